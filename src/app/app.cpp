@@ -212,6 +212,7 @@ void App::initialize(const AppOptions& options)
   PRINTF("Processing options...\n");
 
   bool ignoreEmpty = false;
+  bool mergeDuplicates = false;
 
   // Open file specified in the command line
   if (!options.values().empty()) {
@@ -265,6 +266,10 @@ void App::initialize(const AppOptions& options)
         else if (opt == &options.ignoreEmpty()) {
           ignoreEmpty = true;
         }
+        // --merge-duplicates
+        else if (opt == &options.mergeDuplicates()) {
+          mergeDuplicates = true;
+        }
         // --save-as <filename>
         else if (opt == &options.saveAs()) {
           Document* doc = NULL;
@@ -390,6 +395,9 @@ void App::initialize(const AppOptions& options)
     if (ignoreEmpty)
       m_exporter->setIgnoreEmptyCels(true);
 
+    if (mergeDuplicates)
+      m_exporter->setMergeDuplicates(true);
+
     m_exporter->exportSheet();
     m_exporter.reset(NULL);
   }
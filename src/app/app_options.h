@@ -57,6 +57,7 @@ public:
   const Option& splitLayers() const { return m_splitLayers; }
   const Option& importLayer() const { return m_importLayer; }
   const Option& ignoreEmpty() const { return m_ignoreEmpty; }
+  const Option& mergeDuplicates() const { return m_mergeDuplicates; }
 
   bool hasExporterParams() const;
 
@@ -84,6 +85,7 @@ private:
   Option& m_splitLayers;
   Option& m_importLayer;
   Option& m_ignoreEmpty;
+  Option& m_mergeDuplicates;
 
   Option& m_verbose;
   Option& m_help;
@@ -41,6 +41,8 @@
 #include "doc/sprite.h"
 #include "doc/stock.h"
 
+#include <set>
+
 namespace app {
 
 FlipCommand::FlipCommand()
@@ -95,6 +97,12 @@ void FlipCommand::onExecute(Context* context)
       else if (writer.cel())
         cels.push_back(writer.cel());
 
+      // Linked cels out of the range keep the original image. Linked
+      // cels in the range share the same image, it must be flipped
+      // just once.
+      api.unlinkCels(cels);
+      std::set<int> flipped;
+
       for (Cel* cel : cels) {
         loc.frame(cel->frame());
         loc.layer(cel->layer());
@@ -104,7 +112,8 @@ void FlipCommand::onExecute(Context* context)
         if (!image)
           continue;
 
-        bool alreadyFlipped = false;
+        bool alreadyFlipped = !flipped.insert(cel->imageIndex()).second;
+        bool flippedWithMask = false;
 
         // This variable will be the area to be flipped inside the image.
         gfx::Rect bounds(image->bounds());
@@ -121,15 +130,17 @@ void FlipCommand::onExecute(Context* context)
           // If the mask isn't a rectangular area, we've to flip the mask too.
           if (mask->bitmap() && !mask->isRectangular()) {
             // Flip the portion of image specified by the mask.
-            mask->offsetOrigin(-x, -y);
-            api.flipImageWithMask(writer.layer(), image, mask, m_flipType);
-            mask->offsetOrigin(x, y);
-            alreadyFlipped = true;
+            if (!alreadyFlipped) {
+              mask->offsetOrigin(-x, -y);
+              api.flipImageWithMask(writer.layer(), image, mask, m_flipType);
+              mask->offsetOrigin(x, y);
+            }
+            flippedWithMask = true;
           }
         }
 
         // Flip the portion of image specified by "bounds" variable.
-        if (!alreadyFlipped) {
+        if (!flippedWithMask) {
           api.setCelPosition
             (sprite, cel,
               (m_flipType == doc::algorithm::FlipHorizontal ?
@@ -139,7 +150,8 @@ void FlipCommand::onExecute(Context* context)
                 sprite->height() - image->height() - cel->y():
                 cel->y()));
 
-          api.flipImage(image, bounds, m_flipType);
+          if (!alreadyFlipped)
+            api.flipImage(image, bounds, m_flipType);
         }
       }
 
@@ -164,6 +176,9 @@ void FlipCommand::onExecute(Context* context)
       CelList cels;
       sprite->getCels(cels);
 
+      // images shared by linked cels must be flipped just once
+      std::set<int> flipped;
+
       // for each cel...
       for (CelIterator it = cels.begin(); it != cels.end(); ++it) {
         Cel* cel = *it;
@@ -178,7 +193,8 @@ void FlipCommand::onExecute(Context* context)
             sprite->height() - image->height() - cel->y():
             cel->y()));
 
-        api.flipImage(image, image->bounds(), m_flipType);
+        if (flipped.insert(cel->imageIndex()).second)
+          api.flipImage(image, image->bounds(), m_flipType);
       }
     }
 
@@ -35,16 +35,47 @@
 #include "app/ui/editor/editor.h"
 #include "app/ui/main_window.h"
 #include "app/ui/mini_editor.h"
+#include "app/util/playback_buffer.h"
 #include "doc/image.h"
 #include "doc/palette.h"
 #include "doc/sprite.h"
 
+#include <map>
+#include <utility>
+#include <vector>
+
 namespace app {
 
 // TODO merge this with MiniEditor logic and create a new Editor state
 
 using namespace ui;
 
+// Fills "frames" with the playback order starting from the given
+// frame. The playback repeats the frames from "loopStart" to the end
+// forever.
+static void build_playback_sequence(Sprite* sprite, FrameNumber frame,
+  IDocumentSettings* docSettings,
+  std::vector<FrameNumber>& frames, int& loopStart)
+{
+  // Each state of the playback is the frame and the ping-pong
+  // direction, the sequence ends when a state is repeated.
+  std::map<std::pair<int, bool>, int> visited;
+  bool pingPongForward = true;
+
+  for (;;) {
+    std::pair<int, bool> state((int)frame, pingPongForward);
+    std::map<std::pair<int, bool>, int>::iterator it = visited.find(state);
+    if (it != visited.end()) {
+      loopStart = it->second;
+      break;
+    }
+
+    visited[state] = int(frames.size());
+    frames.push_back(frame);
+    frame = calculate_next_frame(sprite, frame, docSettings, pingPongForward);
+  }
+}
+
 class PlayAniWindow : public Window {
 public:
   PlayAniWindow(Context* context, Editor* editor)
@@ -67,8 +98,24 @@ public:
 
     setFocusStop(true);         // To receive keyboard messages
 
+    // Frames are rendered in a background thread (only the part of
+    // the sprite that is visible in the screen).
+    std::vector<FrameNumber> frames;
+    int loopStart;
+    build_playback_sequence(editor->sprite(), editor->frame(),
+      m_docSettings, frames, loopStart);
+
+    gfx::Rect screen = ui::Manager::getDefault()->getBounds();
+    gfx::Rect visible = editor->zoom().apply(editor->sprite()->bounds());
+    visible = visible.createIntersect(
+      screen.offset(-editor->getBounds().x - editor->offsetX(),
+                    -editor->getBounds().y - editor->offsetY()));
+
+    m_buffer.reset(new PlaybackBuffer(m_doc, frames, loopStart,
+        visible, editor->zoom()));
+
     m_curFrameTick = ui::clock();
-    m_pingPongForward = true;
+    m_pos = 0;
     m_nextFrameTime = editor->sprite()->getFrameDuration(editor->frame());
 
     m_playTimer.Tick.connect(&PlayAniWindow::onPlaybackTick, this);
@@ -81,11 +128,7 @@ protected:
       m_nextFrameTime -= (ui::clock() - m_curFrameTick);
 
       while (m_nextFrameTime <= 0) {
-        FrameNumber frame = calculate_next_frame(
-          m_editor->sprite(),
-          m_editor->frame(),
-          m_docSettings,
-          m_pingPongForward);
+        FrameNumber frame = m_buffer->frameAt(++m_pos);
 
         m_editor->setFrame(frame);
         m_nextFrameTime += m_editor->sprite()->getFrameDuration(frame);
@@ -104,6 +147,10 @@ protected:
         break;
 
       case kCloseMessage:
+        // Stop the background rendering
+        m_playTimer.stop();
+        m_buffer.reset(NULL);
+
         // Restore onionskin flag
         m_docSettings->setUseOnionskin(m_oldOnionskinState);
 
@@ -138,10 +185,16 @@ protected:
       m_editor->getBounds().x + g->getInternalDeltaY(),
       m_editor->getBounds().y + g->getInternalDeltaY());
 
+    const Image* frameImage = (m_buffer ? m_buffer->getFrame(m_pos): NULL);
+    if (frameImage)
+      m_editor->setPrerenderedFrame(frameImage, m_buffer->bounds());
+
     m_editor->drawSpriteUnclippedRect(&subG,
       gfx::Rect(0, 0,
         m_editor->sprite()->width(),
         m_editor->sprite()->height()));
+
+    m_editor->setPrerenderedFrame(NULL, gfx::Rect());
   }
 
 private:
@@ -151,7 +204,8 @@ private:
   Document* m_doc;
   IDocumentSettings* m_docSettings;
   bool m_oldOnionskinState;
-  bool m_pingPongForward;
+  base::UniquePtr<PlaybackBuffer> m_buffer;
+  int m_pos;                    // Position in the playback sequence
 
   int m_nextFrameTime;
   int m_curFrameTick;
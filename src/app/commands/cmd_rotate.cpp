@@ -41,6 +41,8 @@
 #include "doc/stock.h"
 #include "ui/ui.h"
 
+#include <set>
+
 namespace app {
 
 class RotateCommand : public Command {
@@ -91,12 +93,15 @@ protected:
     UndoTransaction undoTransaction(m_writer.context(), "Rotate Canvas");
     DocumentApi api = m_document->getApi();
 
-    // for each cel...
-    int i = 0;
+    // linked cels out of the selected ones keep the original image
+    if (!m_rotateSprite)
+      api.unlinkCels(m_cels);
+
+    // change the location of each cel (before rotating the images,
+    // because linked cels share the same image)
     for (Cel* cel : m_cels) {
       Image* image = cel->image();
       if (image) {
-        // change it location
         switch (m_angle) {
           case 180:
             api.setCelPosition(m_sprite, cel,
@@ -114,8 +119,15 @@ protected:
               m_sprite->width() - cel->x() - image->width());
             break;
         }
+      }
+    }
 
-        // rotate the image
+    // rotate each image just once
+    std::set<int> rotated;
+    int i = 0;
+    for (Cel* cel : m_cels) {
+      Image* image = cel->image();
+      if (image && rotated.insert(cel->imageIndex()).second) {
         Image* new_image = Image::create(image->pixelFormat(),
           m_angle == 180 ? image->width(): image->height(),
           m_angle == 180 ? image->height(): image->width());
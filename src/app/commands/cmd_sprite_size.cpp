@@ -44,6 +44,8 @@
 #include "doc/stock.h"
 #include "ui/ui.h"
 
+#include <set>
+
 #define PERC_FORMAT     "%.1f"
 
 namespace app {
@@ -89,6 +91,9 @@ protected:
     CelList cels;
     m_sprite->getCels(cels);
 
+    // Images shared by linked cels are resized just once
+    std::set<int> resized;
+
     // For each cel...
     int progress = 0;
     for (CelIterator it = cels.begin(); it != cels.end(); ++it, ++progress) {
@@ -99,7 +104,7 @@ protected:
 
       // Get cel's image
       Image* image = cel->image();
-      if (!image)
+      if (!image || !resized.insert(cel->imageIndex()).second)
         continue;
 
       // Resize the image
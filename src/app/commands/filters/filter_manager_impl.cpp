@@ -23,6 +23,8 @@
 #include "app/commands/filters/filter_manager_impl.h"
 
 #include "app/context_access.h"
+#include "app/document.h"
+#include "app/document_api.h"
 #include "app/ini_file.h"
 #include "app/modules/editors.h"
 #include "app/ui/editor/editor.h"
@@ -227,6 +229,17 @@ void FilterManagerImpl::applyToTarget()
   ContextWriter writer(reader);
   UndoTransaction undo(writer.context(), m_filter->getName(), undo::ModifyDocument);
 
+  // Linked cels are in the same layer, so if the filter is applied to
+  // one frame only, the cels of other frames must keep the original
+  // images. (With all frames, linked cels are modified just once
+  // because the collector returns each image once.)
+  if ((m_target & TARGET_ALL_FRAMES) != TARGET_ALL_FRAMES) {
+    CelList cels;
+    for (ImagesCollector::ItemsIterator it = images.begin(); it != images.end(); ++it)
+      cels.push_back(it->cel());
+    writer.document()->getApi().unlinkCels(cels);
+  }
+
   m_progressBase = 0.0f;
   m_progressWidth = 1.0f / images.size();
 
@@ -234,7 +247,7 @@ void FilterManagerImpl::applyToTarget()
   for (ImagesCollector::ItemsIterator it = images.begin();
        it != images.end() && !cancelled;
        ++it) {
-    applyToImage(it->layer(), it->image(), it->cel()->x(), it->cel()->y());
+    applyToImage(it->layer(), it->cel()->image(), it->cel()->x(), it->cel()->y());
 
     // Is there a delegate to know if the process was cancelled by the user?
     if (m_progressDelegate)
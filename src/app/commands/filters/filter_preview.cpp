@@ -23,11 +23,11 @@
 #include "app/commands/filters/filter_preview.h"
 
 #include "app/commands/filters/filter_manager_impl.h"
+#include "app/document.h"
 #include "doc/sprite.h"
 #include "ui/manager.h"
 #include "ui/message.h"
 #include "ui/widget.h"
-#include "app/util/render.h"
 
 namespace app {
 
@@ -75,14 +75,15 @@ bool FilterPreview::onProcessMessage(Message* msg)
   switch (msg->type()) {
 
     case kOpenMessage:
-      RenderEngine::setPreviewImage(
+      m_filterMgr->document()->setPreviewImage(
         m_filterMgr->layer(),
         m_filterMgr->frame(),
         m_filterMgr->destinationImage());
       break;
 
     case kCloseMessage:
-      RenderEngine::setPreviewImage(NULL, FrameNumber(0), NULL);
+      if (m_filterMgr)
+        m_filterMgr->document()->setPreviewImage(NULL, FrameNumber(0), NULL);
 
       // Stop the preview timer.
       m_timer.stop();
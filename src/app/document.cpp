@@ -30,6 +30,9 @@
 #include "app/undoers/add_image.h"
 #include "app/undoers/add_layer.h"
 #include "app/util/boundary.h"
+#include "app/util/render_frame_cache.h"
+#include "app/util/render_mipmap_cache.h"
+#include "app/util/render_tile_cache.h"
 #include "base/memory.h"
 #include "base/mutex.h"
 #include "base/scoped_lock.h"
@@ -43,6 +46,8 @@
 #include "doc/sprite.h"
 #include "doc/stock.h"
 
+#include <map>
+
 namespace app {
 
 using namespace base;
@@ -60,6 +65,10 @@ Document::Document(Sprite* sprite)
   , m_extraCel(NULL)
   , m_extraImage(NULL)
   , m_extraCelBlendMode(BLEND_MODE_NORMAL)
+    // Preview image
+  , m_previewLayer(NULL)
+  , m_previewFrame(0)
+  , m_previewImage(NULL)
   // Mask
   , m_mask(new Mask())
   , m_maskVisible(true)
@@ -87,6 +96,9 @@ Document::~Document()
     base_free(m_bound.seg);
 
   destroyExtraCel();
+  m_renderTileCache.reset(NULL);
+  m_renderMipmapCache.reset(NULL);
+  m_renderFrameCache.reset(NULL);
 }
 
 DocumentApi Document::getApi(undo::UndoersCollector* undoers)
@@ -271,6 +283,43 @@ Image* Document::getExtraCelImage() const
   return m_extraImage;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Preview Image
+
+void Document::setPreviewImage(const Layer* layer, FrameNumber frame, Image* image)
+{
+  m_previewLayer = layer;
+  m_previewFrame = frame;
+  m_previewImage = image;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Render cache
+
+RenderTileCache* Document::renderTileCache()
+{
+  if (!m_renderTileCache)
+    m_renderTileCache.reset(new RenderTileCache(this));
+
+  return m_renderTileCache;
+}
+
+RenderMipmapCache* Document::renderMipmapCache()
+{
+  if (!m_renderMipmapCache)
+    m_renderMipmapCache.reset(new RenderMipmapCache);
+
+  return m_renderMipmapCache;
+}
+
+RenderFrameCache* Document::renderFrameCache()
+{
+  if (!m_renderFrameCache)
+    m_renderFrameCache.reset(new RenderFrameCache);
+
+  return m_renderFrameCache;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Mask
 
@@ -332,6 +381,10 @@ void Document::copyLayerContent(const Layer* sourceLayer0, Document* destDoc, La
     CelConstIterator it = sourceLayer->getCelBegin();
     CelConstIterator end = sourceLayer->getCelEnd();
 
+    // Linked cels (cels sharing the same image) are kept linked in
+    // the copy, so each source image is copied just once.
+    std::map<int, int> linkedImages;
+
     for (; it != end; ++it) {
       const Cel* sourceCel = *it;
       if (sourceCel->frame() > destLayer->sprite()->lastFrame())
@@ -339,11 +392,19 @@ void Document::copyLayerContent(const Layer* sourceLayer0, Document* destDoc, La
 
       base::UniquePtr<Cel> newCel(new Cel(*sourceCel));
 
-      const Image* sourceImage = sourceCel->image();
-      ASSERT(sourceImage != NULL);
+      std::map<int, int>::iterator linked = linkedImages.find(sourceCel->imageIndex());
+      if (linked != linkedImages.end()) {
+        newCel->setImage(linked->second);
+      }
+      else {
+        const Image* sourceImage = sourceCel->image();
+        ASSERT(sourceImage != NULL);
+
+        Image* newImage = Image::createCopy(sourceImage);
+        newCel->setImage(destLayer->sprite()->stock()->addImage(newImage));
 
-      Image* newImage = Image::createCopy(sourceImage);
-      newCel->setImage(destLayer->sprite()->stock()->addImage(newImage));
+        linkedImages[sourceCel->imageIndex()] = newCel->imageIndex();
+      }
 
       destLayer->addCel(newCel);
       newCel.release();
@@ -523,6 +584,12 @@ void Document::unlock()
 
   if (m_write_lock) {
     m_write_lock = false;
+
+    // No other thread is using the images now, so lazy images that
+    // weren't used recently can be unloaded (except the ones that
+    // undoers reference by pointer).
+    if (m_read_locks == 0 && sprite())
+      sprite()->stock()->unloadOldImages(m_undo);
   }
   else if (m_read_locks > 0) {
     --m_read_locks;
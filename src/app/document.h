@@ -56,6 +56,9 @@ namespace undo {
 namespace app {
   class DocumentApi;
   class DocumentUndo;
+  class RenderFrameCache;
+  class RenderMipmapCache;
+  class RenderTileCache;
   struct BoundSeg;
 
   using namespace doc;
@@ -135,6 +138,32 @@ namespace app {
     int getExtraCelBlendMode() const { return m_extraCelBlendMode; }
     void setExtraCelBlendMode(int mode) { m_extraCelBlendMode = mode; }
 
+    //////////////////////////////////////////////////////////////////////
+    // Preview Image (it is rendered instead of the cel image of the
+    // given layer/frame, e.g. to show the result of a filter or the
+    // destination image of a tool loop)
+
+    void setPreviewImage(const Layer* layer, FrameNumber frame, Image* image);
+    const Layer* getPreviewLayer() const { return m_previewLayer; }
+    FrameNumber getPreviewFrame() const { return m_previewFrame; }
+    Image* getPreviewImage() const { return m_previewImage; }
+
+    //////////////////////////////////////////////////////////////////////
+    // Render cache
+
+    // Composited tiles used by the editors to redraw the sprite
+    // (created the first time it's used).
+    RenderTileCache* renderTileCache();
+
+    // Reduced versions of the images used by the editors to render
+    // the sprite with zoom levels below 100% (created the first time
+    // it's used).
+    RenderMipmapCache* renderMipmapCache();
+
+    // Whole frames used by the editors to draw the onion-skin
+    // (created the first time it's used).
+    RenderFrameCache* renderFrameCache();
+
     //////////////////////////////////////////////////////////////////////
     // Mask
 
@@ -222,6 +251,15 @@ namespace app {
     Image* m_extraImage;
     int m_extraCelBlendMode;
 
+    // Image used instead of the cel image of m_previewLayer/Frame.
+    const Layer* m_previewLayer;
+    FrameNumber m_previewFrame;
+    Image* m_previewImage;
+
+    base::UniquePtr<RenderTileCache> m_renderTileCache;
+    base::UniquePtr<RenderMipmapCache> m_renderMipmapCache;
+    base::UniquePtr<RenderFrameCache> m_renderFrameCache;
+
     // Current mask.
     base::UniquePtr<Mask> m_mask;
     bool m_maskVisible;
@@ -44,6 +44,7 @@
 #include "app/undoers/remove_palette.h"
 #include "app/undoers/replace_image.h"
 #include "app/undoers/set_cel_frame.h"
+#include "app/undoers/set_cel_image.h"
 #include "app/undoers/set_cel_opacity.h"
 #include "app/undoers/set_cel_position.h"
 #include "app/undoers/set_frame_duration.h"
@@ -76,6 +77,9 @@
 #include "doc/sprite.h"
 #include "doc/stock.h"
 
+#include <map>
+#include <set>
+
 namespace app {
 
 DocumentApi::DocumentApi(Document* document, undo::UndoersCollector* undoers)
@@ -658,15 +662,72 @@ void DocumentApi::cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h)
   Image* cel_image = cel->image();
   ASSERT(cel_image);
 
+  int dx = x - cel->x();
+  int dy = y - cel->y();
+
   // create the new image through a crop
   Image* new_image = crop_image(cel_image,
-    x-cel->x(), y-cel->y(), w, h, bgColor(cel->layer()));
+    dx, dy, w, h, bgColor(cel->layer()));
 
   // replace the image in the stock that is pointed by the cel
   replaceStockImage(sprite, cel->imageIndex(), new_image);
 
-  // update the cel's position
-  setCelPosition(sprite, cel, x, y);
+  // update the position of the cel and of the cels linked to the
+  // same image (so they keep their pixels in the same place)
+  CelList cels;
+  sprite->getCels(cels);
+  for (Cel* other : cels) {
+    if (other->imageIndex() == cel->imageIndex())
+      setCelPosition(sprite, other, other->x()+dx, other->y()+dy);
+  }
+}
+
+// Gives a copy of the image to a cel that shares its image with other
+// (linked) cels, so the image can be modified just for this cel.
+Image* DocumentApi::unlinkCel(Cel* cel)
+{
+  ASSERT(cel);
+
+  CelList cels;
+  cels.push_back(cel);
+  unlinkCels(cels);
+  return cel->image();
+}
+
+void DocumentApi::unlinkCels(const CelList& cels)
+{
+  if (cels.empty())
+    return;
+
+  Sprite* sprite = cels.front()->layer()->sprite();
+
+  // References to each image from the given cels
+  std::map<int, size_t> refs;
+  for (Cel* cel : cels)
+    if (cel->imageIndex() != 0)
+      ++refs[cel->imageIndex()];
+
+  // Images that are used by other cels too are copied
+  std::map<int, int> copies;
+  for (Cel* cel : cels) {
+    int imageIndex = cel->imageIndex();
+    if (imageIndex == 0)
+      continue;
+
+    std::map<int, int>::iterator it = copies.find(imageIndex);
+    if (it == copies.end()) {
+      if (sprite->getImageRefs(imageIndex) <= refs[imageIndex])
+        continue;
+
+      int copyIndex = addImageInStock(sprite, Image::createCopy(cel->image()));
+      it = copies.insert(std::make_pair(imageIndex, copyIndex)).first;
+    }
+
+    if (undoEnabled())
+      m_undoers->pushUndoer(new undoers::SetCelImage(getObjects(), cel));
+
+    cel->setImage(it->second);
+  }
 }
 
 void DocumentApi::clearCel(LayerImage* layer, FrameNumber frame)
@@ -688,7 +749,7 @@ void DocumentApi::clearCel(Cel* cel)
   if (cel->layer()->isBackground()) {
     ASSERT(image);
     if (image)
-      clearImage(image, bgColor(cel->layer()));
+      clearImage(unlinkCel(cel), bgColor(cel->layer()));
   }
   else {
     removeCel(cel);
@@ -726,11 +787,11 @@ void DocumentApi::moveCel(
           int blend = (srcLayer->isBackground() ?
             BLEND_MODE_COPY: BLEND_MODE_NORMAL);
 
-          composite_image(dstImage, srcImage,
+          composite_image(unlinkCel(dstCel), srcImage,
             srcCel->x(), srcCel->y(), 255, blend);
         }
 
-        clearImage(srcImage, bgColor(srcLayer));
+        clearImage(unlinkCel(srcCel), bgColor(srcLayer));
       }
       // Move the cel in the same layer.
       else {
@@ -792,7 +853,7 @@ void DocumentApi::copyCel(
         int blend = (srcLayer->isBackground() ?
           BLEND_MODE_COPY: BLEND_MODE_NORMAL);
 
-        composite_image(dstImage, srcImage,
+        composite_image(unlinkCel(dstCel), srcImage,
           srcCel->x(), srcCel->y(), 255, blend);
       }
     }
@@ -934,10 +995,17 @@ void DocumentApi::cropLayer(Layer* layer, int x, int y, int w, int h)
     return;
 
   Sprite* sprite = layer->sprite();
+
+  // Linked cels share the same image, it's cropped just once
+  // (cropCel() moves all the linked cels)
+  std::set<int> cropped;
+
   CelIterator it = ((LayerImage*)layer)->getCelBegin();
   CelIterator end = ((LayerImage*)layer)->getCelEnd();
-  for (; it != end; ++it)
-    cropCel(sprite, *it, x, y, w, h);
+  for (; it != end; ++it) {
+    if (cropped.insert((*it)->imageIndex()).second)
+      cropCel(sprite, *it, x, y, w, h);
+  }
 }
 
 // Moves every frame in @a layer with the offset (@a dx, @a dy).
@@ -985,11 +1053,33 @@ void DocumentApi::backgroundFromLayer(LayerImage* layer)
                                                sprite->height()));
   Image* bg_image = bg_image_wrap.get();
 
+  // Linked cels with the same position and opacity produce the same
+  // background image, so their shared image is converted just once.
+  // Other linked cels need their own copy of the image.
+  std::map<int, Cel*> firstCels;
   CelIterator it = layer->getCelBegin();
   CelIterator end = layer->getCelEnd();
-
   for (; it != end; ++it) {
     Cel* cel = *it;
+    Cel*& first = firstCels[cel->imageIndex()];
+    if (!first)
+      first = cel;
+    else if (first->x() != cel->x() ||
+             first->y() != cel->y() ||
+             first->opacity() != cel->opacity())
+      unlinkCel(cel);
+  }
+
+  std::set<int> converted;
+
+  for (it = layer->getCelBegin(); it != end; ++it) {
+    Cel* cel = *it;
+
+    // The shared image was already converted
+    if (!converted.insert(cel->imageIndex()).second) {
+      setCelPosition(sprite, cel, 0, 0);
+      continue;
+    }
 
     // get the image from the sprite's stock of images
     Image* cel_image = cel->image();
@@ -1037,6 +1127,76 @@ void DocumentApi::backgroundFromLayer(LayerImage* layer)
   configureLayerAsBackground(layer);
 }
 
+// Merges the cels of "srcLayer" in the layer below it and removes
+// "srcLayer". New areas of the destination cels are filled with
+// "bgcolor".
+void DocumentApi::mergeDownLayer(LayerImage* srcLayer, color_t bgcolor)
+{
+  Sprite* sprite = srcLayer->sprite();
+  LayerImage* dstLayer = static_cast<LayerImage*>(srcLayer->getPrevious());
+  ASSERT(dstLayer && dstLayer->isImage());
+
+  for (FrameNumber frame(0); frame<sprite->totalFrames(); ++frame) {
+    Cel* src_cel = srcLayer->getCel(frame);
+    Cel* dst_cel = dstLayer->getCel(frame);
+
+    Image* src_image = (src_cel ? src_cel->image(): NULL);
+    if (!src_image)
+      continue;
+
+    // No destination cel, copy the source cel to the destination layer
+    if (!dst_cel) {
+      int index = addImageInStock(sprite, Image::createCopy(src_image));
+
+      dst_cel = new Cel(frame, index);
+      dst_cel->setPosition(src_cel->x(), src_cel->y());
+      dst_cel->setOpacity(src_cel->opacity());
+      addCel(dstLayer, dst_cel);
+      continue;
+    }
+
+    // The destination image is replaced, so if it's shared with other
+    // (linked) cels, this cel needs its own copy.
+    unlinkCel(dst_cel);
+    Image* dst_image = dst_cel->image();
+
+    int x1, y1, x2, y2;
+
+    // Merge down in the background layer
+    if (dstLayer->isBackground()) {
+      x1 = 0;
+      y1 = 0;
+      x2 = sprite->width();
+      y2 = sprite->height();
+    }
+    // Merge down in a transparent layer
+    else {
+      x1 = MIN(src_cel->x(), dst_cel->x());
+      y1 = MIN(src_cel->y(), dst_cel->y());
+      x2 = MAX(src_cel->x()+src_image->width()-1, dst_cel->x()+dst_image->width()-1);
+      y2 = MAX(src_cel->y()+src_image->height()-1, dst_cel->y()+dst_image->height()-1);
+    }
+
+    Image* new_image = crop_image(dst_image,
+      x1-dst_cel->x(),
+      y1-dst_cel->y(),
+      x2-x1+1, y2-y1+1, bgcolor);
+
+    // Merge src_image in new_image
+    composite_image(new_image, src_image,
+      src_cel->x()-x1,
+      src_cel->y()-y1,
+      src_cel->opacity(),
+      srcLayer->getBlendMode());
+
+    setCelPosition(sprite, dst_cel, x1, y1);
+    replaceStockImage(sprite, dst_cel->imageIndex(), new_image);
+  }
+
+  m_document->notifyLayerMergedDown(srcLayer, dstLayer);
+  removeLayer(srcLayer); // srcLayer is deleted inside removeLayer()
+}
+
 void DocumentApi::layerFromBackground(Layer* layer)
 {
   ASSERT(layer != NULL);
@@ -1088,7 +1248,9 @@ void DocumentApi::flattenLayers(Sprite* sprite)
 
     cel = background->getCel(frame);
     if (cel) {
-      cel_image = cel->image();
+      // Linked cels of other frames are rendered with the original
+      // image, so this cel needs its own copy.
+      cel_image = unlinkCel(cel);
       ASSERT(cel_image != NULL);
 
       // We have to save the current state of `cel_image' in the undo.
@@ -1249,6 +1411,9 @@ void DocumentApi::clearMask(Cel* cel)
   if (x1 > x2 || y1 > y2)
     return;
 
+  // Other linked cels must keep the original image
+  image = unlinkCel(cel);
+
   if (undoEnabled())
     m_undoers->pushUndoer(new undoers::ImageArea(getObjects(),
         image, x1, y1, x2-x1+1, y2-y1+1));
@@ -1308,7 +1473,7 @@ void DocumentApi::pasteImage(Sprite* sprite, Cel* cel, const Image* src_image, i
 {
   ASSERT(cel != NULL);
 
-  Image* cel_image = cel->image();
+  Image* cel_image = unlinkCel(cel);
   Image* cel_image2 = Image::createCopy(cel_image);
   composite_image(cel_image2, src_image, x-cel->x(), y-cel->y(), opacity, BLEND_MODE_NORMAL);
 
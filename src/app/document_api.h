@@ -22,6 +22,7 @@
 
 #include "gfx/rect.h"
 #include "doc/algorithm/flip_type.h"
+#include "doc/cel_list.h"
 #include "doc/color.h"
 #include "doc/dithering_method.h"
 #include "doc/frame_number.h"
@@ -84,6 +85,14 @@ namespace app {
     void setCelPosition(Sprite* sprite, Cel* cel, int x, int y);
     void setCelOpacity(Sprite* sprite, Cel* cel, int newOpacity);
     void cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h);
+
+    // Linked cels (cels that share their image with other cels) get
+    // their own copy of the image, so it can be modified without
+    // modifying the other cels. Cels of the list that share the same
+    // image keep sharing the copy. Returns the new cel image.
+    Image* unlinkCel(Cel* cel);
+    void unlinkCels(const CelList& cels);
+
     void moveCel(
       LayerImage* srcLayer, FrameNumber srcFrame,
       LayerImage* dstLayer, FrameNumber dstFrame);
@@ -103,6 +112,7 @@ namespace app {
     void cropLayer(Layer* layer, int x, int y, int w, int h);
     void displaceLayers(Layer* layer, int dx, int dy);
     void backgroundFromLayer(LayerImage* layer);
+    void mergeDownLayer(LayerImage* srcLayer, color_t bgcolor);
     void layerFromBackground(Layer* layer);
     void flattenLayers(Sprite* sprite);
     void duplicateLayerAfter(Layer* sourceLayer, Layer* afterLayer);
@@ -19,11 +19,17 @@
 #include "tests/test.h"
 
 #include "app/document_api.h"
+#include "app/document_undo.h"
 #include "app/test_context.h"
+#include "app/undo_transaction.h"
 #include "base/unique_ptr.h"
 #include "doc/cel.h"
+#include "doc/color.h"
 #include "doc/image.h"
+#include "doc/layer.h"
 #include "doc/primitives.h"
+#include "doc/sprite.h"
+#include "doc/stock.h"
 
 using namespace app;
 using namespace doc;
@@ -70,3 +76,204 @@ TEST(DocumentApi, MoveCel) {
 
   doc->close();
 }
+
+TEST(DocumentApi, MergeDownLayerWithLinkedCels) {
+  TestContext ctx;
+  DocumentPtr doc(static_cast<app::Document*>(ctx.documents().add(4, 4)));
+  Sprite* sprite = doc->sprite();
+  LayerImage* layer1 = static_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+  sprite->setTotalFrames(FrameNumber(2));
+
+  // Two cels linked to the same image
+  Cel* cel0 = layer1->getCel(FrameNumber(0));
+  Cel* cel1 = new Cel(FrameNumber(1), cel0->imageIndex());
+  layer1->addCel(cel1);
+
+  // Each frame of the layer above has a pixel in a different place
+  LayerImage* layer2 = new LayerImage(sprite);
+  sprite->folder()->addLayer(layer2);
+  for (int i=0; i<2; ++i) {
+    Image* image = Image::create(IMAGE_RGB, 1, 1);
+    clear_image(image, rgba(255, 0, 0, 255));
+    Cel* cel = doc->getApi().addImage(layer2, FrameNumber(i), image);
+    cel->setPosition(i, 0);
+  }
+
+  doc->getApi().mergeDownLayer(layer2, 0);
+
+  EXPECT_EQ(1, (int)sprite->countLayers());
+  EXPECT_NE(cel0->imageIndex(), cel1->imageIndex());
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(cel0->image(), 0, 0));
+  EXPECT_EQ(0, get_pixel(cel0->image(), 1, 0));
+  EXPECT_EQ(0, get_pixel(cel1->image(), 0, 0));
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(cel1->image(), 1, 0));
+
+  doc->close();
+}
+
+TEST(DocumentApi, CropLayerWithLinkedCels) {
+  TestContext ctx;
+  DocumentPtr doc(static_cast<app::Document*>(ctx.documents().add(4, 4)));
+  Sprite* sprite = doc->sprite();
+  LayerImage* layer1 = static_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+  sprite->setTotalFrames(FrameNumber(2));
+
+  Cel* cel0 = layer1->getCel(FrameNumber(0));
+  put_pixel(cel0->image(), 2, 2, rgba(255, 0, 0, 255));
+
+  // A linked cel in other position
+  Cel* cel1 = new Cel(FrameNumber(1), cel0->imageIndex());
+  cel1->setPosition(1, 0);
+  layer1->addCel(cel1);
+
+  doc->getApi().cropLayer(layer1, 1, 1, 2, 2);
+
+  // The shared image is cropped just once
+  EXPECT_EQ(cel0->imageIndex(), cel1->imageIndex());
+  Image* image = cel0->image();
+  EXPECT_EQ(2, image->width());
+  EXPECT_EQ(2, image->height());
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(image, 1, 1));
+  EXPECT_EQ(1, cel0->x());
+  EXPECT_EQ(1, cel0->y());
+  EXPECT_EQ(2, cel1->x());
+  EXPECT_EQ(1, cel1->y());
+
+  doc->close();
+}
+
+TEST(DocumentApi, BackgroundFromLayerWithLinkedCels) {
+  TestContext ctx;
+  DocumentPtr doc(static_cast<app::Document*>(ctx.documents().add(4, 4)));
+  Sprite* sprite = doc->sprite();
+  LayerImage* layer1 = static_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+  sprite->setTotalFrames(FrameNumber(3));
+
+  Cel* cel0 = layer1->getCel(FrameNumber(0));
+  cel0->setOpacity(128);
+  put_pixel(cel0->image(), 0, 0, rgba(255, 0, 0, 255));
+
+  // Cel linked with the same position/opacity, and other in a
+  // different position
+  Cel* cel1 = new Cel(FrameNumber(1), cel0->imageIndex());
+  cel1->setOpacity(128);
+  layer1->addCel(cel1);
+  Cel* cel2 = new Cel(FrameNumber(2), cel0->imageIndex());
+  cel2->setPosition(1, 0);
+  cel2->setOpacity(128);
+  layer1->addCel(cel2);
+
+  doc->getApi().backgroundFromLayer(layer1);
+
+  EXPECT_TRUE(layer1->isBackground());
+  EXPECT_EQ(cel0->imageIndex(), cel1->imageIndex());
+  EXPECT_NE(cel0->imageIndex(), cel2->imageIndex());
+  EXPECT_EQ(0, cel1->x());
+  EXPECT_EQ(0, cel2->x());
+
+  // The red pixel is composited just once in each image
+  color_t color = get_pixel(cel0->image(), 0, 0);
+  EXPECT_NE(rgba(255, 0, 0, 255), color);
+  EXPECT_EQ(color, get_pixel(cel2->image(), 1, 0));
+  EXPECT_NE(color, get_pixel(cel0->image(), 1, 0));
+
+  doc->close();
+}
+
+TEST(DocumentApi, UnlinkCels) {
+  TestContext ctx;
+  DocumentPtr doc(static_cast<app::Document*>(ctx.documents().add(4, 4)));
+  Sprite* sprite = doc->sprite();
+  LayerImage* layer1 = static_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+  sprite->setTotalFrames(FrameNumber(3));
+
+  // Three cels linked to the same image
+  Cel* cel0 = layer1->getCel(FrameNumber(0));
+  int index = cel0->imageIndex();
+  Cel* cel1 = new Cel(FrameNumber(1), index);
+  Cel* cel2 = new Cel(FrameNumber(2), index);
+  layer1->addCel(cel1);
+  layer1->addCel(cel2);
+  put_pixel(cel0->image(), 0, 0, rgba(255, 0, 0, 255));
+
+  // The two first cels share a copy of the image
+  CelList cels;
+  cels.push_back(cel0);
+  cels.push_back(cel1);
+  doc->getApi().unlinkCels(cels);
+
+  EXPECT_NE(index, cel0->imageIndex());
+  EXPECT_EQ(cel0->imageIndex(), cel1->imageIndex());
+  EXPECT_EQ(index, cel2->imageIndex());
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(cel0->image(), 0, 0));
+
+  // Nothing to do when the image is not shared with other cels
+  doc->getApi().unlinkCels(cels);
+  EXPECT_EQ(cel0->imageIndex(), cel1->imageIndex());
+  EXPECT_EQ(index, cel2->imageIndex());
+
+  // Clearing a background cel doesn't clear its linked cels
+  layer1->setBackground(true);
+  EXPECT_EQ(cel0->image(), doc->getApi().unlinkCel(cel0));
+  doc->getApi().clearCel(cel1);
+  EXPECT_NE(cel0->imageIndex(), cel1->imageIndex());
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(cel0->image(), 0, 0));
+  EXPECT_NE(rgba(255, 0, 0, 255), get_pixel(cel1->image(), 0, 0));
+
+  doc->close();
+}
+
+// Loads images of 4x4 pixels with the index as the first pixel.
+class TestStockLoader : public StockLoader {
+public:
+  Image* loadImage(int index) override {
+    Image* image = Image::create(IMAGE_RGB, 4, 4);
+    clear_image(image, 0);
+    put_pixel(image, 0, 0, index);
+    return image;
+  }
+};
+
+TEST(DocumentApi, UndoEditOfUnloadedLazyImage) {
+  TestContext ctx;
+  DocumentPtr doc(static_cast<app::Document*>(ctx.documents().add(4, 4)));
+  Sprite* sprite = doc->sprite();
+  Stock* stock = sprite->stock();
+  LayerImage* layer1 = static_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+  Cel* cel = layer1->getCel(FrameNumber(0));
+  int index = cel->imageIndex();
+
+  stock->setLoader(new TestStockLoader);
+  stock->setMaxLoadedBytes(0);
+
+  Image* image = cel->image();
+  clear_image(image, 0);
+  put_pixel(image, 0, 0, index);
+  stock->setLazyImage(index);
+
+  {
+    UndoTransaction undo(&ctx, "Flip");
+    doc->getApi().flipImage(image, image->bounds(),
+                            doc::algorithm::FlipHorizontal);
+    undo.commit();
+  }
+  EXPECT_EQ(index, (int)get_pixel(image, 3, 0));
+
+  // Simulate a save of the flipped image, so it's an unmodified lazy
+  // image again, and try to unload it.
+  stock->setLazyImage(index);
+  for (int i=0; i<2; ++i) {
+    doc->lock(app::Document::WriteLock);
+    doc->unlock();
+  }
+
+  // The undo history references the image, so it cannot be unloaded.
+  EXPECT_EQ(image, stock->getLoadedImage(index));
+
+  doc->getUndo()->doUndo();
+  EXPECT_EQ(image, cel->image());
+  EXPECT_EQ(index, (int)get_pixel(image, 0, 0));
+  EXPECT_EQ(0, (int)get_pixel(image, 3, 0));
+
+  doc->close();
+}
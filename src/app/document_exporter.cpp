@@ -28,9 +28,10 @@
 #include "app/file/file.h"
 #include "app/ui_context.h"
 #include "base/convert_to.h"
+#include "base/parallel_for.h"
 #include "base/path.h"
+#include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
-#include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/dithering_method.h"
 #include "doc/image.h"
@@ -42,9 +43,11 @@
 #include "gfx/packing_rects.h"
 #include "gfx/size.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <map>
 
 using namespace doc;
 
@@ -58,7 +61,8 @@ public:
     m_sprite(sprite),
     m_layer(layer),
     m_frame(frame),
-    m_filename(filename) {
+    m_filename(filename),
+    m_original(NULL) {
   }
 
   Document* document() const { return m_document; }
@@ -70,6 +74,12 @@ public:
   const gfx::Rect& trimmedBounds() const { return m_trimmedBounds; }
   const gfx::Rect& inTextureBounds() const { return m_inTextureBounds; }
 
+  // Returns the sample with the same content that is already in the
+  // texture (when duplicates are merged), or NULL if this is a unique
+  // sample.
+  const Sample* original() const { return m_original; }
+  bool isDuplicated() const { return m_original != NULL; }
+
   bool trimmed() const {
     return m_trimmedBounds.x > 0
       || m_trimmedBounds.y > 0
@@ -80,6 +90,11 @@ public:
   void setOriginalSize(const gfx::Size& size) { m_originalSize = size; }
   void setTrimmedBounds(const gfx::Rect& bounds) { m_trimmedBounds = bounds; }
   void setInTextureBounds(const gfx::Rect& bounds) { m_inTextureBounds = bounds; }
+  void setOriginal(const Sample* original) { m_original = original; }
+
+  // Render of the sample made in captureSamples() (it can be NULL).
+  Image* image() const { return m_image.get(); }
+  void setImage(Image* image) { m_image.reset(image); }
 
 private:
   Document* m_document;
@@ -90,6 +105,8 @@ private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   gfx::Rect m_inTextureBounds;
+  const Sample* m_original;
+  SharedPtr<Image> m_image;
 };
 
 class DocumentExporter::Samples {
@@ -100,8 +117,9 @@ public:
 
   bool empty() const { return m_samples.empty(); }
 
-  void addSample(const Sample& sample) {
+  Sample& addSample(const Sample& sample) {
     m_samples.push_back(sample);
+    return m_samples.back();
   }
 
   iterator begin() { return m_samples.begin(); }
@@ -128,6 +146,9 @@ public:
 
     gfx::Point framePt(0, 0);
     for (auto& sample : samples) {
+      if (sample.isDuplicated())
+        continue;
+
       const Sprite* sprite = sample.sprite();
       const Layer* layer = sample.layer();
       gfx::Size size(sprite->width(), sprite->height());
@@ -172,6 +193,9 @@ public:
     gfx::PackingRects pr;
 
     for (auto& sample : samples) {
+      if (sample.isDuplicated())
+        continue;
+
       const Sprite* sprite = sample.sprite();
       gfx::Size size(sprite->width(), sprite->height());
 
@@ -191,6 +215,9 @@ public:
 
     auto it = samples.begin();
     for (auto& rc : pr) {
+      while (it != samples.end() && it->isDuplicated())
+        ++it;
+
       ASSERT(it != samples.end());
       it->setInTextureBounds(rc);
       ++it;
@@ -207,6 +234,7 @@ DocumentExporter::DocumentExporter()
  , m_scale(1.0)
  , m_scaleMode(DefaultScaleMode)
  , m_ignoreEmptyCels(false)
+ , m_mergeDuplicates(false)
 {
 }
 
@@ -243,6 +271,15 @@ void DocumentExporter::exportSheet()
     layout.layoutSamples(samples, m_textureWidth, m_textureHeight);
   }
 
+  // Duplicated samples point to the same place of their originals.
+  for (auto& sample : samples) {
+    if (const Sample* original = sample.original()) {
+      sample.setOriginalSize(original->originalSize());
+      sample.setTrimmedBounds(original->trimmedBounds());
+      sample.setInTextureBounds(original->inTextureBounds());
+    }
+  }
+
   // 3) Create and render the texture.
   base::UniquePtr<Document> textureDocument(
     createEmptyTexture(samples));
@@ -266,8 +303,7 @@ void DocumentExporter::exportSheet()
 
 void DocumentExporter::captureSamples(Samples& samples)
 {
-  ImageBufferPtr checkEmptyImageBuf;
-  std::vector<char> buf(32);
+  std::vector<Sample> candidates;
 
   for (auto& item : m_documents) {
     Document* doc = item.doc;
@@ -292,36 +328,76 @@ void DocumentExporter::captureSamples(Samples& samples)
             + "." + base::get_file_extension(filename));
       }
 
-      Sample sample(doc, sprite, layer, frame, filename);
-
       if (m_ignoreEmptyCels) {
         if (layer && layer->isImage() &&
             !static_cast<LayerImage*>(layer)->getCel(frame)) {
           // Empty cel this sample completely
           continue;
         }
+      }
+
+      candidates.push_back(Sample(doc, sprite, layer, frame, filename));
+    }
+  }
+
+  if (!m_ignoreEmptyCels && !m_mergeDuplicates) {
+    for (const auto& sample : candidates)
+      samples.addSample(sample);
+    return;
+  }
 
-        base::UniquePtr<Image> checkEmptyImage(
-          Image::create(sprite->pixelFormat(),
-            sprite->width(),
-            sprite->height(),
-            checkEmptyImageBuf));
-
-        checkEmptyImage->setMaskColor(sprite->transparentColor());
-        clear_image(checkEmptyImage, sprite->transparentColor());
-        renderSample(sample, checkEmptyImage, 0, 0);
-
-        gfx::Rect frameBounds;
-        if (!algorithm::shrink_bounds(checkEmptyImage, frameBounds,
-            sprite->transparentColor())) {
-          // If shrink_bounds returns false, it's because the whole
-          // image is transparent (equal to the mask color).
+  // Render all candidates in parallel. The renders are kept in the
+  // samples so renderTexture() doesn't need to render them again.
+  base::parallel_for(0, int(candidates.size()),
+    [this, &candidates](int i) {
+      Image* image = createSampleImage(candidates[i]);
+      candidates[i].setImage(image);
+      if (m_mergeDuplicates)
+        image->contentHash();
+    });
+
+  // Content hash of each unique sample, used to find duplicates.
+  std::multimap<uint64_t, const Sample*> uniqueSamples;
+
+  for (auto& sample : candidates) {
+    const Sprite* sprite = sample.sprite();
+    Image* sampleImage = sample.image();
+
+    if (m_ignoreEmptyCels) {
+      // The sample image uses the transparent color as mask color,
+      // so it's empty if it doesn't have visible pixels.
+      if (sampleImage->visibleBounds().isEmpty())
+        continue;
+    }
+
+    if (m_mergeDuplicates) {
+      uint64_t hash = sampleImage->contentHash();
+      auto range = uniqueSamples.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        const Sample* other = it->second;
+
+        // Indexed samples are equal only if they use the same colors.
+        if (sprite->pixelFormat() == IMAGE_INDEXED &&
+            other->sprite()->pixelFormat() == IMAGE_INDEXED &&
+            sprite->getPalette(sample.frame())->countDiff(
+              other->sprite()->getPalette(other->frame()), NULL, NULL) > 0)
           continue;
+
+        // Different images can have the same hash, so we have to
+        // compare the pixels too.
+        if (is_same_image(sampleImage, other->image())) {
+          sample.setOriginal(other);
+          sample.setImage(NULL);
+          break;
         }
       }
 
-      samples.addSample(sample);
+      const Sample& added = samples.addSample(sample);
+      if (!added.isDuplicated())
+        uniqueSamples.insert(std::make_pair(hash, &added));
     }
+    else
+      samples.addSample(sample);
   }
 }
 
@@ -372,7 +448,12 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
 {
   textureImage->clear(0);
 
+  std::vector<const Sample*> toRender;
   for (const auto& sample : samples) {
+    // Duplicated samples are already in the texture.
+    if (sample.isDuplicated())
+      continue;
+
     // Make the sprite compatible with the texture so the render()
     // works correctly.
     if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
@@ -383,11 +464,45 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
         DITHERING_NONE);
     }
 
-    int x = sample.inTextureBounds().x - sample.trimmedBounds().x;
-    int y = sample.inTextureBounds().y - sample.trimmedBounds().y;
-
-    renderSample(sample, textureImage, x, y);
+    toRender.push_back(&sample);
   }
+
+  // Each sample is rendered in its own image and then copied to its
+  // area of the texture. These areas don't overlap, so the samples
+  // can be processed in parallel.
+  base::parallel_for(0, int(toRender.size()),
+    [this, &toRender, textureImage](int i) {
+      const Sample& sample = *toRender[i];
+      const Image* src = sample.image();
+      base::UniquePtr<Image> render;
+
+      // We can reuse the render from captureSamples() if it has the
+      // same format and background than the texture.
+      if (!src ||
+          src->pixelFormat() != textureImage->pixelFormat() ||
+          sample.sprite()->transparentColor() != 0) {
+        render.reset(Image::createFromPool(textureImage->pixelFormat(),
+            sample.sprite()->width(),
+            sample.sprite()->height()));
+        render->clear(0);
+        renderSample(sample, render, 0, 0);
+        src = render.get();
+      }
+
+      const gfx::Rect& srcBounds = sample.trimmedBounds();
+      const gfx::Rect& dstBounds = sample.inTextureBounds();
+      ASSERT(textureImage->bounds().contains(dstBounds));
+
+      int bytes = textureImage->getRowStrideSize(srcBounds.w);
+      for (int v=0; v<srcBounds.h; ++v) {
+        const uint8_t* srcRow = src->getPixelAddress(srcBounds.x, srcBounds.y+v);
+        std::copy(srcRow, srcRow+bytes,
+                  textureImage->getPixelAddress(dstBounds.x, dstBounds.y+v));
+      }
+    });
+
+  // Pixels were modified directly
+  textureImage->incrementVersion();
 }
 
 void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os, Image* textureImage)
@@ -441,6 +556,19 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
      << "}\n";
 }
 
+Image* DocumentExporter::createSampleImage(const Sample& sample)
+{
+  const Sprite* sprite = sample.sprite();
+  Image* image = Image::createFromPool(sprite->pixelFormat(),
+    sprite->width(),
+    sprite->height());
+
+  image->setMaskColor(sprite->transparentColor());
+  clear_image(image, sprite->transparentColor());
+  renderSample(sample, image, 0, 0);
+  return image;
+}
+
 void DocumentExporter::renderSample(const Sample& sample, doc::Image* dst, int x, int y)
 {
   if (sample.layer()) {
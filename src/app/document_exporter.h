@@ -93,6 +93,10 @@ namespace app {
       m_ignoreEmptyCels = ignore;
     }
 
+    void setMergeDuplicates(bool merge) {
+      m_mergeDuplicates = merge;
+    }
+
     void addDocument(Document* document, doc::Layer* layer = NULL) {
       m_documents.push_back(Item(document, layer));
     }
@@ -110,6 +114,7 @@ namespace app {
     Document* createEmptyTexture(const Samples& samples);
     void renderTexture(const Samples& samples, doc::Image* textureImage);
     void createDataFile(const Samples& samples, std::ostream& os, doc::Image* textureImage);
+    doc::Image* createSampleImage(const Sample& sample);
     void renderSample(const Sample& sample, doc::Image* dst, int x, int y);
 
     class Item {
@@ -132,6 +137,7 @@ namespace app {
     double m_scale;
     ScaleMode m_scaleMode;
     bool m_ignoreEmptyCels;
+    bool m_mergeDuplicates;
     Items m_documents;
 
     DISABLE_COPYING(DocumentExporter);
@@ -96,6 +96,16 @@ bool DocumentUndo::implantUndoerInLastGroup(undo::Undoer* undoer)
   return m_undoHistory->implantUndoerInLastGroup(undoer);
 }
 
+undo::ObjectsContainer* DocumentUndo::getObjects() const
+{
+  return m_objects;
+}
+
+bool DocumentUndo::isImageReferenced(const Image* image) const
+{
+  return m_objects->hasObject(image);
+}
+
 size_t DocumentUndo::getUndoSizeLimit() const
 {
   ASSERT(m_ctx);
@@ -21,8 +21,10 @@
 #pragma once
 
 #include "base/disable_copying.h"
+#include "app/objects_container_impl.h"
 #include "base/unique_ptr.h"
 #include "doc/sprite_position.h"
+#include "doc/stock.h"
 #include "undo/undo_history.h"
 
 namespace doc {
@@ -41,7 +43,8 @@ namespace app {
 
   using namespace doc;
 
-  class DocumentUndo : public undo::UndoHistoryDelegate {
+  class DocumentUndo : public undo::UndoHistoryDelegate
+                     , public doc::StockImageRefs {
   public:
     DocumentUndo();
 
@@ -63,9 +66,13 @@ namespace app {
     void impossibleToBackToSavedState();
 
     // UndoHistoryDelegate implementation.
-    undo::ObjectsContainer* getObjects() const override { return m_objects; }
+    undo::ObjectsContainer* getObjects() const override;
     size_t getUndoSizeLimit() const override;
 
+    // StockImageRefs implementation. Images referenced by undoers
+    // cannot be unloaded from the stock.
+    bool isImageReferenced(const Image* image) const override;
+
     void pushUndoer(undo::Undoer* undoer);
 
     bool implantUndoerInLastGroup(undo::Undoer* undoer);
@@ -89,7 +96,7 @@ namespace app {
     // ID that is saved in the serialization process, and loaded in the
     // deserialization process. The ID can be used by different undoers
     // to keep references to deleted objects.
-    base::UniquePtr<undo::ObjectsContainer> m_objects;
+    base::UniquePtr<ObjectsContainerImpl> m_objects;
 
     // Stack of undoers to undo operations.
     base::UniquePtr<undo::UndoHistory> m_undoHistory;
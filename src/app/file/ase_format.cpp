@@ -21,16 +21,26 @@
 #endif
 
 #include "app/document.h"
+#include "app/document_undo.h"
+#include "app/file/ase_options.h"
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/ini_file.h"
+#include "base/buffered_file_reader.h"
 #include "base/cfile.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/parallel_for.h"
 #include "doc/doc.h"
 #include "zlib.h"
 
+#include <map>
+#include <set>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
 #define ASE_FILE_MAGIC                  0xA5E0
 #define ASE_FILE_FRAME_MAGIC            0xF1FA
@@ -46,6 +56,10 @@
 #define ASE_FILE_LINK_CEL               1
 #define ASE_FILE_COMPRESSED_CEL         2
 
+// Maximum number of images that are compressed ahead of the frame
+// that is being written.
+#define ASE_COMPRESSION_LOOKAHEAD       64
+
 namespace app {
 
 using namespace base;
@@ -80,34 +94,94 @@ struct ASE_Chunk {
   int start;
 };
 
-static bool ase_file_read_header(FILE* f, ASE_Header* header);
+// Position of a compressed cel image in the file. Its pixels are
+// read and decompressed when all frames are loaded.
+struct ASE_CompressedImage {
+  Image* image;
+  FrameNumber frame;
+  long pos;
+  size_t size;
+};
+
+typedef std::vector<ASE_CompressedImage> ASE_CompressedImages;
+
+// Position of a compressed cel image in the file. Lazy images are
+// decompressed from there when they are used for the first time.
+struct ASE_LazyImage {
+  long pos;
+  size_t size;
+  int width;
+  int height;
+};
+
+// Compressed pixels of each stock image to be saved. They are
+// compressed (or copied from the original file if the image wasn't
+// modified) in groups while the frames are written, and they are
+// freed after writing the last frame that uses them.
+struct ASE_CompressedPixels {
+  int width;
+  int height;
+  std::vector<uint8_t> data;
+  size_t size;                  // Size of "data" (even if it was freed)
+  long pos;                     // Position of "data" in the new file
+  bool reused;                  // "data" comes from the original file
+  bool ready;                   // "data" was compressed (or read)
+  bool keep;                    // "data" is not freed after writing it
+};
+
+typedef std::map<int, ASE_CompressedPixels> ASE_CompressedPixelsMap;
+
+// Order in which the images are written in the file.
+struct ASE_ImagesOrder {
+  std::vector<int> images;      // Images in the order they are written
+  std::vector<size_t> frameEnd; // Number of images needed by each frame
+  std::vector<std::vector<int> > lastUse; // Images written for the last time in each frame
+};
+
+// First frame where each image was written in each layer, next cels
+// of the layer with the same image are written as links to that frame.
+typedef std::map<std::pair<const Layer*, int>, FrameNumber> ASE_CelLinks;
+
+class AseStockLoader;
+
+// Result of comparing a file with the file of the lazy images.
+enum class ASE_FileIdentity { Different, Same, Unknown };
+
+static bool ase_file_read_header(BufferedFileReader* f, ASE_Header* header);
+static void ase_file_read_progress(BufferedFileReader* f, FileOp* fop, ASE_Header* header);
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite);
 static void ase_file_write_header(FILE* f, ASE_Header* header);
 static void ase_file_write_header_filesize(FILE* f, ASE_Header* header);
 
-static void ase_file_read_frame_header(FILE* f, ASE_FrameHeader* frame_header);
+static void ase_file_read_frame_header(BufferedFileReader* f, ASE_FrameHeader* frame_header);
 static void ase_file_prepare_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 static void ase_file_write_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 
 static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame);
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame, ASE_CompressedPixelsMap& compressed_pixels, ASE_CelLinks& links);
 
-static void ase_file_read_padding(FILE* f, int bytes);
+static void ase_file_read_padding(BufferedFileReader* f, int bytes);
 static void ase_file_write_padding(FILE* f, int bytes);
-static std::string ase_file_read_string(FILE* f);
+static std::string ase_file_read_string(BufferedFileReader* f);
 static void ase_file_write_string(FILE* f, const std::string& string);
 
 static void ase_file_write_start_chunk(FILE* f, ASE_FrameHeader* frame_header, int type, ASE_Chunk* chunk);
 static void ase_file_write_close_chunk(FILE* f, ASE_Chunk* chunk);
 
-static Palette* ase_file_read_color_chunk(FILE* f, Sprite* sprite, FrameNumber frame);
-static Palette* ase_file_read_color2_chunk(FILE* f, Sprite* sprite, FrameNumber frame);
+static Palette* ase_file_read_color_chunk(BufferedFileReader* f, Sprite* sprite, FrameNumber frame);
+static Palette* ase_file_read_color2_chunk(BufferedFileReader* f, Sprite* sprite, FrameNumber frame);
 static void ase_file_write_color2_chunk(FILE* f, ASE_FrameHeader* frame_header, Palette* pal);
-static Layer* ase_file_read_layer_chunk(FILE* f, Sprite* sprite, Layer** previous_layer, int* current_level);
+static Layer* ase_file_read_layer_chunk(BufferedFileReader* f, Sprite* sprite, Layer** previous_layer, int* current_level);
 static void ase_file_write_layer_chunk(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite);
-static Mask* ase_file_read_mask_chunk(FILE* f);
+static Cel* ase_file_read_cel_chunk(BufferedFileReader* f, Sprite* sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end, ASE_CompressedImages* compressed_images, AseStockLoader* loader);
+static void ase_file_decompress_pixels(const std::vector<uint8_t>& data, Image* image);
+static void ase_file_decompress_images(ASE_CompressedImages::iterator begin, ASE_CompressedImages::iterator end, FileOp* fop);
+static void ase_file_get_frame_cels(Layer* layer, FrameNumber frame, CelList& cels);
+static void ase_file_prepare_images(Sprite* sprite, ASE_CompressedPixelsMap* compressed_pixels, ASE_ImagesOrder* order);
+static void ase_file_compress_images(Sprite* sprite, const AseOptions* options, ASE_CompressedPixelsMap& compressed_pixels, const std::vector<int>& indexes);
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, ASE_CompressedPixelsMap& compressed_pixels, ASE_CelLinks& links);
+static void ase_file_update_lazy_images(Sprite* sprite, FileOp* fop, const ASE_CompressedPixelsMap& compressed_pixels);
+static Mask* ase_file_read_mask_chunk(BufferedFileReader* f);
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, ASE_FrameHeader* frame_header, Mask* mask);
 #endif
@@ -127,6 +201,147 @@ private:
   ASE_Chunk m_chunk;
 };
 
+// Loads lazy images from the .ase file. Each call opens the file
+// again, so images can be loaded from several threads at the same
+// time. The status of the file is saved when the loader is created
+// (the file must be complete at that moment), and images are not
+// read if the file was modified or replaced after that.
+class AseStockLoader : public StockLoader {
+public:
+  AseStockLoader(const std::string& filename, PixelFormat pixelFormat)
+    : m_filename(filename)
+    , m_pixelFormat(pixelFormat) {
+    m_hasStatus = base::get_file_status(m_filename, &m_status);
+  }
+
+  bool empty() const {
+    return m_images.empty();
+  }
+
+  // Compares the given file with the file of the loader using their
+  // identity (device and index), so different paths to the same file
+  // are detected (e.g. links or relative paths).
+  ASE_FileIdentity compareFile(const std::string& filename) const {
+    base::FileStatus status;
+    if (!base::get_file_status(filename, &status))
+      return (base::is_file(filename) || base::is_directory(filename) ?
+              ASE_FileIdentity::Unknown:
+              ASE_FileIdentity::Different); // The file doesn't exist
+    else if (!m_hasStatus)
+      return ASE_FileIdentity::Unknown;
+    else if (status.sameFile(m_status))
+      return ASE_FileIdentity::Same;
+    else
+      return ASE_FileIdentity::Different;
+  }
+
+  void addImage(int index, const ASE_LazyImage& lazy) {
+    m_images[index] = lazy;
+  }
+
+  bool hasImage(int index) const {
+    return (m_images.find(index) != m_images.end());
+  }
+
+  // Reads the compressed pixels of the image as they are in the file.
+  void readCompressedPixels(int index, ASE_CompressedPixels* pixels) const {
+    std::map<int, ASE_LazyImage>::const_iterator it = m_images.find(index);
+    if (it == m_images.end())
+      throw base::Exception("Image %d is not in the file.\n", index);
+
+    const ASE_LazyImage& lazy = it->second;
+    pixels->width = lazy.width;
+    pixels->height = lazy.height;
+    pixels->data.resize(lazy.size);
+
+    if (!pixels->data.empty()) {
+      base::FileStatus status;
+      if (!m_hasStatus ||
+          !base::get_file_status(m_filename, &status) ||
+          status != m_status)
+        throw base::Exception("The file \"%s\" was modified by other program.\n",
+                              m_filename.c_str());
+
+      FileHandle handle(open_file_with_exception(m_filename, "rb"));
+      if (fseek(handle, lazy.pos, SEEK_SET) != 0 ||
+          fread(&pixels->data[0], 1, pixels->data.size(), handle) != pixels->data.size())
+        throw base::Exception("Error reading compressed image pixels.\n");
+    }
+  }
+
+  Image* loadImage(int index) override {
+    std::map<int, ASE_LazyImage>::const_iterator it = m_images.find(index);
+    Image* image = (it != m_images.end() ?
+      Image::create(m_pixelFormat, it->second.width, it->second.height):
+      Image::create(m_pixelFormat, 1, 1));
+    clear_image(image, 0);
+
+    // In case of error (e.g. the file was modified by other program)
+    // the image is kept empty, and the stock remembers the failure so
+    // the sprite is not saved with empty images (see
+    // Stock::hasLoadErrors()).
+    try {
+      ASE_CompressedPixels pixels;
+      readCompressedPixels(index, &pixels);
+      ase_file_decompress_pixels(pixels.data, image);
+    }
+    catch (const std::exception&) {
+      clear_image(image, 0);
+      setFailed();
+    }
+    return image;
+  }
+
+private:
+  std::string m_filename;
+  PixelFormat m_pixelFormat;
+  std::map<int, ASE_LazyImage> m_images;
+  base::FileStatus m_status;
+  bool m_hasStatus;
+};
+
+// Loads lazy images from the compressed pixels that were read before
+// overwriting their file (used while the file is overwritten, or if
+// it couldn't be saved). The loader owns the compressed pixels, so
+// they are alive while other threads use the loader.
+class AseMemoryStockLoader : public StockLoader {
+public:
+  AseMemoryStockLoader(PixelFormat pixelFormat, ASE_CompressedPixelsMap& compressed_pixels)
+    : m_pixelFormat(pixelFormat) {
+    m_compressedPixels.swap(compressed_pixels);
+  }
+
+  // Only the positions in the new file can be modified while the
+  // loader is used.
+  ASE_CompressedPixelsMap& compressedPixels() {
+    return m_compressedPixels;
+  }
+
+  Image* loadImage(int index) override {
+    ASE_CompressedPixelsMap::const_iterator it = m_compressedPixels.find(index);
+    Image* image = (it != m_compressedPixels.end() ?
+      Image::create(m_pixelFormat, it->second.width, it->second.height):
+      Image::create(m_pixelFormat, 1, 1));
+    clear_image(image, 0);
+
+    try {
+      if (it == m_compressedPixels.end())
+        throw base::Exception("Image %d is not in memory.\n", index);
+
+      ase_file_decompress_pixels(it->second.data, image);
+    }
+    catch (const std::exception&) {
+      clear_image(image, 0);
+      setFailed();
+    }
+    return image;
+  }
+
+private:
+  PixelFormat m_pixelFormat;
+  ASE_CompressedPixelsMap m_compressedPixels;
+};
+
 class AseFormat : public FileFormat {
   const char* onGetName() const { return "ase"; }
   const char* onGetExtensions() const { return "ase,aseprite"; }
@@ -141,13 +356,16 @@ class AseFormat : public FileFormat {
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_LAYERS |
       FILE_SUPPORT_FRAMES |
-      FILE_SUPPORT_PALETTES;
+      FILE_SUPPORT_PALETTES |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS;
   }
 
   bool onLoad(FileOp* fop) override;
 #ifdef ENABLE_SAVE
   bool onSave(FileOp* fop) override;
 #endif
+
+  SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) override;
 };
 
 FileFormat* CreateAseFormat()
@@ -157,10 +375,18 @@ FileFormat* CreateAseFormat()
 
 bool AseFormat::onLoad(FileOp* fop)
 {
-  FileHandle f(open_file_with_exception(fop->filename, "rb"));
+  FileHandle handle(open_file_with_exception(fop->filename, "rb"));
+
+  // Size of the file, chunks cannot go beyond it
+  long file_size = 0;
+  if (fseek(handle, 0, SEEK_END) == 0)
+    file_size = ftell(handle);
+  fseek(handle, 0, SEEK_SET);
+
+  BufferedFileReader f(handle);
 
   ASE_Header header;
-  if (!ase_file_read_header(f, &header)) {
+  if (!ase_file_read_header(&f, &header)) {
     fop_error(fop, "Error reading header\n");
     return false;
   }
@@ -181,15 +407,22 @@ bool AseFormat::onLoad(FileOp* fop)
   Layer* last_layer = sprite->folder();
   int current_level = -1;
 
+  // Compressed cel images are decompressed after reading all frames,
+  // or when they are used if the images are loaded lazily.
+  ASE_CompressedImages compressed_images;
+  UniquePtr<AseStockLoader> loader;
+  if (fop->lazy_images && !fop->oneframe)
+    loader.reset(new AseStockLoader(fop->filename, sprite->pixelFormat()));
+
   /* read frame by frame to end-of-file */
   for (FrameNumber frame(0); frame<sprite->totalFrames(); ++frame) {
     /* start frame position */
-    int frame_pos = ftell(f);
-    fop_progress(fop, (float)frame_pos / (float)header.size);
+    int frame_pos = f.tell();
+    ase_file_read_progress(&f, fop, &header);
 
     /* read frame header */
     ASE_FrameHeader frame_header;
-    ase_file_read_frame_header(f, &frame_header);
+    ase_file_read_frame_header(&f, &frame_header);
 
     // Correct frame type
     if (frame_header.magic == ASE_FILE_FRAME_MAGIC) {
@@ -200,12 +433,12 @@ bool AseFormat::onLoad(FileOp* fop)
       // Read chunks
       for (int c=0; c<frame_header.chunks; c++) {
         /* start chunk position */
-        int chunk_pos = ftell(f);
-        fop_progress(fop, (float)chunk_pos / (float)header.size);
+        int chunk_pos = f.tell();
+        ase_file_read_progress(&f, fop, &header);
 
         // Read chunk information
-        int chunk_size = fgetl(f);
-        int chunk_type = fgetw(f);
+        int chunk_size = f.read32();
+        int chunk_type = f.read16();
 
         switch (chunk_type) {
 
@@ -215,8 +448,8 @@ bool AseFormat::onLoad(FileOp* fop)
             Palette* prev_pal = sprite->getPalette(frame);
             Palette* pal =
               chunk_type == ASE_FILE_CHUNK_FLI_COLOR ?
-              ase_file_read_color_chunk(f, sprite, frame):
-              ase_file_read_color2_chunk(f, sprite, frame);
+              ase_file_read_color_chunk(&f, sprite, frame):
+              ase_file_read_color2_chunk(&f, sprite, frame);
 
             if (prev_pal->countDiff(pal, NULL, NULL) > 0)
               sprite->setPalette(pal, true);
@@ -228,7 +461,7 @@ bool AseFormat::onLoad(FileOp* fop)
           case ASE_FILE_CHUNK_LAYER: {
             /* fop_error(fop, "Layer chunk\n"); */
 
-            ase_file_read_layer_chunk(f, sprite,
+            ase_file_read_layer_chunk(&f, sprite,
                                       &last_layer,
                                       &current_level);
             break;
@@ -237,9 +470,16 @@ bool AseFormat::onLoad(FileOp* fop)
           case ASE_FILE_CHUNK_CEL: {
             /* fop_error(fop, "Cel chunk\n"); */
 
-            ase_file_read_cel_chunk(f, sprite, frame,
+            // The size of the pixels is taken from the chunk size, so
+            // a broken chunk cannot make us read beyond the file end.
+            long chunk_end = long(chunk_pos) + chunk_size;
+            if (chunk_size < 0 || chunk_end > file_size)
+              chunk_end = file_size;
+
+            ase_file_read_cel_chunk(&f, sprite, frame,
                                     sprite->pixelFormat(), fop, &header,
-                                    chunk_pos+chunk_size);
+                                    size_t(chunk_end),
+                                    &compressed_images, loader);
             break;
           }
 
@@ -248,7 +488,7 @@ bool AseFormat::onLoad(FileOp* fop)
 
             /* fop_error(fop, "Mask chunk\n"); */
 
-            mask = ase_file_read_mask_chunk(f);
+            mask = ase_file_read_mask_chunk(&f);
             if (mask)
               delete mask;      // TODO add the mask in some place?
             else
@@ -267,12 +507,12 @@ bool AseFormat::onLoad(FileOp* fop)
         }
 
         /* skip chunk size */
-        fseek(f, chunk_pos+chunk_size, SEEK_SET);
+        f.seek(chunk_pos+chunk_size);
       }
     }
 
     /* skip frame size */
-    fseek(f, frame_pos+frame_header.size, SEEK_SET);
+    f.seek(frame_pos+frame_header.size);
 
     /* just one frame? */
     if (fop->oneframe)
@@ -282,10 +522,33 @@ bool AseFormat::onLoad(FileOp* fop)
       break;
   }
 
+  // Cels are independent zlib streams, so they can be decompressed
+  // at the same time. Each one writes only in its own image. Cels
+  // are split in groups of consecutive cels, and each group reads
+  // its cels from the file with its own handle.
+  const int groups = MIN(int(compressed_images.size()),
+                         int(4 * base::thread::hardware_concurrency()));
+  base::parallel_for(0, groups,
+    [&](int i) {
+      ase_file_decompress_images(
+        compressed_images.begin() + compressed_images.size() * i / groups,
+        compressed_images.begin() + compressed_images.size() * (i+1) / groups,
+        fop);
+      fop_progress(fop, 0.5 + 0.5 * (i+1) / groups);
+    });
+
+  if (loader && !loader->empty()) {
+    Stock* stock = sprite->stock();
+    stock->setMaxLoadedBytes(
+      size_t(get_config_int("ASE", "LazyImagesMaxMemory",
+          int(Stock::kDefaultMaxLoadedBytes / (1024*1024)))) * 1024*1024);
+    stock->setLoader(loader.release());
+  }
+
   fop->createDocument(sprite);
   sprite.release();
 
-  if (ferror(f)) {
+  if (f.error()) {
     fop_error(fop, "Error reading file.\n");
     return false;
   }
@@ -298,57 +561,163 @@ bool AseFormat::onLoad(FileOp* fop)
 bool AseFormat::onSave(FileOp* fop)
 {
   Sprite* sprite = fop->document->sprite();
+  SharedPtr<AseOptions> ase_options = fop->seq.format_options;
+  if (!ase_options)
+    ase_options.reset(new AseOptions);
+
+  // Are we going to overwrite the file of the lazy images? If we
+  // cannot know it, all lazy images are loaded now (the loader is
+  // deleted), so the file can be overwritten safely.
+  Stock* stock = sprite->stock();
+  const AseStockLoader* loader = dynamic_cast<const AseStockLoader*>(stock->loader());
+  ASE_FileIdentity identity = (loader ? loader->compareFile(fop->filename):
+                                        ASE_FileIdentity::Different);
+  if (identity == ASE_FileIdentity::Unknown)
+    stock->loadAllImages();
+  bool overwriteLazyFile = (identity == ASE_FileIdentity::Same);
+
+  // Images are compressed in parallel (it's the slowest part) while
+  // the frames are written. Unmodified lazy images are copied from
+  // their file without compressing them again.
+  ASE_CompressedPixelsMap local_pixels;
+  ASE_ImagesOrder order;
+  ase_file_prepare_images(sprite, &local_pixels, &order);
+
+  // If the file of the lazy images is going to be overwritten, the
+  // images that cannot be loaded from memory are read (or
+  // compressed) before that, and they are kept until the end.
+  if (overwriteLazyFile) {
+    std::vector<int> indexes;
+    for (int index : order.images) {
+      ASE_CompressedPixels& pixels = local_pixels[index];
+      if (pixels.reused || !stock->getLoadedImage(index)) {
+        pixels.keep = true;
+        indexes.push_back(index);
+      }
+    }
+    ase_file_compress_images(sprite, ase_options, local_pixels, indexes);
+  }
+
+  // Don't overwrite the file if some image couldn't be loaded to
+  // compress it (it would be saved empty).
+  if (stock->hasLoadErrors()) {
+    fop_error(fop, "Some images of the sprite couldn't be loaded from its file.\n");
+    return false;
+  }
+
+  // While the file of the lazy images is overwritten, they are
+  // loaded from the compressed pixels in memory (e.g. by other
+  // threads that render the sprite), so they are never read from the
+  // incomplete file.
+  ASE_CompressedPixelsMap* compressed_pixels = &local_pixels;
+  if (overwriteLazyFile) {
+    AseMemoryStockLoader* memoryLoader =
+      new AseMemoryStockLoader(sprite->pixelFormat(), local_pixels);
+    compressed_pixels = &memoryLoader->compressedPixels();
+    stock->setLoader(memoryLoader);
+  }
+
   FileHandle f(open_file_with_exception(fop->filename, "wb"));
 
-  // Write the header
-  ASE_Header header;
-  ase_file_prepare_header(f, &header, sprite);
-  ase_file_write_header(f, &header);
+  try {
+    // Write the header
+    ASE_Header header;
+    ase_file_prepare_header(f, &header, sprite);
+    ase_file_write_header(f, &header);
+
+    // Write frames
+    ASE_CelLinks links;
+    size_t compressed = 0;
+    for (FrameNumber frame(0); frame<sprite->totalFrames(); ++frame) {
+      // Compress the images of this frame, and some images of the
+      // next frames too, so several threads can work at the same time
+      // (but the compressed pixels in memory are limited).
+      size_t end = order.frameEnd[frame];
+      if (compressed < end) {
+        end = MAX(end, MIN(compressed + ASE_COMPRESSION_LOOKAHEAD,
+                           order.images.size()));
+        ase_file_compress_images(sprite, ase_options, *compressed_pixels,
+          std::vector<int>(order.images.begin()+compressed,
+                           order.images.begin()+end));
+        compressed = end;
+
+        // The file would be saved with empty images
+        if (stock->hasLoadErrors())
+          throw base::Exception("Some images of the sprite couldn't be loaded from its file.\n");
+      }
 
-  // Write frames
-  for (FrameNumber frame(0); frame<sprite->totalFrames(); ++frame) {
-    // Prepare the frame header
-    ASE_FrameHeader frame_header;
-    ase_file_prepare_frame_header(f, &frame_header);
+      // Prepare the frame header
+      ASE_FrameHeader frame_header;
+      ase_file_prepare_frame_header(f, &frame_header);
 
-    // Frame duration
-    frame_header.duration = sprite->getFrameDuration(frame);
+      // Frame duration
+      frame_header.duration = sprite->getFrameDuration(frame);
 
-    // is the first frame or did the palette change?
-    if ((frame == 0 ||
-         sprite->getPalette(frame.previous())->countDiff(sprite->getPalette(frame), NULL, NULL) > 0)) {
-      // Write the color chunk
-      ase_file_write_color2_chunk(f, &frame_header, sprite->getPalette(frame));
-    }
+      // is the first frame or did the palette change?
+      if ((frame == 0 ||
+           sprite->getPalette(frame.previous())->countDiff(sprite->getPalette(frame), NULL, NULL) > 0)) {
+        // Write the color chunk
+        ase_file_write_color2_chunk(f, &frame_header, sprite->getPalette(frame));
+      }
 
-    // Write extra chunks in the first frame
-    if (frame == 0) {
-      LayerIterator it = sprite->folder()->getLayerBegin();
-      LayerIterator end = sprite->folder()->getLayerEnd();
+      // Write extra chunks in the first frame
+      if (frame == 0) {
+        LayerIterator it = sprite->folder()->getLayerBegin();
+        LayerIterator end = sprite->folder()->getLayerEnd();
 
-      // Write layer chunks
-      for (; it != end; ++it)
-        ase_file_write_layers(f, &frame_header, *it);
-    }
+        // Write layer chunks
+        for (; it != end; ++it)
+          ase_file_write_layers(f, &frame_header, *it);
+      }
 
-    // Write cel chunks
-    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame);
+      // Write cel chunks
+      ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame,
+                          *compressed_pixels, links);
 
-    // Write the frame header
-    ase_file_write_frame_header(f, &frame_header);
+      // Write the frame header
+      ase_file_write_frame_header(f, &frame_header);
 
-    // Progress
-    if (sprite->totalFrames() > 1)
-      fop_progress(fop, (float)(frame.next()) / (float)(sprite->totalFrames()));
+      // Free the compressed pixels that are not needed anymore
+      for (int index : order.lastUse[frame]) {
+        ASE_CompressedPixels& pixels = compressed_pixels->find(index)->second;
+        if (!pixels.keep)
+          std::vector<uint8_t>().swap(pixels.data);
+      }
 
-    if (fop_is_stop(fop))
-      break;
+      // Progress
+      fop_progress(fop, double(frame.next()) / sprite->totalFrames());
+
+      if (fop_is_stop(fop))
+        break;
+    }
+
+    // Write the missing field (filesize) of the header.
+    ase_file_write_header_filesize(f, &header);
+    fflush(f);
+  }
+  catch (...) {
+    // Lazy images cannot be loaded from the incomplete file, so they
+    // are loaded from memory now.
+    if (overwriteLazyFile)
+      stock->loadAllImages();
+    throw;
   }
 
-  // Write the missing field (filesize) of the header.
-  ase_file_write_header_filesize(f, &header);
+  // Lazy images are loaded from the new file only if it's complete.
+  // The file is closed first, so its status (saved by the new loader)
+  // doesn't change anymore.
+  bool error = (ferror(f) != 0);
+  bool complete = (!error && !fop_is_stop(fop));
+  f.reset();
 
-  if (ferror(f)) {
+  if (overwriteLazyFile) {
+    if (complete)
+      ase_file_update_lazy_images(sprite, fop, *compressed_pixels);
+    else
+      stock->loadAllImages();
+  }
+
+  if (error) {
     fop_error(fop, "Error writing file.\n");
     return false;
   }
@@ -358,35 +727,65 @@ bool AseFormat::onSave(FileOp* fop)
 }
 #endif
 
-static bool ase_file_read_header(FILE* f, ASE_Header* header)
+// Returns the options from the configuration file. They are read
+// again on each save (the options that file.cpp keeps in the
+// document are not used), so changes in the configuration are used
+// by the next save.
+SharedPtr<FormatOptions> AseFormat::onGetFormatOptions(FileOp* fop)
 {
-  header->pos = ftell(f);
+  SharedPtr<AseOptions> ase_options(new AseOptions);
+
+  int level = get_config_int("ASE", "CompressionLevel", ase_options->compressionLevel());
+  int strategy = get_config_int("ASE", "CompressionStrategy", (int)ase_options->strategy());
+
+  // Fast saves (e.g. backups) use the fastest level, the file size
+  // is not so important.
+  if (fop->fast_save)
+    level = AseOptions::kFastestCompression;
+
+  ase_options->setCompressionLevel(MID(-1, level, 9));
+  ase_options->setStrategy((AseOptions::Strategy)
+    MID((int)AseOptions::DefaultStrategy, strategy, (int)AseOptions::RleStrategy));
 
-  header->size  = fgetl(f);
-  header->magic = fgetw(f);
+  return ase_options;
+}
+
+static bool ase_file_read_header(BufferedFileReader* f, ASE_Header* header)
+{
+  header->pos = f->tell();
+
+  header->size  = f->read32();
+  header->magic = f->read16();
   if (header->magic != ASE_FILE_MAGIC)
     return false;
 
-  header->frames     = fgetw(f);
-  header->width      = fgetw(f);
-  header->height     = fgetw(f);
-  header->depth      = fgetw(f);
-  header->flags      = fgetl(f);
-  header->speed      = fgetw(f);
-  header->next       = fgetl(f);
-  header->frit       = fgetl(f);
-  header->transparent_index = fgetc(f);
-  header->ignore[0]  = fgetc(f);
-  header->ignore[1]  = fgetc(f);
-  header->ignore[2]  = fgetc(f);
-  header->ncolors    = fgetw(f);
+  header->frames     = f->read16();
+  header->width      = f->read16();
+  header->height     = f->read16();
+  header->depth      = f->read16();
+  header->flags      = f->read32();
+  header->speed      = f->read16();
+  header->next       = f->read32();
+  header->frit       = f->read32();
+  header->transparent_index = f->read8();
+  header->ignore[0]  = f->read8();
+  header->ignore[1]  = f->read8();
+  header->ignore[2]  = f->read8();
+  header->ncolors    = f->read16();
   if (header->ncolors == 0)     // 0 means 256 (old .ase files)
     header->ncolors = 256;
 
-  fseek(f, header->pos+128, SEEK_SET);
+  f->seek(header->pos+128);
   return true;
 }
 
+// The first half of the progress is used to read the file, and the
+// second one to decompress the cel images.
+static void ase_file_read_progress(BufferedFileReader* f, FileOp* fop, ASE_Header* header)
+{
+  fop_progress(fop, 0.5 * f->tell() / header->size);
+}
+
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite)
 {
   header->pos = ftell(f);
@@ -443,12 +842,12 @@ static void ase_file_write_header_filesize(FILE* f, ASE_Header* header)
   fseek(f, header->pos+header->size, SEEK_SET);
 }
 
-static void ase_file_read_frame_header(FILE* f, ASE_FrameHeader* frame_header)
+static void ase_file_read_frame_header(BufferedFileReader* f, ASE_FrameHeader* frame_header)
 {
-  frame_header->size = fgetl(f);
-  frame_header->magic = fgetw(f);
-  frame_header->chunks = fgetw(f);
-  frame_header->duration = fgetw(f);
+  frame_header->size = f->read32();
+  frame_header->magic = f->read16();
+  frame_header->chunks = f->read16();
+  frame_header->duration = f->read16();
   ase_file_read_padding(f, 6);
 }
 
@@ -495,7 +894,7 @@ static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer*
   }
 }
 
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame)
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame, ASE_CompressedPixelsMap& compressed_pixels, ASE_CelLinks& links)
 {
   if (layer->isImage()) {
     Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
@@ -503,7 +902,8 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
 /*       fop_error(fop, "New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite,
+                               compressed_pixels, links);
     }
   }
 
@@ -512,14 +912,13 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, frame_header, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, compressed_pixels, links);
   }
 }
 
-static void ase_file_read_padding(FILE* f, int bytes)
+static void ase_file_read_padding(BufferedFileReader* f, int bytes)
 {
-  for (int c=0; c<bytes; c++)
-    fgetc(f);
+  f->skip(bytes);
 }
 
 static void ase_file_write_padding(FILE* f, int bytes)
@@ -528,9 +927,9 @@ static void ase_file_write_padding(FILE* f, int bytes)
     fputc(0, f);
 }
 
-static std::string ase_file_read_string(FILE* f)
+static std::string ase_file_read_string(BufferedFileReader* f)
 {
-  int length = fgetw(f);
+  int length = f->read16();
   if (length == EOF)
     return "";
 
@@ -538,7 +937,7 @@ static std::string ase_file_read_string(FILE* f)
   string.reserve(length+1);
 
   for (int c=0; c<length; c++)
-    string.push_back(fgetc(f));
+    string.push_back(f->read8());
 
   return string;
 }
@@ -572,25 +971,25 @@ static void ase_file_write_close_chunk(FILE* f, ASE_Chunk* chunk)
   fseek(f, chunk_end, SEEK_SET);
 }
 
-static Palette* ase_file_read_color_chunk(FILE* f, Sprite* sprite, FrameNumber frame)
+static Palette* ase_file_read_color_chunk(BufferedFileReader* f, Sprite* sprite, FrameNumber frame)
 {
   int i, c, r, g, b, packets, skip, size;
   Palette* pal = new Palette(*sprite->getPalette(frame));
   pal->setFrame(frame);
 
-  packets = fgetw(f);   // Number of packets
+  packets = f->read16();   // Number of packets
   skip = 0;
 
   // Read all packets
   for (i=0; i<packets; i++) {
-    skip += fgetc(f);
-    size = fgetc(f);
+    skip += f->read8();
+    size = f->read8();
     if (!size) size = 256;
 
     for (c=skip; c<skip+size; c++) {
-      r = fgetc(f);
-      g = fgetc(f);
-      b = fgetc(f);
+      r = f->read8();
+      g = f->read8();
+      b = f->read8();
       pal->setEntry(c, rgba(scale_6bits_to_8bits(r),
                             scale_6bits_to_8bits(g),
                             scale_6bits_to_8bits(b), 255));
@@ -600,25 +999,25 @@ static Palette* ase_file_read_color_chunk(FILE* f, Sprite* sprite, FrameNumber f
   return pal;
 }
 
-static Palette* ase_file_read_color2_chunk(FILE* f, Sprite* sprite, FrameNumber frame)
+static Palette* ase_file_read_color2_chunk(BufferedFileReader* f, Sprite* sprite, FrameNumber frame)
 {
   int i, c, r, g, b, packets, skip, size;
   Palette* pal = new Palette(*sprite->getPalette(frame));
   pal->setFrame(frame);
 
-  packets = fgetw(f);   // Number of packets
+  packets = f->read16();   // Number of packets
   skip = 0;
 
   // Read all packets
   for (i=0; i<packets; i++) {
-    skip += fgetc(f);
-    size = fgetc(f);
+    skip += f->read8();
+    size = f->read8();
     if (!size) size = 256;
 
     for (c=skip; c<skip+size; c++) {
-      r = fgetc(f);
-      g = fgetc(f);
-      b = fgetc(f);
+      r = f->read8();
+      g = f->read8();
+      b = f->read8();
       pal->setEntry(c, rgba(r, g, b, 255));
     }
   }
@@ -646,7 +1045,7 @@ static void ase_file_write_color2_chunk(FILE* f, ASE_FrameHeader* frame_header,
   }
 }
 
-static Layer* ase_file_read_layer_chunk(FILE* f, Sprite* sprite, Layer** previous_layer, int* current_level)
+static Layer* ase_file_read_layer_chunk(BufferedFileReader* f, Sprite* sprite, Layer** previous_layer, int* current_level)
 {
   std::string name;
   Layer* layer = NULL;
@@ -655,12 +1054,12 @@ static Layer* ase_file_read_layer_chunk(FILE* f, Sprite* sprite, Layer** previou
   int layer_type;
   int child_level;
 
-  flags = fgetw(f);
-  layer_type = fgetw(f);
-  child_level = fgetw(f);
-  fgetw(f);                     // default width
-  fgetw(f);                     // default height
-  fgetw(f);                     // blend mode
+  flags = f->read16();
+  layer_type = f->read16();
+  child_level = f->read16();
+  f->read16();                     // default width
+  f->read16();                     // default height
+  f->read16();                     // blend mode
 
   ase_file_read_padding(f, 4);
   name = ase_file_read_string(f);
@@ -736,7 +1135,6 @@ static void ase_file_write_layer_chunk(FILE* f, ASE_FrameHeader* frame_header, L
 template<typename ImageTraits>
 class PixelIO {
 public:
-  typename ImageTraits::pixel_t read_pixel(FILE* f);
   void write_pixel(FILE* f, typename ImageTraits::pixel_t c);
   void read_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
   void write_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
@@ -746,13 +1144,6 @@ template<>
 class PixelIO<RgbTraits> {
   int r, g, b, a;
 public:
-  RgbTraits::pixel_t read_pixel(FILE* f) {
-    r = fgetc(f);
-    g = fgetc(f);
-    b = fgetc(f);
-    a = fgetc(f);
-    return rgba(r, g, b, a);
-  }
   void write_pixel(FILE* f, RgbTraits::pixel_t c) {
     fputc(rgba_getr(c), f);
     fputc(rgba_getg(c), f);
@@ -785,11 +1176,6 @@ template<>
 class PixelIO<GrayscaleTraits> {
   int k, a;
 public:
-  GrayscaleTraits::pixel_t read_pixel(FILE* f) {
-    k = fgetc(f);
-    a = fgetc(f);
-    return graya(k, a);
-  }
   void write_pixel(FILE* f, GrayscaleTraits::pixel_t c) {
     fputc(graya_getv(c), f);
     fputc(graya_geta(c), f);
@@ -815,9 +1201,6 @@ public:
 template<>
 class PixelIO<IndexedTraits> {
 public:
-  IndexedTraits::pixel_t read_pixel(FILE* f) {
-    return fgetc(f);
-  }
   void write_pixel(FILE* f, IndexedTraits::pixel_t c) {
     fputc(c, f);
   }
@@ -836,16 +1219,23 @@ public:
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void read_raw_image(FILE* f, Image* image, FileOp* fop, ASE_Header* header)
+static void read_raw_image(BufferedFileReader* f, Image* image, FileOp* fop, ASE_Header* header)
 {
   PixelIO<ImageTraits> pixel_io;
-  int x, y;
+  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
 
-  for (y=0; y<image->height(); y++) {
-    for (x=0; x<image->width(); x++)
-      put_pixel_fast<ImageTraits>(image, x, y, pixel_io.read_pixel(f));
+  for (int y=0; y<image->height(); y++) {
+    // Missing bytes at the end of the file are zero
+    size_t bytes = f->read(&scanline[0], scanline.size());
+    if (bytes < scanline.size())
+      std::fill(scanline.begin()+bytes, scanline.end(), 0);
+
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
+    pixel_io.read_scanline(address, image->width(), &scanline[0]);
+
+    ase_file_read_progress(f, fop, header);
   }
 }
 
@@ -865,7 +1255,7 @@ static void write_raw_image(FILE* f, Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void read_compressed_image(const std::vector<uint8_t>& compressed, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -879,59 +1269,41 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
+  // Rows are packed in the file, but image rows can be padded
+  // (aligned images), so each row is inflated separately.
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> uncompressed(image->height() * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
-
-  while (true) {
-    size_t input_bytes;
+  zstream.next_in = (Bytef*)(compressed.empty() ? NULL: &compressed[0]);
+  zstream.avail_in = compressed.size();
+  err = Z_OK;
 
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
-
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
-
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
-
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
+  for (y=0; y<image->height(); y++) {
+    zstream.next_out = (Bytef*)&scanline[0];
+    zstream.avail_out = scanline.size();
 
+    // Inflate until the row is complete or the stream ends
+    while (zstream.avail_out > 0 && err == Z_OK) {
       err = inflate(&zstream, Z_NO_FLUSH);
       if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
         throw base::Exception("ZLib error %d in inflate().", err);
+    }
 
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
-
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
-
-        uncompressed_offset += uncompressed_bytes;
-      }
-    } while (zstream.avail_out == 0);
-
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
-  }
+    // Missing bytes of a truncated stream are zero
+    std::fill(scanline.end()-zstream.avail_out, scanline.end(), 0);
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->height(); y++) {
     typename ImageTraits::address_t address =
       (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-    pixel_io.read_scanline(address, image->width(), &uncompressed[uncompressed_offset]);
+    pixel_io.read_scanline(address, image->width(), &scanline[0]);
+  }
 
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->width());
+  // The stream cannot contain more pixels than the image
+  if (err == Z_OK && zstream.avail_in > 0) {
+    uint8_t extra;
+    zstream.next_out = (Bytef*)&extra;
+    zstream.avail_out = 1;
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (zstream.avail_out == 0)
+      throw base::Exception("Bad compressed image.");
   }
 
   err = inflateEnd(&zstream);
@@ -940,7 +1312,7 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
 }
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, Image* image)
+static void write_compressed_image(std::vector<uint8_t>* compressed, Image* image, int level, int strategy)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -949,12 +1321,15 @@ static void write_compressed_image(FILE* f, Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit2(&zstream, level, Z_DEFLATED, MAX_WBITS, 8, strategy);
   if (err != Z_OK)
-    throw base::Exception("ZLib error %d in deflateInit().", err);
+    throw base::Exception("ZLib error %d in deflateInit2().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
+
+  // Enough space for the whole image in most cases
+  compressed->resize(deflateBound(&zstream, scanline.size() * image->height()));
+  size_t output_bytes = 0;
 
   for (y=0; y<image->height(); y++) {
     typename ImageTraits::address_t address =
@@ -967,23 +1342,23 @@ static void write_compressed_image(FILE* f, Image* image)
     int flush = (y == image->height()-1 ? Z_FINISH: Z_NO_FLUSH);
 
     do {
-      zstream.next_out = (Bytef*)&compressed[0];
-      zstream.avail_out = compressed.size();
+      if (output_bytes == compressed->size())
+        compressed->resize(2*compressed->size());
+
+      zstream.next_out = (Bytef*)&(*compressed)[output_bytes];
+      zstream.avail_out = compressed->size() - output_bytes;
 
       // Compress
       err = deflate(&zstream, flush);
       if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
         throw base::Exception("ZLib error %d in deflate().", err);
 
-      int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
+      output_bytes = compressed->size() - zstream.avail_out;
     } while (zstream.avail_out == 0);
   }
 
+  compressed->resize(output_bytes);
+
   err = deflateEnd(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
@@ -993,16 +1368,18 @@ static void write_compressed_image(FILE* f, Image* image)
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
-static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
+static Cel* ase_file_read_cel_chunk(BufferedFileReader* f, Sprite* sprite, FrameNumber frame,
                                     PixelFormat pixelFormat,
-                                    FileOp* fop, ASE_Header* header, size_t chunk_end)
+                                    FileOp* fop, ASE_Header* header, size_t chunk_end,
+                                    ASE_CompressedImages* compressed_images,
+                                    AseStockLoader* loader)
 {
   /* read chunk data */
-  LayerIndex layer_index = LayerIndex(fgetw(f));
-  int x = ((short)fgetw(f));
-  int y = ((short)fgetw(f));
-  int opacity = fgetc(f);
-  int cel_type = fgetw(f);
+  LayerIndex layer_index = LayerIndex(f->read16());
+  int x = ((short)f->read16());
+  int y = ((short)f->read16());
+  int opacity = f->read8();
+  int cel_type = f->read16();
   Layer* layer;
 
   ase_file_read_padding(f, 7);
@@ -1028,8 +1405,8 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
 
     case ASE_FILE_RAW_CEL: {
       // Read width and height
-      int w = fgetw(f);
-      int h = fgetw(f);
+      int w = f->read16();
+      int h = f->read16();
 
       if (w > 0 && h > 0) {
         Image* image = Image::create(pixelFormat, w, h);
@@ -1057,13 +1434,13 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
 
     case ASE_FILE_LINK_CEL: {
       // Read link position
-      FrameNumber link_frame = FrameNumber(fgetw(f));
+      FrameNumber link_frame = FrameNumber(f->read16());
       Cel* link = static_cast<LayerImage*>(layer)->getCel(link_frame);
 
       if (link) {
-        // Create a copy of the linked cel (avoid using links cel)
-        Image* image = Image::createCopy(link->image());
-        cel->setImage(sprite->stock()->addImage(image));
+        // Share the image of the linked cel (both cels will reference
+        // the same image in the stock)
+        cel->setImage(link->imageIndex());
       }
       else {
         // Linked cel doesn't found
@@ -1074,34 +1451,32 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
 
     case ASE_FILE_COMPRESSED_CEL: {
       // Read width and height
-      int w = fgetw(f);
-      int h = fgetw(f);
-
-      if (w > 0 && h > 0) {
+      int w = f->read16();
+      int h = f->read16();
+
+      if (w > 0 && h > 0 && loader) {
+        // Just remember where the compressed pixel data is
+        ASE_LazyImage lazy;
+        lazy.pos = f->tell();
+        lazy.size = (chunk_end > size_t(f->tell()) ? chunk_end - f->tell(): 0);
+        lazy.width = w;
+        lazy.height = h;
+
+        int index = sprite->stock()->addLazyImage();
+        loader->addImage(index, lazy);
+        cel->setImage(index);
+      }
+      else if (w > 0 && h > 0) {
         Image* image = Image::create(pixelFormat, w, h);
 
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image, chunk_end, fop, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop_error(fop, e.what());
-        }
+        // Remember where the compressed pixel data is, it will be
+        // read and decompressed after reading all frames.
+        ASE_CompressedImage compressed_image;
+        compressed_image.image = image;
+        compressed_image.frame = frame;
+        compressed_image.pos = f->tell();
+        compressed_image.size = (chunk_end > size_t(f->tell()) ? chunk_end - f->tell(): 0);
+        compressed_images->push_back(compressed_image);
 
         cel->setImage(sprite->stock()->addImage(image));
       }
@@ -1115,13 +1490,211 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
   return newCel;
 }
 
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite)
+static void ase_file_decompress_pixels(const std::vector<uint8_t>& data, Image* image)
+{
+  switch (image->pixelFormat()) {
+
+    case IMAGE_RGB:
+      read_compressed_image<RgbTraits>(data, image);
+      break;
+
+    case IMAGE_GRAYSCALE:
+      read_compressed_image<GrayscaleTraits>(data, image);
+      break;
+
+    case IMAGE_INDEXED:
+      read_compressed_image<IndexedTraits>(data, image);
+      break;
+  }
+}
+
+static void ase_file_decompress_images(ASE_CompressedImages::iterator begin,
+                                       ASE_CompressedImages::iterator end,
+                                       FileOp* fop)
+{
+  if (begin == end)
+    return;
+
+  FileHandle handle(open_file(fop->filename, "rb"));
+  if (!handle) {
+    fop_error(fop, "Frame %d: Error opening the file again to read the cel images.\n",
+              (int)begin->frame);
+    for (ASE_CompressedImages::iterator it=begin; it!=end; ++it)
+      clear_image(it->image, 0);
+    return;
+  }
+
+  std::vector<uint8_t> data;
+  for (ASE_CompressedImages::iterator it=begin; it!=end; ++it) {
+    // Try to read and decompress pixel data
+    try {
+      data.resize(it->size);
+      if (!data.empty() &&
+          (fseek(handle, it->pos, SEEK_SET) != 0 ||
+           fread(&data[0], 1, data.size(), handle) != data.size()))
+        throw base::Exception("Error reading compressed image pixels.\n");
+
+      ase_file_decompress_pixels(data, it->image);
+    }
+    // OK, in case of error we can show the problem, but continue
+    // loading more cels.
+    catch (const std::exception& e) {
+      fop_error(fop, "Frame %d: %s\n", (int)it->frame, e.what());
+    }
+  }
+}
+
+// Returns the cels of the given frame in the same order that
+// ase_file_write_cels() writes them.
+static void ase_file_get_frame_cels(Layer* layer, FrameNumber frame, CelList& cels)
+{
+  if (layer->isImage()) {
+    Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
+    if (cel)
+      cels.push_back(cel);
+  }
+
+  if (layer->isFolder()) {
+    LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+    LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+    for (; it != end; ++it)
+      ase_file_get_frame_cels(*it, frame, cels);
+  }
+}
+
+// Creates an entry for each image to be saved (each image is
+// compressed only once, even if it's shared by several cels), and
+// calculates when each one is needed. The map is filled here so the
+// workers of ase_file_compress_images() only modify the content of
+// their own entries.
+static void ase_file_prepare_images(Sprite* sprite, ASE_CompressedPixelsMap* compressed_pixels, ASE_ImagesOrder* order)
+{
+  Stock* stock = sprite->stock();
+  const AseStockLoader* loader = dynamic_cast<const AseStockLoader*>(stock->loader());
+
+  // Cels with an image that was already written in the same layer are
+  // written as links (see ase_file_write_cel_chunk())
+  std::set<std::pair<const Layer*, int> > written;
+  std::map<int, FrameNumber> lastFrame;
+
+  for (FrameNumber frame(0); frame<sprite->totalFrames(); ++frame) {
+    CelList cels;
+    ase_file_get_frame_cels(sprite->folder(), frame, cels);
+
+    for (Cel* cel : cels) {
+      int index = cel->imageIndex();
+      if (index == 0 ||
+          !written.insert(std::make_pair((const Layer*)cel->layer(), index)).second)
+        continue;
+
+      lastFrame[index] = frame;
+      if (compressed_pixels->find(index) == compressed_pixels->end()) {
+        ASE_CompressedPixels& pixels = (*compressed_pixels)[index];
+        pixels.width = pixels.height = 0;
+        pixels.size = 0;
+        pixels.pos = -1;
+        pixels.reused = (loader && loader->hasImage(index) &&
+                         stock->isUnmodifiedLazyImage(index));
+        pixels.ready = false;
+        pixels.keep = false;
+        order->images.push_back(index);
+      }
+    }
+
+    order->frameEnd.push_back(order->images.size());
+  }
+
+  order->lastUse.resize(sprite->totalFrames());
+  for (const auto& pair : lastFrame)
+    order->lastUse[pair.second].push_back(pair.first);
+}
+
+// Compresses the given images in parallel (images that were already
+// compressed are skipped).
+static void ase_file_compress_images(Sprite* sprite, const AseOptions* options, ASE_CompressedPixelsMap& compressed_pixels, const std::vector<int>& indexes)
+{
+  int strategy;
+  switch (options->strategy()) {
+    case AseOptions::FilteredStrategy: strategy = Z_FILTERED; break;
+    case AseOptions::RleStrategy: strategy = Z_RLE; break;
+    default: strategy = Z_DEFAULT_STRATEGY; break;
+  }
+
+  Stock* stock = sprite->stock();
+  const AseStockLoader* loader = dynamic_cast<const AseStockLoader*>(stock->loader());
+
+  base::parallel_for(0, int(indexes.size()),
+    [&](int i) {
+      int index = indexes[i];
+      ASE_CompressedPixels* pixels = &compressed_pixels.find(index)->second;
+      if (pixels->ready)
+        return;
+
+      // Unmodified images are copied as they are in the original file
+      if (pixels->reused) {
+        try {
+          if (!loader)
+            throw base::Exception("The original file is not available.\n");
+
+          loader->readCompressedPixels(index, pixels);
+        }
+        catch (const std::exception&) {
+          // The file was modified by other program (or it cannot be
+          // read), so the image is compressed again. If it's not in
+          // memory the loader fails too, and the file is not saved
+          // (see Stock::hasLoadErrors()).
+          pixels->reused = false;
+          pixels->data.clear();
+        }
+      }
+
+      if (!pixels->reused) {
+        Image* image = stock->getImage(index);
+        pixels->width = image->width();
+        pixels->height = image->height();
+
+        switch (image->pixelFormat()) {
+
+          case IMAGE_RGB:
+            write_compressed_image<RgbTraits>(&pixels->data, image, options->compressionLevel(), strategy);
+            break;
+
+          case IMAGE_GRAYSCALE:
+            write_compressed_image<GrayscaleTraits>(&pixels->data, image, options->compressionLevel(), strategy);
+            break;
+
+          case IMAGE_INDEXED:
+            write_compressed_image<IndexedTraits>(&pixels->data, image, options->compressionLevel(), strategy);
+            break;
+        }
+      }
+
+      pixels->size = pixels->data.size();
+      pixels->ready = true;
+    });
+}
+
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, ASE_CompressedPixelsMap& compressed_pixels, ASE_CelLinks& links)
 {
   ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
   int layer_index = sprite->layerToIndex(layer);
   int cel_type = ASE_FILE_COMPRESSED_CEL;
 
+  // If a previous cel in the same layer uses the same image, we
+  // write a link to that frame instead of saving the image again.
+  FrameNumber linkFrame;
+  if (cel->imageIndex() != 0) {
+    std::pair<ASE_CelLinks::iterator, bool> res =
+      links.insert(std::make_pair(std::make_pair((const Layer*)layer, cel->imageIndex()),
+                                  cel->frame()));
+    if (!res.second) {
+      linkFrame = res.first->second;
+      cel_type = ASE_FILE_LINK_CEL;
+    }
+  }
+
   fputw(layer_index, f);
   fputw(cel->x(), f);
   fputw(cel->y(), f);
@@ -1165,33 +1738,27 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
 
     case ASE_FILE_LINK_CEL:
       // Linked cel to another frame
-      //fputw(link->frame, f);
-      fputw(0, f);
+      fputw(linkFrame, f);
       break;
 
     case ASE_FILE_COMPRESSED_CEL: {
-      Image* image = cel->image();
+      ASE_CompressedPixelsMap::iterator it = compressed_pixels.find(cel->imageIndex());
 
-      if (image) {
-        // Width and height
-        fputw(image->width(), f);
-        fputw(image->height(), f);
+      if (it != compressed_pixels.end()) {
+        ASE_CompressedPixels& pixels = it->second;
 
-        // Pixel data
-        switch (image->pixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
+        // Width and height
+        fputw(pixels.width, f);
+        fputw(pixels.height, f);
 
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
+        // Pixel data (already compressed)
+        pixels.pos = ftell(f);
 
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        const std::vector<uint8_t>& compressed = pixels.data;
+        if (!compressed.empty() &&
+            ((fwrite(&compressed[0], 1, compressed.size(), f) != compressed.size())
+             || ferror(f)))
+          throw base::Exception("Error writing compressed image pixels.\n");
       }
       else {
         // Width and height
@@ -1203,15 +1770,51 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
   }
 }
 
-static Mask* ase_file_read_mask_chunk(FILE* f)
+// Called after overwriting the file of the lazy images, they are
+// loaded from the new positions of their compressed pixels. Saved
+// images become unmodified lazy images too, so they aren't compressed
+// again in the next save, except the ones referenced by the undo
+// history (they cannot be unloaded anyway).
+static void ase_file_update_lazy_images(Sprite* sprite, FileOp* fop, const ASE_CompressedPixelsMap& compressed_pixels)
+{
+  Stock* stock = sprite->stock();
+  AseStockLoader* loader = new AseStockLoader(fop->filename, sprite->pixelFormat());
+  std::vector<int> indexes;
+  for (const auto& pair : compressed_pixels) {
+    const ASE_CompressedPixels& pixels = pair.second;
+    if (pixels.pos < 0)
+      continue;
+
+    ASE_LazyImage lazy;
+    lazy.pos = pixels.pos;
+    lazy.size = pixels.size;
+    lazy.width = pixels.width;
+    lazy.height = pixels.height;
+    loader->addImage(pair.first, lazy);
+    indexes.push_back(pair.first);
+  }
+
+  // The compressed pixels can be deleted with the old loader from
+  // this point.
+  stock->setLoader(loader);
+
+  const DocumentUndo* undo = fop->document->getUndo();
+  for (int index : indexes) {
+    Image* image = stock->getLoadedImage(index);
+    if (!image || !undo->isImageReferenced(image))
+      stock->setLazyImage(index);
+  }
+}
+
+static Mask* ase_file_read_mask_chunk(BufferedFileReader* f)
 {
   int c, u, v, byte;
   Mask* mask;
   // Read chunk data
-  int x = fgetw(f);
-  int y = fgetw(f);
-  int w = fgetw(f);
-  int h = fgetw(f);
+  int x = f->read16();
+  int y = f->read16();
+  int w = f->read16();
+  int h = f->read16();
 
   ase_file_read_padding(f, 8);
   std::string name = ase_file_read_string(f);
@@ -1223,7 +1826,7 @@ static Mask* ase_file_read_mask_chunk(FILE* f)
   // Read image data
   for (v=0; v<h; v++)
     for (u=0; u<(w+7)/8; u++) {
-      byte = fgetc(f);
+      byte = f->read8();
       for (c=0; c<8; c++)
         put_pixel(mask->bitmap(), u*8+c, v, byte & (1<<(7-c)));
     }
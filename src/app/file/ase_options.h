@@ -0,0 +1,62 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_FILE_ASE_OPTIONS_H_INCLUDED
+#define APP_FILE_ASE_OPTIONS_H_INCLUDED
+#pragma once
+
+#include "app/file/format_options.h"
+
+namespace app {
+
+  // Data for .ase files
+  class AseOptions : public FormatOptions {
+  public:
+    // zlib compression levels, from 1 (fastest) to 9 (smallest
+    // files). The default level is a balance between both.
+    enum {
+      kDefaultCompression = -1,
+      kFastestCompression = 1,
+      kBestCompression = 9,
+    };
+
+    // zlib strategies. Rle is fast and works well with images that
+    // have big flat areas.
+    enum Strategy { DefaultStrategy, FilteredStrategy, RleStrategy };
+
+    AseOptions(
+      int compressionLevel = kDefaultCompression,
+      Strategy strategy = DefaultStrategy)
+      : m_compressionLevel(compressionLevel)
+      , m_strategy(strategy) {
+    }
+
+    int compressionLevel() const { return m_compressionLevel; }
+    Strategy strategy() const { return m_strategy; }
+
+    void setCompressionLevel(int level) { m_compressionLevel = level; }
+    void setStrategy(Strategy strategy) { m_strategy = strategy; }
+
+  private:
+    int m_compressionLevel;
+    Strategy m_strategy;
+  };
+
+} // namespace app
+
+#endif
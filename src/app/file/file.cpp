@@ -114,12 +114,12 @@ Document* load_document(Context* context, const char* filename)
   return document;
 }
 
-int save_document(Context* context, doc::Document* document)
+int save_document(Context* context, doc::Document* document, int flags)
 {
   ASSERT(dynamic_cast<app::Document*>(document));
 
   int ret;
-  FileOp* fop = fop_to_save_document(context, static_cast<app::Document*>(document));
+  FileOp* fop = fop_to_save_document(context, static_cast<app::Document*>(document), flags);
   if (!fop)
     return -1;
 
@@ -230,11 +230,15 @@ FileOp* fop_to_load_document(Context* context, const char* filename, int flags)
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->oneframe = true;
 
+  // Load images when they are needed
+  if (flags & FILE_LOAD_LAZY_IMAGES)
+    fop->lazy_images = true;
+
 done:;
   return fop;
 }
 
-FileOp* fop_to_save_document(Context* context, Document* document)
+FileOp* fop_to_save_document(Context* context, Document* document, int flags)
 {
   FileOp *fop;
   bool fatal;
@@ -246,6 +250,10 @@ FileOp* fop_to_save_document(Context* context, Document* document)
   // Document to save
   fop->document = document;
 
+  // Save as fast as possible (the format options depend on this)
+  if (flags & FILE_SAVE_FAST)
+    fop->fast_save = true;
+
   // Get the extension of the filename (in lower case)
   std::string extension = base::string_to_lower(base::get_file_extension(fop->document->filename()));
 
@@ -497,18 +505,17 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
 
           // Compare the old frame with the new one
 #if USE_LINK // TODO this should be configurable through a check-box
-          if (count_diff_between_images(old_image, fop->seq.image)) {
+          if (!is_same_image(old_image, fop->seq.image)) {
             SEQUENCE_IMAGE();
           }
           // We don't need this image
           else {
             delete fop->seq.image;
+            fop->seq.image = NULL;
 
-            // But add a link frame
-            fop->seq.last_cel->image = image_index;
-            layer_add_frame(fop->seq.layer, fop->seq.last_cel);
-
-            fop->seq.last_image = NULL;
+            // But add a linked cel (it shares the previous image)
+            fop->seq.last_cel->setImage(image_index);
+            fop->seq.layer->addCel(fop->seq.last_cel);
             fop->seq.last_cel = NULL;
           }
 #else
@@ -548,8 +555,16 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
            fop->format != NULL &&
            fop->format->support(FILE_SUPPORT_SAVE)) {
 #ifdef ENABLE_SAVE
+    Stock* stock = fop->document->sprite()->stock();
+
+    // Lazy images that couldn't be loaded from the original file are
+    // empty, saving them would lose the original pixels.
+    if (stock->hasLoadErrors()) {
+      fop_error(fop, "Some images of the sprite couldn't be loaded from its file,\n"
+                "the sprite cannot be saved.\n");
+    }
     // Save a sequence
-    if (fop->is_sequence()) {
+    else if (fop->is_sequence()) {
       ASSERT(fop->format->support(FILE_SUPPORT_SEQUENCES));
 
       Sprite* sprite = fop->document->sprite();
@@ -598,6 +613,11 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
         fop_error(fop, "Error saving the sprite in the file \"%s\"\n",
                   fop->filename.c_str());
     }
+
+    // Lazy images are loaded while they are saved
+    if (!fop->has_error() && stock->hasLoadErrors())
+      fop_error(fop, "Some images of the sprite couldn't be loaded from its file,\n"
+                "\"%s\" was saved with empty images.\n", fop->filename.c_str());
 #else
     fop_error(fop,
       "Save operation is not supported in trial version.\n"
@@ -827,6 +847,8 @@ static FileOp* fop_new(FileOpType type, Context* context)
   fop->done = false;
   fop->stop = false;
   fop->oneframe = false;
+  fop->lazy_images = false;
+  fop->fast_save = false;
 
   fop->seq.palette = NULL;
   fop->seq.image = NULL;
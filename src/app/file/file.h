@@ -32,6 +32,9 @@
 #define FILE_LOAD_SEQUENCE_ASK          0x00000002
 #define FILE_LOAD_SEQUENCE_YES          0x00000004
 #define FILE_LOAD_ONE_FRAME             0x00000008
+#define FILE_LOAD_LAZY_IMAGES           0x00000010
+
+#define FILE_SAVE_FAST                  0x00000001
 
 namespace base {
   class mutex;
@@ -90,6 +93,10 @@ namespace app {
     bool oneframe : 1;            // Load just one frame (in formats
     // that support animation like
     // GIF/FLI/ASE).
+    bool lazy_images : 1;         // Load images when they are used
+    // (in formats that support it like ASE).
+    bool fast_save : 1;           // Save as fast as possible even if
+    // the file is bigger (e.g. for backups).
 
     // Data for sequences.
     struct {
@@ -128,12 +135,12 @@ namespace app {
   // High-level routines to load/save documents.
 
   app::Document* load_document(Context* context, const char* filename);
-  int save_document(Context* context, doc::Document* document);
+  int save_document(Context* context, doc::Document* document, int flags = 0);
 
   // Low-level routines to load/save documents.
 
   FileOp* fop_to_load_document(Context* context, const char* filename, int flags);
-  FileOp* fop_to_save_document(Context* context, Document* document);
+  FileOp* fop_to_save_document(Context* context, Document* document, int flags = 0);
   void fop_operate(FileOp* fop, IFileOpProgress* progress);
   void fop_done(FileOp* fop);
   void fop_stop(FileOp* fop);
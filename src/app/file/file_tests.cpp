@@ -93,3 +93,130 @@ TEST(File, SeveralSizes)
     }
   }
 }
+
+// More frames than images compressed ahead of the frame that is
+// written, with linked cels in several frames.
+TEST(File, FastSaveWithManyFrames)
+{
+  she::ScopedHandle<she::System> system(she::create_system());
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+  const int frames = 150;
+
+  {
+    doc::Document* doc = ctx.documents().add(8, 8, doc::ColorMode::INDEXED, 256);
+    doc->setFilename("test_fast.ase");
+
+    Sprite* sprite = doc->sprite();
+    sprite->setTotalFrames(FrameNumber(frames));
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    put_pixel(layer->getCel(FrameNumber(0))->image(), 0, 0, 0);
+
+    // Each third frame is linked to the previous one
+    for (int i=1; i<frames; ++i) {
+      Cel* prev = layer->getCel(FrameNumber(i-1));
+      int index;
+      if ((i % 3) == 0)
+        index = prev->imageIndex();
+      else {
+        Image* image = Image::create(IMAGE_INDEXED, 8, 8);
+        clear_image(image, 0);
+        put_pixel(image, 0, 0, i % 256);
+        index = sprite->stock()->addImage(image);
+      }
+      layer->addCel(new Cel(FrameNumber(i), index));
+    }
+
+    ASSERT_EQ(0, save_document(&ctx, doc, FILE_SAVE_FAST));
+    doc->close();
+    delete doc;
+  }
+
+  {
+    app::Document* doc = load_document(&ctx, "test_fast.ase");
+    ASSERT_TRUE(doc != NULL);
+    ASSERT_EQ(frames, doc->sprite()->totalFrames());
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(doc->sprite()->folder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    for (int i=0; i<frames; ++i) {
+      Cel* cel = layer->getCel(FrameNumber(i));
+      ASSERT_TRUE(cel != NULL);
+      int expected = ((i % 3) == 0 && i > 0 ? i-1: i) % 256;
+      EXPECT_EQ(expected, (int)get_pixel(cel->image(), 0, 0));
+      if ((i % 3) == 0 && i > 0)
+        EXPECT_EQ(layer->getCel(FrameNumber(i-1))->imageIndex(), cel->imageIndex());
+    }
+
+    doc->close();
+    delete doc;
+  }
+}
+
+// A cel chunk with a wrong (huge) size must be loaded reading only
+// the bytes that are in the file.
+TEST(File, CelChunkBiggerThanFile)
+{
+  she::ScopedHandle<she::System> system(she::create_system());
+  FileFormatsManager::instance()->registerAllFormats();
+  app::Context ctx;
+
+  {
+    doc::Document* doc = ctx.documents().add(16, 16, doc::ColorMode::INDEXED, 256);
+    doc->setFilename("test_chunk.ase");
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(doc->sprite()->folder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    Image* image = layer->getCel(FrameNumber(0))->image();
+    clear_image(image, 0);
+    put_pixel(image, 3, 4, 5);
+
+    ASSERT_EQ(0, save_document(&ctx, doc));
+    doc->close();
+    delete doc;
+  }
+
+  // Change the size of the cel chunk (it's the last chunk of the
+  // file, so it doesn't matter for the next chunks) to 2 GB.
+  {
+    FILE* f = std::fopen("test_chunk.ase", "r+b");
+    ASSERT_TRUE(f != NULL);
+
+    long pos = 128 + 16;          // Header + first frame header
+    long cel_pos = -1;
+    unsigned char buf[6];
+    while (std::fseek(f, pos, SEEK_SET) == 0 &&
+           std::fread(buf, 1, 6, f) == 6) {
+      long size = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (long(buf[3]) << 24);
+      int type = buf[4] | (buf[5] << 8);
+      if (type == 0x2005) {
+        cel_pos = pos;
+        break;
+      }
+      if (size <= 0)
+        break;
+      pos += size;
+    }
+    ASSERT_NE(-1, cel_pos);
+
+    unsigned char huge[4] = { 0xff, 0xff, 0xff, 0x7f };
+    std::fseek(f, cel_pos, SEEK_SET);
+    ASSERT_EQ(4u, std::fwrite(huge, 1, 4, f));
+    std::fclose(f);
+  }
+
+  {
+    app::Document* doc = load_document(&ctx, "test_chunk.ase");
+    ASSERT_TRUE(doc != NULL);
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(doc->sprite()->folder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    Image* image = layer->getCel(FrameNumber(0))->image();
+    EXPECT_EQ(5, (int)get_pixel(image, 3, 4));
+    EXPECT_EQ(0, (int)get_pixel(image, 0, 0));
+
+    doc->close();
+    delete doc;
+  }
+}
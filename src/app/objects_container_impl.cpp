@@ -65,6 +65,11 @@ void ObjectsContainerImpl::insertObject(ObjectId id, void* object)
   m_ptrToId[object] = id;
 }
 
+bool ObjectsContainerImpl::hasObject(const void* object) const
+{
+  return (m_ptrToId.find(const_cast<void*>(object)) != m_ptrToId.end());
+}
+
 void ObjectsContainerImpl::removeObject(ObjectId id)
 {
   std::map<ObjectId, void*>::iterator it1 = m_idToPtr.find(id);
@@ -38,6 +38,9 @@ namespace app {
     void removeObject(undo::ObjectId id);
     void* getObject(undo::ObjectId id);
 
+    // Returns true if the given object was added to the container.
+    bool hasObject(const void* object) const;
+
   private:
     undo::ObjectId m_idCounter;
     std::map<undo::ObjectId, void*> m_idToPtr;
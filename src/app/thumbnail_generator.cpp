@@ -33,6 +33,7 @@
 #include "doc/algorithm/rotate.h"
 #include "doc/conversion_she.h"
 #include "doc/image.h"
+#include "doc/image_buffer_pool.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
 #include "doc/sprite.h"
@@ -83,7 +84,10 @@ private:
         RenderEngine renderEngine(m_fop->document,
           sprite, NULL, FrameNumber(0));
 
-        doc::ImageBufferPtr thumbnail_buffer(new doc::ImageBuffer);
+        doc::ImageBufferPtr thumbnail_buffer =
+          doc::ImageBufferPool::instance()->get(
+            doc::calculate_image_buffer_size(doc::IMAGE_RGB,
+              sprite->width(), sprite->height(), true));
         base::UniquePtr<Image> image(renderEngine.renderSprite(
             sprite->bounds(), FrameNumber(0),
             Zoom(1, 1), true, false,
@@ -83,6 +83,7 @@ class SimpleInkProcessing : public InkProcessing<Derived> {
 public:
   void initIterators(ToolLoop* loop, int x1, int y) {
     m_dstAddress = (typename ImageTraits::address_t)loop->getDstImage()->getPixelAddress(x1, y);
+    loop->getDstImage()->incrementVersion();
   }
 
   void moveIterators() {
@@ -99,6 +100,7 @@ public:
   void initIterators(ToolLoop* loop, int x1, int y) {
     m_srcAddress = (typename ImageTraits::address_t)loop->getSrcImage()->getPixelAddress(x1, y);
     m_dstAddress = (typename ImageTraits::address_t)loop->getDstImage()->getPixelAddress(x1, y);
+    loop->getDstImage()->incrementVersion();
   }
 
   void moveIterators() {
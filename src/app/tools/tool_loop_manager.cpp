@@ -23,13 +23,13 @@
 #include "app/tools/tool_loop_manager.h"
 
 #include "app/context.h"
+#include "app/document.h"
 #include "app/settings/document_settings.h"
 #include "app/tools/controller.h"
 #include "app/tools/ink.h"
 #include "app/tools/intertwine.h"
 #include "app/tools/point_shape.h"
 #include "app/tools/tool_loop.h"
-#include "app/util/render.h"
 #include "gfx/region.h"
 #include "doc/image.h"
 #include "doc/primitives.h"
@@ -69,7 +69,7 @@ void ToolLoopManager::prepareLoop(const Pointer& pointer)
 
   // Prepare preview image (the destination image will be our preview
   // in the tool-loop time, so we can see what we are drawing)
-  RenderEngine::setPreviewImage(
+  m_toolLoop->getDocument()->setPreviewImage(
     m_toolLoop->getLayer(),
     m_toolLoop->getFrame(),
     m_toolLoop->getDstImage());
@@ -78,7 +78,7 @@ void ToolLoopManager::prepareLoop(const Pointer& pointer)
 void ToolLoopManager::releaseLoop(const Pointer& pointer)
 {
   // No more preview image
-  RenderEngine::setPreviewImage(NULL, FrameNumber(0), NULL);
+  m_toolLoop->getDocument()->setPreviewImage(NULL, FrameNumber(0), NULL);
 }
 
 void ToolLoopManager::pressKey(ui::KeyScancode key)
@@ -34,6 +34,7 @@
 #include "app/ui/editor/scoped_cursor.h"
 #include "app/ui/keyboard_shortcuts.h"
 #include "app/ui_context.h"
+#include "app/util/render.h"
 #include "doc/blend.h"
 #include "ui/message.h"
 #include "ui/system.h"
@@ -73,10 +74,31 @@ DrawingState::~DrawingState()
   destroyLoop();
 }
 
+EditorState::BeforeChangeAction DrawingState::onBeforeChangeState(Editor* editor, EditorState* newState)
+{
+  editor->setFlattenedLayers(NULL);
+  return StandbyState::onBeforeChangeState(editor, newState);
+}
+
+void DrawingState::onBeforePopState(Editor* editor)
+{
+  editor->setFlattenedLayers(NULL);
+  StandbyState::onBeforePopState(editor);
+}
+
 void DrawingState::initToolLoop(Editor* editor, MouseMessage* msg)
 {
   HideShowDrawingCursor hideShow(editor);
 
+  // Only the current layer is modified by the tool loop, so the other
+  // layers can be flattened to make the editor updates faster (they
+  // are not used when we zoom out, see RenderEngine::renderSprite).
+  if (editor->zoom().scale() >= 1.0) {
+    RenderEngine renderEngine(editor->document(), editor->sprite(),
+      editor->layer(), editor->frame());
+    editor->setFlattenedLayers(renderEngine.flattenLayers(editor->frame()));
+  }
+
   m_toolLoopManager->prepareLoop(pointer_from_msg(msg));
   m_toolLoopManager->pressButton(pointer_from_msg(msg));
 
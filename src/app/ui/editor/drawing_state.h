@@ -32,6 +32,8 @@ namespace app {
   public:
     DrawingState(tools::ToolLoop* loop);
     virtual ~DrawingState();
+    virtual BeforeChangeAction onBeforeChangeState(Editor* editor, EditorState* newState) override;
+    virtual void onBeforePopState(Editor* editor) override;
     virtual bool onMouseDown(Editor* editor, ui::MouseMessage* msg) override;
     virtual bool onMouseUp(Editor* editor, ui::MouseMessage* msg) override;
     virtual bool onMouseMove(Editor* editor, ui::MouseMessage* msg) override;
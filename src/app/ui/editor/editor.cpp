@@ -59,6 +59,7 @@
 #include "doc/conversion_she.h"
 #include "doc/doc.h"
 #include "doc/document_event.h"
+#include "doc/image_buffer_pool.h"
 #include "she/surface.h"
 #include "she/system.h"
 #include "ui/ui.h"
@@ -145,6 +146,8 @@ Editor::Editor(Document* document, EditorFlags flags)
   : Widget(editor_type())
   , m_state(new StandbyState())
   , m_decorator(NULL)
+  , m_renderSurface(NULL)
+  , m_prerenderedFrame(NULL)
   , m_document(document)
   , m_sprite(m_document->sprite())
   , m_layer(m_sprite->folder()->getFirstLayer())
@@ -195,6 +198,9 @@ Editor::~Editor()
   setCustomizationDelegate(NULL);
 
   m_mask_timer.stop();
+
+  if (m_renderSurface)
+    m_renderSurface->dispose();
 }
 
 WidgetType editor_type()
@@ -368,13 +374,29 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
     rc.h = clip.y+clip.h-dest_y;
   }
 
+  // Use the pre-rendered frame if it contains the whole area
+  if ((rc.w > 0) && (rc.h > 0) &&
+      m_prerenderedFrame && m_prerenderedBounds.contains(rc)) {
+    she::Surface* surface = getRenderSurface(rc.w, rc.h);
+    if (surface->nativeHandle()) {
+      convert_image_to_surface(m_prerenderedFrame, m_sprite->getPalette(m_frame),
+        surface, rc.x-m_prerenderedBounds.x, rc.y-m_prerenderedBounds.y,
+        0, 0, rc.w, rc.h);
+      g->blit(surface, 0, 0, dest_x, dest_y, rc.w, rc.h);
+    }
+  }
   // Draw the sprite
-  if ((rc.w > 0) && (rc.h > 0)) {
+  else if ((rc.w > 0) && (rc.h > 0)) {
     RenderEngine renderEngine(m_document, m_sprite, m_layer, m_frame);
+    renderEngine.setTileCache(m_document->renderTileCache());
+    renderEngine.setMipmapCache(m_document->renderMipmapCache());
+    renderEngine.setFrameCache(m_document->renderFrameCache());
+    renderEngine.setFlattenedLayers(m_flattenedLayers);
 
-    // Generate the rendered image
-    if (!render_buffer)
-      render_buffer.reset(new doc::ImageBuffer());
+    // Generate the rendered image (the buffer is taken from the
+    // pool and returned to it when "rendered" is destroyed)
+    ImageBufferPtr buffer = ImageBufferPool::instance()->get(
+      calculate_image_buffer_size(IMAGE_RGB, rc.w, rc.h, true));
 
     base::UniquePtr<Image> rendered(NULL);
     try {
@@ -395,7 +417,7 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
       rendered.reset(renderEngine.renderSprite(
           rc, m_frame, m_zoom, true,
           ((m_flags & kShowOnionskin) == kShowOnionskin),
-          render_buffer));
+          buffer));
     }
     catch (const std::exception& e) {
       Console::showException(e);
@@ -410,17 +432,46 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
       }
 
       // Convert the render to a she::Surface
-      she::Surface* tmp(she::instance()->createRgbaSurface(rc.w, rc.h));
-      if (tmp->nativeHandle()) {
+      she::Surface* surface = getRenderSurface(rc.w, rc.h);
+      if (surface->nativeHandle()) {
         convert_image_to_surface(rendered, m_sprite->getPalette(m_frame),
-          tmp, 0, 0, 0, 0, rc.w, rc.h);
-        g->blit(tmp, 0, 0, dest_x, dest_y, rc.w, rc.h);
+          surface, 0, 0, 0, 0, rc.w, rc.h);
+        g->blit(surface, 0, 0, dest_x, dest_y, rc.w, rc.h);
       }
-      tmp->dispose();
     }
   }
 }
 
+// Returns a surface of at least the given size, so we don't have to
+// create one for each painted rectangle.
+she::Surface* Editor::getRenderSurface(int width, int height)
+{
+  if (m_renderSurface &&
+      m_renderSurface->width() >= width &&
+      m_renderSurface->height() >= height)
+    return m_renderSurface;
+
+  if (m_renderSurface) {
+    width = std::max(width, m_renderSurface->width());
+    height = std::max(height, m_renderSurface->height());
+    m_renderSurface->dispose();
+  }
+
+  m_renderSurface = she::instance()->createRgbaSurface(width, height);
+  return m_renderSurface;
+}
+
+void Editor::setPrerenderedFrame(const Image* image, const gfx::Rect& zoomedBounds)
+{
+  m_prerenderedFrame = image;
+  m_prerenderedBounds = zoomedBounds;
+}
+
+void Editor::setFlattenedLayers(FlattenedLayers* layers)
+{
+  m_flattenedLayers.reset(layers);
+}
+
 void Editor::drawSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& _rc)
 {
   gfx::Rect rc = _rc;
@@ -721,7 +772,7 @@ void Editor::flashCurrentLayer()
   int x, y;
   const Image* src_image = loc.image(&x, &y);
   if (src_image) {
-    RenderEngine::setPreviewImage(NULL, FrameNumber(0), NULL);
+    m_document->setPreviewImage(NULL, FrameNumber(0), NULL);
 
     m_document->prepareExtraCel(m_sprite->bounds(), 255);
     Image* flash_image = m_document->getExtraCelImage();
@@ -1471,6 +1522,9 @@ void Editor::notifyScrollChanged()
 // static
 ImageBufferPtr Editor::getRenderImageBuffer()
 {
+  if (!render_buffer)
+    render_buffer.reset(new doc::ImageBuffer());
+
   return render_buffer;
 }
 
@@ -29,10 +29,12 @@
 #include "app/ui/editor/editor_states_history.h"
 #include "app/zoom.h"
 #include "base/connection.h"
+#include "base/unique_ptr.h"
 #include "doc/document_observer.h"
 #include "doc/frame_number.h"
 #include "doc/image_buffer.h"
 #include "gfx/fwd.h"
+#include "gfx/rect.h"
 #include "ui/base.h"
 #include "ui/timer.h"
 #include "ui/widget.h"
@@ -44,6 +46,9 @@ namespace doc {
 namespace gfx {
   class Region;
 }
+namespace she {
+  class Surface;
+}
 namespace ui {
   class Graphics;
   class View;
@@ -54,6 +59,7 @@ namespace app {
   class DocumentLocation;
   class DocumentView;
   class EditorCustomizationDelegate;
+  class FlattenedLayers;
   class PixelsMovement;
 
   namespace tools {
@@ -109,6 +115,17 @@ namespace app {
     EditorDecorator* decorator() { return m_decorator; }
     void setDecorator(EditorDecorator* decorator) { m_decorator = decorator; }
 
+    // Sets the layers below/above the current layer flattened by the
+    // DrawingState (the editor takes the ownership of them). It can be
+    // NULL to render all layers again.
+    void setFlattenedLayers(FlattenedLayers* layers);
+
+    // Image to be shown instead of rendering the sprite. It must
+    // contain the given area of the current frame (with the zoom
+    // applied). It's used to play the animation with frames rendered
+    // in a background thread.
+    void setPrerenderedFrame(const Image* image, const gfx::Rect& zoomedBounds);
+
     EditorFlags editorFlags() const { return m_flags; }
     void setEditorFlags(EditorFlags flags) { m_flags = flags; }
 
@@ -253,6 +270,7 @@ namespace app {
     // You should setup the clip of the screen before calling this
     // routine.
     void drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, int dx, int dy);
+    she::Surface* getRenderSurface(int width, int height);
 
     // Stack of states. The top element in the stack is the current state (m_state).
     EditorStatesHistory m_statesHistory;
@@ -264,6 +282,17 @@ namespace app {
     // Current decorator (to draw extra UI elements).
     EditorDecorator* m_decorator;
 
+    // Flattened layers used while the user is drawing.
+    base::UniquePtr<FlattenedLayers> m_flattenedLayers;
+
+    // Surface used to blit the rendered sprite on the screen. It's
+    // reused between paints (and only grows).
+    she::Surface* m_renderSurface;
+
+    // Pre-rendered current frame (see setPrerenderedFrame()).
+    const Image* m_prerenderedFrame;
+    gfx::Rect m_prerenderedBounds;
+
     Document* m_document;         // Active document in the editor
     Sprite* m_sprite;             // Active sprite in the editor
     Layer* m_layer;               // Active layer in the editor
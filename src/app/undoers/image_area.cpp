@@ -74,6 +74,8 @@ void ImageArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
     std::copy(it, it+m_lineSize, addr);
     it += m_lineSize;
   }
+
+  image->incrementVersion();
 }
 
 } // namespace undoers
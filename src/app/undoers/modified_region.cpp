@@ -85,6 +85,8 @@ void ModifiedRegion::revert(ObjectsContainer* objects, UndoersCollector* redoers
       m_stream.read(
         (char*)image->getPixelAddress(rc.x, rc.y+y),
         image->getRowStrideSize(rc.w));
+
+  image->incrementVersion();
 }
 
 } // namespace undoers
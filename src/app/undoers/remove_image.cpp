@@ -23,9 +23,8 @@
 #include "app/undoers/remove_image.h"
 
 #include "app/undoers/add_image.h"
-#include "app/undoers/object_io.h"
+#include "base/unique_ptr.h"
 #include "doc/image.h"
-#include "doc/image_io.h"
 #include "doc/stock.h"
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
@@ -39,10 +38,13 @@ using namespace undo;
 RemoveImage::RemoveImage(ObjectsContainer* objects, Stock* stock, int imageIndex)
   : m_stockId(objects->addObject(stock))
   , m_imageIndex(imageIndex)
+  , m_tiles(stock->getImage(imageIndex))
 {
   Image* image = stock->getImage(imageIndex);
 
-  write_object(objects, m_stream, image, doc::write_image);
+  // The image will be restored with the same ID (see revert())
+  m_imageId = objects->addObject(image);
+  objects->removeObject(m_imageId);
 }
 
 void RemoveImage::dispose()
@@ -53,12 +55,13 @@ void RemoveImage::dispose()
 void RemoveImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Stock* stock = objects->getObjectT<Stock>(m_stockId);
-  Image* image = read_object<Image>(objects, m_stream, doc::read_image);
+  base::UniquePtr<Image> image(m_tiles.createImage());
+  objects->insertObject(m_imageId, image);
 
   // Push an AddImage as redoer
   redoers->pushUndoer(new AddImage(objects, stock, m_imageIndex));
 
-  stock->replaceImage(m_imageIndex, image);
+  stock->replaceImage(m_imageIndex, image.release());
 }
 
 } // namespace undoers
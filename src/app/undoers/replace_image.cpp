@@ -22,9 +22,8 @@
 
 #include "app/undoers/replace_image.h"
 
-#include "app/undoers/object_io.h"
+#include "base/unique_ptr.h"
 #include "doc/image.h"
-#include "doc/image_io.h"
 #include "doc/stock.h"
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
@@ -37,10 +36,13 @@ using namespace undo;
 ReplaceImage::ReplaceImage(ObjectsContainer* objects, Stock* stock, int imageIndex)
   : m_stockId(objects->addObject(stock))
   , m_imageIndex(imageIndex)
+  , m_tiles(stock->getImage(imageIndex))
 {
   Image* image = stock->getImage(imageIndex);
 
-  write_object(objects, m_stream, image, doc::write_image);
+  // The image will be restored with the same ID (see revert())
+  m_imageId = objects->addObject(image);
+  objects->removeObject(m_imageId);
 }
 
 void ReplaceImage::dispose()
@@ -52,15 +54,16 @@ void ReplaceImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Stock* stock = objects->getObjectT<Stock>(m_stockId);
 
-  // Read the image to be restored from the stream
-  Image* image = read_object<Image>(objects, m_stream, doc::read_image);
+  // Create the image to be restored from the tiles
+  base::UniquePtr<Image> image(m_tiles.createImage());
+  objects->insertObject(m_imageId, image);
 
   // Save the current image in the redoers
   redoers->pushUndoer(new ReplaceImage(objects, stock, m_imageIndex));
   Image* oldImage = stock->getImage(m_imageIndex);
 
   // Replace the image in the stock
-  stock->replaceImage(m_imageIndex, image);
+  stock->replaceImage(m_imageIndex, image.release());
 
   // Destroy the old image
   delete oldImage;
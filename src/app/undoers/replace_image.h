@@ -21,10 +21,9 @@
 #pragma once
 
 #include "app/undoers/undoer_base.h"
+#include "doc/image_tiles.h"
 #include "undo/object_id.h"
 
-#include <sstream>
-
 namespace doc {
   class Stock;
 }
@@ -39,17 +38,14 @@ namespace app {
       ReplaceImage(ObjectsContainer* objects, Stock* stock, int imageIndex);
 
       void dispose() override;
-      size_t getMemSize() const override { return sizeof(*this) + getStreamSize(); }
+      size_t getMemSize() const override { return sizeof(*this) + m_tiles.getMemSize(); }
       void revert(ObjectsContainer* objects, UndoersCollector* redoers) override;
 
     private:
-      size_t getStreamSize() const {
-        return const_cast<std::stringstream*>(&m_stream)->tellp();
-      }
-
       undo::ObjectId m_stockId;
+      undo::ObjectId m_imageId;
       uint32_t m_imageIndex;
-      std::stringstream m_stream;
+      ImageTiles m_tiles;
     };
 
   } // namespace undoers
@@ -32,6 +32,7 @@
 #include "app/undoers/dirty_area.h"
 #include "app/undoers/modified_region.h"
 #include "app/undoers/replace_image.h"
+#include "app/undoers/set_cel_image.h"
 #include "app/undoers/set_cel_position.h"
 #include "base/unique_ptr.h"
 #include "doc/cel.h"
@@ -173,9 +174,14 @@ void ExpandCelCanvas::commit()
     }
   }
   else if (m_celImage) {
+    // If the image is shared with other (linked) cels, the cel gets a
+    // new image, so the other cels are not modified.
+    bool linked = (m_sprite->getImageRefs(m_cel->imageIndex()) > 1);
+
     // If the size of each image is the same, we can create an undo
     // with only the differences between both images.
-    if (m_cel->position() == m_origCelPos &&
+    if (!linked &&
+        m_cel->position() == m_origCelPos &&
         m_bounds.getOrigin() == m_origCelPos &&
         m_celImage->width() == m_dstImage->width() &&
         m_celImage->height() == m_dstImage->height()) {
@@ -207,20 +213,38 @@ void ExpandCelCanvas::commit()
           m_cel->setPosition(newPos);
         }
 
-        m_undo.pushUndoer(new undoers::ReplaceImage(m_undo.getObjects(),
-            m_sprite->stock(), m_cel->imageIndex()));
+        if (!linked)
+          m_undo.pushUndoer(new undoers::ReplaceImage(m_undo.getObjects(),
+              m_sprite->stock(), m_cel->imageIndex()));
       }
 
       // Validate the whole m_dstImage copying invalid areas from m_celImage
       validateDestCanvas(gfx::Region(m_bounds));
 
-      // Replace the image in the stock. We need to create a copy of
-      // image because m_dstImage's ImageBuffer cannot be shared.
-      m_sprite->stock()->replaceImage(m_cel->imageIndex(),
-        Image::createCopy(m_dstImage));
+      // Add a copy of m_dstImage in the stock for this cel only (the
+      // old image is still used by the other linked cels).
+      if (linked) {
+        int imageIndex = m_sprite->stock()->addImage(
+          Image::createCopy(m_dstImage));
+
+        if (m_undo.isEnabled()) {
+          m_undo.pushUndoer(new undoers::AddImage(m_undo.getObjects(),
+              m_sprite->stock(), imageIndex));
+          m_undo.pushUndoer(new undoers::SetCelImage(m_undo.getObjects(),
+              m_cel));
+        }
 
-      // Destroy the old cel image.
-      delete m_celImage;
+        m_cel->setImage(imageIndex);
+      }
+      else {
+        // Replace the image in the stock. We need to create a copy of
+        // image because m_dstImage's ImageBuffer cannot be shared.
+        m_sprite->stock()->replaceImage(m_cel->imageIndex(),
+          Image::createCopy(m_dstImage));
+
+        // Destroy the old cel image.
+        delete m_celImage;
+      }
     }
   }
   else {
@@ -0,0 +1,165 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/playback_buffer.h"
+
+#include "app/document.h"
+#include "base/bind.h"
+#include "base/scoped_lock.h"
+#include "doc/image.h"
+#include "doc/sprite.h"
+
+namespace app {
+
+PlaybackBuffer::PlaybackBuffer(Document* document,
+                               const std::vector<FrameNumber>& frames, int loopStart,
+                               const gfx::Rect& zoomedBounds, Zoom zoom,
+                               size_t maxBytes)
+  : m_document(document)
+  , m_renderEngine(document, document->sprite(), NULL, frames[0])
+  , m_frames(frames)
+  , m_loopStart(loopStart)
+  , m_bounds(zoomedBounds)
+  , m_zoom(zoom)
+  , m_playPos(0)
+  , m_renderPos(0)
+  , m_stop(false)
+{
+  ASSERT(!frames.empty());
+  ASSERT(loopStart >= 0 && loopStart < int(frames.size()));
+
+  if (m_bounds.isEmpty())
+    return;
+
+  // We need at least two slots: the one that is being shown and the
+  // next one. Otherwise frames are rendered when they are painted.
+  size_t frameBytes = size_t(m_bounds.w) * m_bounds.h * 4;
+  size_t slots = maxBytes / frameBytes;
+  if (slots < 2)
+    return;
+
+  Slot empty = { -1, NULL };
+  m_slots.resize(slots, empty);
+
+  m_thread.reset(new base::thread(Bind<void>(&PlaybackBuffer::renderFrames, this)));
+}
+
+PlaybackBuffer::~PlaybackBuffer()
+{
+  if (m_thread) {
+    {
+      base::scoped_lock lock(m_mutex);
+      m_stop = true;
+    }
+    m_thread->join();
+  }
+
+  for (size_t i=0; i<m_slots.size(); ++i)
+    delete m_slots[i].image;
+}
+
+FrameNumber PlaybackBuffer::frameAt(int pos) const
+{
+  int size = int(m_frames.size());
+  if (pos >= size)
+    pos = m_loopStart + (pos - m_loopStart) % (size - m_loopStart);
+
+  return m_frames[pos];
+}
+
+const Image* PlaybackBuffer::getFrame(int pos)
+{
+  if (m_slots.empty())
+    return NULL;
+
+  base::scoped_lock lock(m_mutex);
+  if (pos > m_playPos)
+    m_playPos = pos;
+
+  const Slot& slot = m_slots[pos % m_slots.size()];
+  return (slot.pos == pos ? slot.image: NULL);
+}
+
+// Background thread: renders the positions after the playback
+// position until the ring buffer is full.
+void PlaybackBuffer::renderFrames()
+{
+  int slots = int(m_slots.size());
+
+  for (;;) {
+    int pos;
+    bool full;
+    {
+      base::scoped_lock lock(m_mutex);
+      if (m_stop)
+        break;
+
+      // Skip frames that were already played
+      if (m_renderPos < m_playPos)
+        m_renderPos = m_playPos;
+
+      pos = m_renderPos;
+      full = (pos >= m_playPos + slots);
+    }
+
+    if (full) {
+      base::this_thread::sleep_for(0.005);
+      continue;
+    }
+
+    Image* image = NULL;
+    if (m_document->lock(Document::ReadLock)) {
+      try {
+        ImageBufferPtr buffer;
+        image = m_renderEngine.renderSprite(m_bounds, frameAt(pos), m_zoom,
+          true, false, buffer);
+      }
+      catch (const std::exception&) {
+        // Frames that cannot be rendered (e.g. not enough memory)
+        // will be rendered by the editor when they are painted.
+        m_document->unlock();
+        break;
+      }
+      m_document->unlock();
+    }
+
+    if (!image) {
+      base::this_thread::sleep_for(0.005);
+      continue;
+    }
+
+    base::scoped_lock lock(m_mutex);
+    if (pos != m_renderPos || pos < m_playPos) {
+      // The playback is ahead of this frame
+      delete image;
+      continue;
+    }
+
+    Slot& slot = m_slots[pos % slots];
+    delete slot.image;
+    slot.pos = pos;
+    slot.image = image;
+    ++m_renderPos;
+  }
+}
+
+} // namespace app
@@ -0,0 +1,100 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UTIL_PLAYBACK_BUFFER_H_INCLUDED
+#define APP_UTIL_PLAYBACK_BUFFER_H_INCLUDED
+#pragma once
+
+#include "app/util/render.h"
+#include "app/zoom.h"
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
+#include "doc/frame_number.h"
+#include "gfx/rect.h"
+
+#include <vector>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+  class Document;
+
+  using namespace doc;
+
+  // Renders the frames of an animation in a background thread, ahead
+  // of the playback position, so they can be shown in real time. The
+  // rendered frames are kept in a ring buffer limited by "maxBytes".
+  //
+  // The playback sequence is given as a list of frames where the
+  // frames from "loopStart" to the end are repeated forever. Each
+  // step of the playback is a position in that sequence (0, 1, 2...).
+  class PlaybackBuffer {
+  public:
+    static const size_t kDefaultMaxBytes = 256*1024*1024;
+
+    PlaybackBuffer(Document* document,
+                   const std::vector<FrameNumber>& frames, int loopStart,
+                   const gfx::Rect& zoomedBounds, Zoom zoom,
+                   size_t maxBytes = kDefaultMaxBytes);
+    ~PlaybackBuffer();
+
+    // Area of the sprite rendered in each frame (with the zoom
+    // applied).
+    const gfx::Rect& bounds() const { return m_bounds; }
+
+    // Frame to show in the given position of the playback.
+    FrameNumber frameAt(int pos) const;
+
+    // Returns the frame rendered for the given position, or NULL if
+    // it's not ready yet. Previous positions are discarded, so their
+    // space is used for the next frames. The image is valid until
+    // the next call.
+    const Image* getFrame(int pos);
+
+  private:
+    struct Slot {
+      int pos;
+      Image* image;
+    };
+
+    void renderFrames();
+
+    Document* m_document;
+    RenderEngine m_renderEngine;
+    std::vector<FrameNumber> m_frames;
+    int m_loopStart;
+    gfx::Rect m_bounds;
+    Zoom m_zoom;
+
+    base::mutex m_mutex;
+    std::vector<Slot> m_slots;
+    int m_playPos;            // Current playback position
+    int m_renderPos;          // Next position to render
+    bool m_stop;
+    base::UniquePtr<base::thread> m_thread;
+
+    DISABLE_COPYING(PlaybackBuffer);
+  };
+
+} // namespace app
+
+#endif
@@ -29,6 +29,14 @@
 #include "app/settings/document_settings.h"
 #include "app/settings/settings.h"
 #include "app/ui_context.h"
+#include "app/util/render_frame_cache.h"
+#include "app/util/render_mipmap_cache.h"
+#include "app/util/render_tile_cache.h"
+#include "base/parallel_for.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
+
+#include <algorithm>
 
 namespace app {
 
@@ -39,11 +47,13 @@ template<class DstTraits, class SrcTraits>
 class BlenderHelper
 {
   BLEND_COLOR m_blend_color;
+  int m_blend_mode;
   uint32_t m_mask_color;
 public:
   BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
   {
     m_blend_color = SrcTraits::get_blender(blend_mode);
+    m_blend_mode = blend_mode;
     m_mask_color = src->maskColor();
   }
   inline void operator()(typename DstTraits::pixel_t& scanline,
@@ -56,6 +66,12 @@ public:
     else
       scanline = dst;
   }
+  inline void blendRow(typename DstTraits::pixel_t* scanline,
+                       const typename SrcTraits::pixel_t* src,
+                       int n, int opacity)
+  {
+    SrcTraits::blend_row(scanline, src, n, opacity, m_blend_mode, m_mask_color);
+  }
 };
 
 template<>
@@ -81,6 +97,13 @@ public:
     else
       scanline = dst;
   }
+  inline void blendRow(RgbTraits::pixel_t* scanline,
+                       const GrayscaleTraits::pixel_t* src,
+                       int n, int opacity)
+  {
+    for (int x=0; x<n; ++x, ++scanline, ++src)
+      operator()(*scanline, *scanline, *src, opacity);
+  }
 };
 
 template<>
@@ -112,11 +135,18 @@ public:
         scanline = dst;
     }
   }
+  inline void blendRow(RgbTraits::pixel_t* scanline,
+                       const IndexedTraits::pixel_t* src,
+                       int n, int opacity)
+  {
+    for (int x=0; x<n; ++x, ++scanline, ++src)
+      operator()(*scanline, *scanline, *src, opacity);
+  }
 };
 
 template<class DstTraits, class SrcTraits>
 static void merge_zoomed_image_scale_up(Image* dst, const Image* src, const Palette* pal,
-  int x, int y, int opacity, int blend_mode, Zoom zoom)
+  const gfx::Rect& srcBounds, int x, int y, int opacity, int blend_mode, Zoom zoom)
 {
   BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blend_mode);
   int src_x, src_y, src_w, src_h;
@@ -128,15 +158,15 @@ static void merge_zoomed_image_scale_up(Image* dst, const Image* src, const Pale
   box_w = zoom.apply(1);
   box_h = zoom.apply(1);
 
-  src_x = 0;
-  src_y = 0;
-  src_w = src->width();
-  src_h = src->height();
+  src_x = srcBounds.x;
+  src_y = srcBounds.y;
+  src_w = srcBounds.w;
+  src_h = srcBounds.h;
 
-  dst_x = x;
-  dst_y = y;
-  dst_w = zoom.apply(src->width());
-  dst_h = zoom.apply(src->height());
+  dst_x = x + zoom.apply(srcBounds.x);
+  dst_y = y + zoom.apply(srcBounds.y);
+  dst_w = zoom.apply(srcBounds.w);
+  dst_h = zoom.apply(srcBounds.h);
 
   // clipping...
   if (dst_x < 0) {
@@ -184,12 +214,7 @@ static void merge_zoomed_image_scale_up(Image* dst, const Image* src, const Pale
 #endif
 
   // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, gfx::Rect(src_x, src_y, src_w, src_h));
   LockImageBits<DstTraits> dstBits(dst, gfx::Rect(dst_x, dst_y, dst_w, dst_h));
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
   typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
 
   // For each line to draw of the source image...
@@ -197,16 +222,13 @@ static void merge_zoomed_image_scale_up(Image* dst, const Image* src, const Pale
     dst_it = dstBits.begin_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
     dst_end = dstBits.end_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
 
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
+    // Read 'dst' pixels (one for each 'src' pixel) in `scanline'
     scanline_it = scanline.begin();
     for (x=0; x<src_w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
       ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
       ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
 
-      blender(*scanline_it, *dst_it, *src_it, opacity);
-
-      ++src_it;
+      *scanline_it = *dst_it;
 
       int delta;
       if ((x == 0) && (first_box_w > 0))
@@ -220,6 +242,11 @@ static void merge_zoomed_image_scale_up(Image* dst, const Image* src, const Pale
       ++scanline_it;
     }
 
+    // Blend the whole 'src' line with the `scanline'
+    blender.blendRow(&scanline[0],
+      (typename SrcTraits::const_address_t)src->getPixelAddress(src_x, src_y),
+      src_w, opacity);
+
     // Get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_box_h > 0))
       line_h = first_box_h;
@@ -280,7 +307,7 @@ done_with_blit:;
 
 template<class DstTraits, class SrcTraits>
 static void merge_zoomed_image_scale_down(Image* dst, const Image* src, const Palette* pal,
-  int x, int y, int opacity, int blend_mode, Zoom zoom)
+  const gfx::Rect& srcBounds, int x, int y, int opacity, int blend_mode, Zoom zoom)
 {
   BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blend_mode);
   int src_x, src_y, src_w, src_h;
@@ -291,15 +318,15 @@ static void merge_zoomed_image_scale_down(Image* dst, const Image* src, const Pa
   unbox_w = zoom.remove(1);
   unbox_h = zoom.remove(1);
 
-  src_x = 0;
-  src_y = 0;
-  src_w = src->width();
-  src_h = src->height();
+  src_x = srcBounds.x;
+  src_y = srcBounds.y;
+  src_w = srcBounds.w;
+  src_h = srcBounds.h;
 
-  dst_x = x;
-  dst_y = y;
-  dst_w = zoom.apply(src->width());
-  dst_h = zoom.apply(src->height());
+  dst_x = x + zoom.apply(srcBounds.x);
+  dst_y = y + zoom.apply(srcBounds.y);
+  dst_w = zoom.apply(srcBounds.w);
+  dst_h = zoom.apply(srcBounds.h);
 
   // clipping...
   if (dst_x < 0) {
@@ -335,48 +362,67 @@ static void merge_zoomed_image_scale_down(Image* dst, const Image* src, const Pa
 
   bottom = dst_y+dst_h-1;
 
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, gfx::Rect(src_x, src_y, src_w, src_h));
-  LockImageBits<DstTraits> dstBits(dst, gfx::Rect(dst_x, dst_y, dst_w, dst_h));
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  // The scanline contains the 'src' pixels that will be blended in
+  // each 'dst' line
+  typedef std::vector<typename SrcTraits::pixel_t> Scanline;
+  Scanline scanline(MIN((src_w+unbox_w-1) / unbox_w, dst_w));
+  int scanline_w = int(scanline.size());
 
   // For each line to draw of the source image...
   for (y=0; y<src_h; y+=unbox_h) {
-    dst_it = dstBits.begin_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
-    dst_end = dstBits.end_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
-
-    for (x=0; x<src_w; x+=unbox_w) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
+    typename SrcTraits::const_address_t src_address =
+      (typename SrcTraits::const_address_t)src->getPixelAddress(src_x, src_y+y);
 
-      blender(*dst_it, *dst_it, *src_it, opacity);
+    // Skip source pixels
+    for (x=0; x<scanline_w; ++x, src_address += unbox_w)
+      scanline[x] = *src_address;
 
-      // Skip source pixels
-      for (int delta=0; delta < unbox_w && src_it != src_end; ++delta)
-        ++src_it;
-
-      ++dst_it;
-    }
+    blender.blendRow(
+      (typename DstTraits::address_t)dst->getPixelAddress(dst_x, dst_y),
+      &scanline[0], scanline_w, opacity);
 
     if (++dst_y > bottom)
       break;
-
-    // Skip lines
-    for (int delta=0; delta < src_w * (unbox_h-1) && src_it != src_end; ++delta)
-      ++src_it;
   }
 }
 
+// If "scanBounds" is false, the visible bounds of "src" are used only
+// if they were already calculated (e.g. for images that are modified
+// each time they are rendered, like the preview image, where scanning
+// all pixels would cost more than it saves).
 template<class DstTraits, class SrcTraits>
 static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
-  int x, int y, int opacity, int blend_mode, Zoom zoom)
+  int x, int y, int opacity, int blend_mode, Zoom zoom, bool scanBounds)
 {
+  gfx::Rect srcBounds = src->bounds();
+
+  // With the normal blend mode transparent pixels don't modify the
+  // destination, so we can blend the visible part of "src" only
+  // (this is possible only with integer zoom levels, where each
+  // source pixel is drawn in the same place as its neighbors).
+  if (blend_mode == BLEND_MODE_NORMAL &&
+      (zoom.num() == 1 || zoom.den() == 1) &&
+      (scanBounds || src->isVisibleBoundsValid())) {
+    srcBounds = src->visibleBounds();
+    if (srcBounds.isEmpty())
+      return;
+
+    // Keep the pixels that are sampled when we scale down
+    int unbox = zoom.remove(1);
+    if (unbox > 1) {
+      int x2 = MIN(src->width(), (srcBounds.x2()+unbox-1) / unbox * unbox);
+      int y2 = MIN(src->height(), (srcBounds.y2()+unbox-1) / unbox * unbox);
+      srcBounds.x -= srcBounds.x % unbox;
+      srcBounds.y -= srcBounds.y % unbox;
+      srcBounds.w = x2 - srcBounds.x;
+      srcBounds.h = y2 - srcBounds.y;
+    }
+  }
+
   if (zoom.scale() >= 1.0)
-    merge_zoomed_image_scale_up<DstTraits, SrcTraits>(dst, src, pal, x, y, opacity, blend_mode, zoom);
+    merge_zoomed_image_scale_up<DstTraits, SrcTraits>(dst, src, pal, srcBounds, x, y, opacity, blend_mode, zoom);
   else
-    merge_zoomed_image_scale_down<DstTraits, SrcTraits>(dst, src, pal, x, y, opacity, blend_mode, zoom);
+    merge_zoomed_image_scale_down<DstTraits, SrcTraits>(dst, src, pal, srcBounds, x, y, opacity, blend_mode, zoom);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -387,11 +433,6 @@ static bool checked_bg_zoom;
 static app::Color checked_bg_color1;
 static app::Color checked_bg_color2;
 
-static int global_opacity = 255;
-static const Layer* selected_layer = NULL;
-static FrameNumber selected_frame(0);
-static Image* preview_image = NULL;
-
 // static
 void RenderEngine::loadConfig()
 {
@@ -454,6 +495,20 @@ void RenderEngine::setCheckedBgColor2(const app::Color& color)
   set_config_color("Options", "CheckedBgColor2", color);
 }
 
+typedef void (*ZoomedFunc)(Image*, const Image*, const Palette*, int, int, int, int, Zoom, bool);
+
+// Returns the function to merge images of the given format in a RGB
+// image (or NULL if the format is not supported).
+static ZoomedFunc get_zoomed_func(PixelFormat format)
+{
+  switch (format) {
+    case IMAGE_RGB: return merge_zoomed_image<RgbTraits, RgbTraits>;
+    case IMAGE_GRAYSCALE: return merge_zoomed_image<RgbTraits, GrayscaleTraits>;
+    case IMAGE_INDEXED: return merge_zoomed_image<RgbTraits, IndexedTraits>;
+    default: return NULL;
+  }
+}
+
 //////////////////////////////////////////////////////////////////////
 
 RenderEngine::RenderEngine(const Document* document,
@@ -464,16 +519,22 @@ RenderEngine::RenderEngine(const Document* document,
   , m_sprite(sprite)
   , m_currentLayer(currentLayer)
   , m_currentFrame(currentFrame)
+  , m_tileCache(NULL)
+  , m_mipmapCache(NULL)
+  , m_frameCache(NULL)
+  , m_flattenedLayers(NULL)
+  , m_checkedBgType(checked_bg_type)
+  , m_checkedBgZoom(checked_bg_zoom)
+  , m_checkedBgColor1(color_utils::color_for_image(checked_bg_color1, IMAGE_RGB))
+  , m_checkedBgColor2(color_utils::color_for_image(checked_bg_color2, IMAGE_RGB))
+  , m_previewLayer(document->getPreviewLayer())
+  , m_previewFrame(document->getPreviewFrame())
+  , m_previewImage(document->getPreviewImage())
 {
 }
 
-// static
-void RenderEngine::setPreviewImage(const Layer* layer, FrameNumber frame, Image* image)
-{
-  selected_layer = layer;
-  selected_frame = frame;
-  preview_image = image;
-}
+// Minimum height of each band rendered in parallel by renderSprite().
+static const int kMinBandHeight = 64;
 
 Image* RenderEngine::renderSprite(
   const gfx::Rect& zoomedRect,
@@ -482,55 +543,32 @@ Image* RenderEngine::renderSprite(
   bool enable_onionskin,
   ImageBufferPtr& buffer)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, Zoom);
   const LayerImage* background = m_sprite->backgroundLayer();
   bool need_checked_bg = (background != NULL ? !background->isVisible(): true);
   uint32_t bg_color = 0;
-  Image *image;
 
-  switch (m_sprite->pixelFormat()) {
-
-    case IMAGE_RGB:
-      zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
-      break;
-
-    case IMAGE_GRAYSCALE:
-      zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
-      break;
-
-    case IMAGE_INDEXED:
-      zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
-      if (!need_checked_bg)
-        bg_color = m_sprite->getPalette(frame)->getEntry(m_sprite->transparentColor());
-      break;
+  ZoomedFunc zoomed_func = get_zoomed_func(m_sprite->pixelFormat());
+  if (!zoomed_func)
+    return NULL;
 
-    default:
-      return NULL;
-  }
+  if (m_sprite->pixelFormat() == IMAGE_INDEXED && !need_checked_bg)
+    bg_color = m_sprite->getPalette(frame)->getEntry(m_sprite->transparentColor());
 
   // Create a temporary RGB bitmap to draw all to it
-  image = Image::create(IMAGE_RGB, zoomedRect.w, zoomedRect.h, buffer);
+  Image* image = Image::createAligned(IMAGE_RGB, zoomedRect.w, zoomedRect.h, buffer);
   if (!image)
     return NULL;
 
-  // Draw checked background
-  if (need_checked_bg && draw_tiled_bg)
-    renderCheckedBackground(image, zoomedRect.x, zoomedRect.y, zoom);
-  else
-    clear_image(image, bg_color);
-
-  // Draw the current frame.
-  global_opacity = 255;
-  renderLayer(m_sprite->folder(), image,
-    zoomedRect.x, zoomedRect.y,
-    frame, zoom, zoomed_func, true, true, -1);
-
-  // Onion-skin feature: Draw previous/next frames with different
-  // opacity (<255) (it is the onion-skinning)
-  IDocumentSettings* docSettings = UIContext::instance()
-    ->settings()->getDocumentSettings(m_document);
+  bool checked_bg = (need_checked_bg && draw_tiled_bg);
 
-  if (enable_onionskin & docSettings->getUseOnionskin()) {
+  // Onion-skin feature: Previous/next frames are drawn with different
+  // opacity (<255) (it is the onion-skinning). Settings are not read
+  // if they are not needed, because frames can be rendered from
+  // background threads.
+  std::vector<OnionskinFrame> onionskin;
+  IDocumentSettings* docSettings = (enable_onionskin ?
+    UIContext::instance()->settings()->getDocumentSettings(m_document): NULL);
+  if (docSettings && docSettings->getUseOnionskin()) {
     int prevs = docSettings->getOnionskinPrevFrames();
     int nexts = docSettings->getOnionskinNextFrames();
     int opacity_base = docSettings->getOnionskinOpacityBase();
@@ -539,65 +577,547 @@ Image* RenderEngine::renderSprite(
     for (FrameNumber f=frame.previous(prevs); f <= frame.next(nexts); ++f) {
       if (f == frame || f < 0 || f > m_sprite->lastFrame())
         continue;
-      else if (f < frame)
-        global_opacity = opacity_base - opacity_step * ((frame - f)-1);
-      else
-        global_opacity = opacity_base - opacity_step * ((f - frame)-1);
 
-      if (global_opacity > 0) {
-        global_opacity = MID(0, global_opacity, 255);
+      int opacity;
+      if (f < frame)
+        opacity = opacity_base - opacity_step * ((frame - f)-1);
+      else
+        opacity = opacity_base - opacity_step * ((f - frame)-1);
 
+      if (opacity > 0) {
         int blend_mode = -1;
         if (docSettings->getOnionskinType() == IDocumentSettings::Onionskin_Merge)
           blend_mode = BLEND_MODE_NORMAL;
         else if (docSettings->getOnionskinType() == IDocumentSettings::Onionskin_RedBlueTint)
           blend_mode = (f < frame ? BLEND_MODE_RED_TINT: BLEND_MODE_BLUE_TINT);
 
-        renderLayer(m_sprite->folder(), image,
-          zoomedRect.x, zoomedRect.y, f, zoom, zoomed_func,
-          true, true, blend_mode);
+        onionskin.push_back(OnionskinFrame(f, MID(0, opacity, 255), blend_mode));
       }
     }
   }
 
+  bool preview = (m_previewImage && m_previewFrame == frame);
+
+  // The flattened layers can be used if the preview image (if any)
+  // is in the current layer (e.g. while the user is drawing). They
+  // cannot be used when we zoom out: the pixels of a reduced image
+  // are sampled from the origin of each cel, and the flattened
+  // images would be sampled from the origin of the sprite.
+  bool flattened = (m_flattenedLayers &&
+                    zoom.scale() >= 1.0 &&
+                    m_flattenedLayers->sprite() == m_sprite &&
+                    m_flattenedLayers->currentLayer() == m_currentLayer &&
+                    m_flattenedLayers->frame() == frame &&
+                    (!preview || m_previewLayer == m_currentLayer));
+
+  if (!onionskin.empty())
+    prepareOnionskinFrames(onionskin, zoomed_func);
+
+  int bands = std::min(base::thread::hardware_concurrency(),
+                       zoomedRect.h / kMinBandHeight);
+
+  // Cached tiles cannot be used with the onion-skin or the preview
+  // image (they change the whole frame).
+  if (!flattened && m_tileCache && onionskin.empty() && !preview) {
+    renderCachedFrame(image, zoomedRect, frame, zoom, zoomed_func,
+      checked_bg, bg_color);
+  }
+  else if (bands <= 1) {
+    renderBand(image, zoomedRect, frame, zoom, zoomed_func,
+      checked_bg, bg_color, flattened, onionskin);
+  }
+  else {
+    // Each band is rendered in its own image and then copied to the
+    // final one. Bands only read the sprite, so they are independent.
+    int bandHeight = (zoomedRect.h + bands - 1) / bands;
+    int rowBytes = image->getRowStrideSize(zoomedRect.w);
+
+    base::parallel_for(0, bands,
+      [&](int i) {
+        gfx::Rect bandRect(zoomedRect.x, zoomedRect.y + i*bandHeight,
+          zoomedRect.w, std::min(bandHeight, zoomedRect.h - i*bandHeight));
+        if (bandRect.h <= 0)
+          return;
+
+        base::UniquePtr<Image> band(Image::createFromPool(IMAGE_RGB, bandRect.w, bandRect.h));
+        renderBand(band, bandRect, frame, zoom, zoomed_func,
+          checked_bg, bg_color, flattened, onionskin);
+
+        for (int v=0; v<bandRect.h; ++v) {
+          const uint8_t* src = band->getPixelAddress(0, v);
+          std::copy(src, src+rowBytes, image->getPixelAddress(0, i*bandHeight + v));
+        }
+      });
+
+    image->incrementVersion();
+  }
+
+  // No other thread is using the cached images at this point
+  if (m_mipmapCache)
+    m_mipmapCache->removeOldMipmaps();
+  if (m_frameCache)
+    m_frameCache->removeOldFrames();
+
   return image;
 }
 
-// static
-void RenderEngine::renderCheckedBackground(Image* image,
-  int source_x, int source_y, Zoom zoom)
+// Renders the given frame (and the onion-skin frames) in the given
+// image.
+void RenderEngine::renderBand(Image* image, const gfx::Rect& zoomedRect,
+  FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+  bool checked_bg, uint32_t bg_color, bool flattened,
+  const std::vector<OnionskinFrame>& onionskin)
+{
+  if (flattened)
+    renderFlattenedFrame(image, zoomedRect, frame, zoom, zoomed_func,
+      checked_bg, bg_color);
+  else
+    renderFrame(image, zoomedRect, frame, zoom, zoomed_func,
+      checked_bg, bg_color);
+
+  for (std::vector<OnionskinFrame>::const_iterator
+         it=onionskin.begin(), end=onionskin.end(); it != end; ++it) {
+    if (it->image) {
+      Zoom srcZoom = zoom;
+      const Image* src = getZoomedSource(it->image, srcZoom);
+      merge_zoomed_image<RgbTraits, RgbTraits>(image, src, NULL,
+        -zoomedRect.x, -zoomedRect.y, it->opacity,
+        (it->blend_mode < 0 ? BLEND_MODE_NORMAL: it->blend_mode), srcZoom, true);
+    }
+    else {
+      LayersPass pass(it->opacity, it->blend_mode);
+      renderLayer(m_sprite->folder(), image,
+        zoomedRect.x, zoomedRect.y, it->frame, zoom, zoomed_func,
+        true, true, pass);
+    }
+  }
+}
+
+void RenderEngine::renderFrame(Image* image, const gfx::Rect& zoomedRect,
+  FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+  bool checked_bg, uint32_t bg_color)
+{
+  LayersPass pass(255, -1);
+  pass.bottomLayer = findOpaqueLayer(m_sprite->folder(), zoomedRect,
+    frame, zoom, NULL);
+
+  // Draw checked background (if it isn't hidden by an opaque layer)
+  if (!pass.bottomLayer) {
+    if (checked_bg)
+      renderCheckedBg(image, zoomedRect.x, zoomedRect.y, zoom);
+    else
+      clear_image(image, bg_color);
+  }
+
+  renderLayer(m_sprite->folder(), image,
+    zoomedRect.x, zoomedRect.y,
+    frame, zoom, zoomed_func, true, true, pass);
+}
+
+// Renders the current layer between the flattened layers below and
+// above it.
+void RenderEngine::renderFlattenedFrame(Image* image, const gfx::Rect& zoomedRect,
+  FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+  bool checked_bg, uint32_t bg_color)
+{
+  if (checked_bg)
+    renderCheckedBg(image, zoomedRect.x, zoomedRect.y, zoom);
+  else
+    clear_image(image, bg_color);
+
+  if (m_flattenedLayers->below()) {
+    Zoom srcZoom = zoom;
+    const Image* src = getZoomedSource(m_flattenedLayers->below(), srcZoom);
+    merge_zoomed_image<RgbTraits, RgbTraits>(image, src, NULL,
+      -zoomedRect.x, -zoomedRect.y, 255, BLEND_MODE_NORMAL, srcZoom, true);
+  }
+
+  LayersPass pass(255, -1, CurrentLayerOnly);
+  renderLayer(m_sprite->folder(), image,
+    zoomedRect.x, zoomedRect.y,
+    frame, zoom, zoomed_func, true, true, pass);
+
+  if (m_flattenedLayers->above()) {
+    Zoom srcZoom = zoom;
+    const Image* src = getZoomedSource(m_flattenedLayers->above(), srcZoom);
+    merge_zoomed_image<RgbTraits, RgbTraits>(image, src, NULL,
+      -zoomedRect.x, -zoomedRect.y, 255, BLEND_MODE_NORMAL, srcZoom, true);
+  }
+}
+
+FlattenedLayers* RenderEngine::flattenLayers(FrameNumber frame)
+{
+  if (!m_currentLayer || !m_currentLayer->isImage() ||
+      !canFlattenLayers(m_sprite->folder(), frame))
+    return NULL;
+
+  ZoomedFunc zoomed_func = get_zoomed_func(m_sprite->pixelFormat());
+  if (!zoomed_func)
+    return NULL;
+
+  base::UniquePtr<Image> layers[2];
+  LayersRange ranges[2] = { LayersBelowCurrent, LayersAboveCurrent };
+
+  for (int i=0; i<2; ++i) {
+    layers[i].reset(Image::create(IMAGE_RGB, m_sprite->width(), m_sprite->height()));
+    clear_image(layers[i], 0);
+
+    LayersPass pass(255, -1, ranges[i]);
+    renderLayer(m_sprite->folder(), layers[i], 0, 0,
+      frame, Zoom(1, 1), zoomed_func, true, true, pass);
+
+    // We don't need fully transparent images
+    if (layers[i]->visibleBounds().isEmpty())
+      layers[i].reset(NULL);
+  }
+
+  return new FlattenedLayers(m_sprite, m_currentLayer, frame,
+    layers[0].release(), layers[1].release());
+}
+
+// Returns true if all visible layers (except the current one) use the
+// normal blend mode, so they can be merged in a transparent image and
+// then blended with the rest of the layers.
+bool RenderEngine::canFlattenLayers(const Layer* layer, FrameNumber frame) const
+{
+  if (!layer->isVisible() || layer == m_currentLayer)
+    return true;
+
+  switch (layer->type()) {
+
+    case ObjectType::LayerImage:
+      return (!static_cast<const LayerImage*>(layer)->getCel(frame) ||
+              static_cast<const LayerImage*>(layer)->getBlendMode() == BLEND_MODE_NORMAL);
+
+    case ObjectType::LayerFolder: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        if (!canFlattenLayers(*it, frame))
+          return false;
+      break;
+    }
+
+  }
+  return true;
+}
+
+// Returns the top-most layer that covers the whole "zoomedRect" with
+// opaque pixels of its cel, so nothing below it is visible in that
+// area. Returns "opaqueLayer" if there is no such layer.
+const Layer* RenderEngine::findOpaqueLayer(const Layer* layer,
+  const gfx::Rect& zoomedRect, FrameNumber frame, Zoom zoom,
+  const Layer* opaqueLayer) const
+{
+  if (!layer->isVisible())
+    return opaqueLayer;
+
+  switch (layer->type()) {
+
+    case ObjectType::LayerImage: {
+      const Cel* cel = static_cast<const LayerImage*>(layer)->getCel(frame);
+      if (!cel || !cel->image() || cel->opacity() < 255 ||
+          static_cast<const LayerImage*>(layer)->getBlendMode() != BLEND_MODE_NORMAL)
+        break;
+
+      // The preview image replaces the cel image
+      if (m_previewLayer == layer && m_previewFrame == frame && m_previewImage)
+        break;
+
+      // Only zoomed in images cover whole pixels of the destination,
+      // and indexed images could use transparent palette entries.
+      const Image* celImage = cel->image();
+      if (zoom.den() != 1 ||
+          (celImage->pixelFormat() != IMAGE_RGB &&
+           celImage->pixelFormat() != IMAGE_GRAYSCALE))
+        break;
+
+      gfx::Rect celBounds(
+        zoom.apply(cel->x()), zoom.apply(cel->y()),
+        zoom.apply(celImage->width()), zoom.apply(celImage->height()));
+      if (celBounds.contains(zoomedRect) && celImage->isOpaque())
+        opaqueLayer = layer;
+      break;
+    }
+
+    case ObjectType::LayerFolder: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        opaqueLayer = findOpaqueLayer(*it, zoomedRect, frame, zoom, opaqueLayer);
+      break;
+    }
+
+  }
+  return opaqueLayer;
+}
+
+static inline uint64_t hash_value(uint64_t hash, uint64_t value)
+{
+  return hash ^ (value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2));
+}
+
+// Integer division rounding to negative infinity.
+static inline int floor_div(int a, int b)
+{
+  return (a >= 0 ? a / b: -((b - 1 - a) / b));
+}
+
+// Same as renderFrame() but using tiles from the RenderTileCache.
+// Tiles that are not in the cache (or are out of date) are rendered
+// and added to it.
+void RenderEngine::renderCachedFrame(Image* image, const gfx::Rect& zoomedRect,
+  FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+  bool checked_bg, uint32_t bg_color)
+{
+  const int tileSize = RenderTileCache::kTileSize;
+  const Palette* pal = m_sprite->getPalette(frame);
+
+  // Signature of everything that affects all tiles of this frame.
+  uint64_t frameHash = 0;
+  frameHash = hash_value(frameHash, m_sprite->pixelFormat());
+  frameHash = hash_value(frameHash, m_sprite->transparentColor());
+  frameHash = hash_value(frameHash, pal->id());
+  frameHash = hash_value(frameHash, pal->getModifications());
+  frameHash = hash_value(frameHash, checked_bg);
+  frameHash = hash_value(frameHash, bg_color);
+  if (checked_bg) {
+    frameHash = hash_value(frameHash, m_checkedBgType);
+    frameHash = hash_value(frameHash, m_checkedBgZoom);
+    frameHash = hash_value(frameHash, m_checkedBgColor1);
+    frameHash = hash_value(frameHash, m_checkedBgColor2);
+  }
+
+  // Tiles below the extra cel are rendered but not cached.
+  gfx::Rect extraBounds;
+  const Cel* extraCel = m_document->getExtraCel();
+  const Image* extraImage = m_document->getExtraCelImage();
+  if (extraCel && extraImage && extraCel->opacity() > 0 && frame == m_currentFrame) {
+    extraBounds = zoom.apply(gfx::Rect(extraCel->x(), extraCel->y(),
+        extraImage->width(), extraImage->height()));
+    extraBounds.enlarge(1);
+  }
+
+  int col1 = floor_div(zoomedRect.x, tileSize);
+  int row1 = floor_div(zoomedRect.y, tileSize);
+  int col2 = floor_div(zoomedRect.x2()-1, tileSize);
+  int row2 = floor_div(zoomedRect.y2()-1, tileSize);
+
+  // Tiles that must be rendered: first we copy the cached ones, then
+  // the rest are rendered in parallel, and finally they are added to
+  // the cache (which can be used from one thread only).
+  struct MissingTile {
+    int col, row;
+    gfx::Rect bounds;           // Rendered area
+    uint64_t signature;
+    bool cache;
+    Image* image;
+  };
+  std::vector<MissingTile> missing;
+
+  for (int row=row1; row<=row2; ++row) {
+    for (int col=col1; col<=col2; ++col) {
+      gfx::Rect tileBounds(col*tileSize, row*tileSize, tileSize, tileSize);
+      MissingTile tile = { col, row, tileBounds, 0, true, NULL };
+
+      if (tileBounds.intersects(extraBounds)) {
+        tile.bounds = tileBounds.createIntersect(zoomedRect);
+        tile.cache = false;
+        missing.push_back(tile);
+        continue;
+      }
+
+      tile.signature =
+        tileSignature(m_sprite->folder(), tileBounds, frame, zoom, frameHash);
+
+      const Image* cached = m_tileCache->getTile(frame, zoom, col, row, tile.signature);
+      if (!cached) {
+        missing.push_back(tile);
+        continue;
+      }
+
+      gfx::Rect area = tileBounds.createIntersect(zoomedRect);
+      image->copy(cached, area.x-zoomedRect.x, area.y-zoomedRect.y,
+        area.x-tileBounds.x, area.y-tileBounds.y, area.w, area.h);
+    }
+  }
+
+  try {
+    base::parallel_for(0, int(missing.size()),
+      [&](int i) {
+        MissingTile& tile = missing[i];
+        tile.image = Image::create(IMAGE_RGB, tile.bounds.w, tile.bounds.h);
+        renderFrame(tile.image, tile.bounds, frame, zoom, zoomed_func,
+          checked_bg, bg_color);
+      });
+  }
+  catch (...) {
+    for (size_t i=0; i<missing.size(); ++i)
+      delete missing[i].image;
+    throw;
+  }
+
+  for (size_t i=0; i<missing.size(); ++i) {
+    MissingTile& tile = missing[i];
+    gfx::Rect area = tile.bounds.createIntersect(zoomedRect);
+
+    image->copy(tile.image, area.x-zoomedRect.x, area.y-zoomedRect.y,
+      area.x-tile.bounds.x, area.y-tile.bounds.y, area.w, area.h);
+
+    if (tile.cache)
+      m_tileCache->addTile(frame, zoom, tile.col, tile.row, tile.signature, tile.image);
+    else
+      delete tile.image;
+  }
+}
+
+// Sets the composited image of each onion-skin frame. They are taken
+// from the RenderFrameCache, and frames that are not there (or are
+// out of date) are rendered in parallel and added to it.
+void RenderEngine::prepareOnionskinFrames(std::vector<OnionskinFrame>& onionskin,
+  ZoomedFunc zoomed_func)
+{
+  // Frames of huge sprites are not cached
+  if (!m_frameCache ||
+      size_t(m_sprite->width()) * m_sprite->height() * 4 > RenderFrameCache::kMaxBytes / 4)
+    return;
+
+  gfx::Rect spriteBounds(0, 0, m_sprite->width(), m_sprite->height());
+  std::vector<uint64_t> signatures(onionskin.size(), 0);
+  std::vector<int> missing;
+
+  for (size_t i=0; i<onionskin.size(); ++i) {
+    OnionskinFrame& onion = onionskin[i];
+
+    // The preview image changes all the time
+    if (m_previewImage && m_previewFrame == onion.frame)
+      continue;
+
+    // Layers are merged with their own blend mode, or with the normal
+    // one if the onion-skin uses a specific mode for the whole frame.
+    const Palette* pal = m_sprite->getPalette(onion.frame);
+    uint64_t hash = 0;
+    hash = hash_value(hash, m_sprite->pixelFormat());
+    hash = hash_value(hash, m_sprite->transparentColor());
+    hash = hash_value(hash, pal->id());
+    hash = hash_value(hash, pal->getModifications());
+    hash = hash_value(hash, onion.blend_mode < 0);
+
+    signatures[i] = tileSignature(m_sprite->folder(), spriteBounds,
+      onion.frame, Zoom(1, 1), hash);
+
+    onion.image = m_frameCache->getFrame(onion.frame, signatures[i]);
+    if (!onion.image)
+      missing.push_back(int(i));
+  }
+
+  std::vector<Image*> images(missing.size(), (Image*)NULL);
+  try {
+    base::parallel_for(0, int(missing.size()),
+      [&](int i) {
+        const OnionskinFrame& onion = onionskin[missing[i]];
+        images[i] = Image::create(IMAGE_RGB, m_sprite->width(), m_sprite->height());
+        clear_image(images[i], 0);
+
+        LayersPass pass(255, (onion.blend_mode < 0 ? -1: BLEND_MODE_NORMAL));
+        renderLayer(m_sprite->folder(), images[i], 0, 0,
+          onion.frame, Zoom(1, 1), zoomed_func, true, true, pass);
+      });
+  }
+  catch (...) {
+    for (size_t i=0; i<images.size(); ++i)
+      delete images[i];
+    throw;
+  }
+
+  for (size_t i=0; i<missing.size(); ++i) {
+    OnionskinFrame& onion = onionskin[missing[i]];
+    m_frameCache->addFrame(onion.frame, signatures[missing[i]], images[i]);
+    onion.image = images[i];
+  }
+}
+
+// Returns the given hash combined with the state of all visible cels
+// that intersect the tile bounds (in stack order).
+uint64_t RenderEngine::tileSignature(const Layer* layer, const gfx::Rect& tileBounds,
+  FrameNumber frame, Zoom zoom, uint64_t hash) const
+{
+  if (!layer->isVisible())
+    return hash;
+
+  switch (layer->type()) {
+
+    case ObjectType::LayerImage: {
+      const Cel* cel = static_cast<const LayerImage*>(layer)->getCel(frame);
+      const Image* src_image = (cel ? cel->image(): NULL);
+      if (!src_image)
+        break;
+
+      gfx::Rect celBounds = zoom.apply(gfx::Rect(cel->x(), cel->y(),
+          src_image->width(), src_image->height()));
+      celBounds.enlarge(1);
+      if (!celBounds.intersects(tileBounds))
+        break;
+
+      hash = hash_value(hash, layer->id());
+      hash = hash_value(hash, static_cast<const LayerImage*>(layer)->getBlendMode());
+      hash = hash_value(hash, cel->id());
+      hash = hash_value(hash, cel->x());
+      hash = hash_value(hash, cel->y());
+      hash = hash_value(hash, cel->opacity());
+      hash = hash_value(hash, src_image->id());
+      hash = hash_value(hash, src_image->version());
+      break;
+    }
+
+    case ObjectType::LayerFolder: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        hash = tileSignature(*it, tileBounds, frame, zoom, hash);
+      break;
+    }
+
+  }
+
+  return hash;
+}
+
+static void draw_checked_background(Image* image,
+  int source_x, int source_y, Zoom zoom,
+  RenderEngine::CheckedBgType type, bool bgZoom, color_t c1, color_t c2)
 {
-  int x, y, u, v;
   int tile_w = 16;
   int tile_h = 16;
-  int c1 = color_utils::color_for_image(checked_bg_color1, image->pixelFormat());
-  int c2 = color_utils::color_for_image(checked_bg_color2, image->pixelFormat());
 
-  switch (checked_bg_type) {
+  switch (type) {
 
-    case CHECKED_BG_16X16:
+    case RenderEngine::CHECKED_BG_16X16:
       tile_w = 16;
       tile_h = 16;
       break;
 
-    case CHECKED_BG_8X8:
+    case RenderEngine::CHECKED_BG_8X8:
       tile_w = 8;
       tile_h = 8;
       break;
 
-    case CHECKED_BG_4X4:
+    case RenderEngine::CHECKED_BG_4X4:
       tile_w = 4;
       tile_h = 4;
       break;
 
-    case CHECKED_BG_2X2:
+    case RenderEngine::CHECKED_BG_2X2:
       tile_w = 2;
       tile_h = 2;
       break;
 
   }
 
-  if (checked_bg_zoom) {
+  if (bgZoom) {
     tile_w = zoom.apply(tile_w);
     tile_h = zoom.apply(tile_h);
   }
@@ -609,54 +1129,85 @@ void RenderEngine::renderCheckedBackground(Image* image,
   if (tile_w < 1) tile_w = 1;
   if (tile_h < 1) tile_h = 1;
 
-  // Tile position (u,v) is the number of tile we start in (source_x,source_y) coordinate
-  u = (source_x / tile_w);
-  v = (source_y / tile_h);
-
-  // Position where we start drawing the first tile in "image"
-  int x_start = -(source_x % tile_w);
-  int y_start = -(source_y % tile_h);
-
-  // Draw checked background (tile by tile)
-  int u_start = u;
-  for (y=y_start-tile_h; y<image->height()+tile_h; y+=tile_h) {
-    for (x=x_start-tile_w; x<image->width()+tile_w; x+=tile_w) {
-      fill_rect(image, x, y, x+tile_w-1, y+tile_h-1,
-                (((u+v))&1)? c1: c2);
-      ++u;
-    }
-    u = u_start;
-    ++v;
+  // The pattern repeats each two tiles, so we create two rows (one
+  // for even tile rows and other for odd ones) long enough to copy a
+  // whole row of the image from any horizontal offset of the pattern.
+  int period = 2*tile_w;
+  base::UniquePtr<Image> pattern(Image::create(image->pixelFormat(),
+      image->width() + period, 2));
+
+  for (int x=0; x<pattern->width(); x+=tile_w) {
+    bool odd = ((x / tile_w) & 1 ? true: false);
+    fill_rect(pattern, x, 0, x+tile_w-1, 0, odd ? c1: c2);
+    fill_rect(pattern, x, 1, x+tile_w-1, 1, odd ? c2: c1);
+  }
+
+  // Tiles are aligned to the (0,0) of the source coordinates
+  int pattern_x = source_x - floor_div(source_x, period)*period;
+
+  for (int y=0; y<image->height(); ++y) {
+    int pattern_y = (floor_div(source_y+y, tile_h) & 1);
+    image->copy(pattern, 0, y, pattern_x, pattern_y, image->width(), 1);
   }
 }
 
 // static
-void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette* pal,
-  int x, int y, Zoom zoom)
+void RenderEngine::renderCheckedBackground(Image* image,
+  int source_x, int source_y, Zoom zoom)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, Zoom);
-
-  ASSERT(rgb_image->pixelFormat() == IMAGE_RGB && "renderImage accepts RGB destination images only");
+  draw_checked_background(image, source_x, source_y, zoom,
+    checked_bg_type, checked_bg_zoom,
+    color_utils::color_for_image(checked_bg_color1, image->pixelFormat()),
+    color_utils::color_for_image(checked_bg_color2, image->pixelFormat()));
+}
 
-  switch (src_image->pixelFormat()) {
+// Returns the image to draw instead of "image" with the given zoom,
+// i.e. a reduced version of it for zoom levels like 1:2, 1:4, 1:6,
+// etc. In that case the zoom is changed to draw it with the same
+// size of the original image.
+const Image* RenderEngine::getZoomedSource(const Image* image, Zoom& zoom) const
+{
+  if (!m_mipmapCache || zoom.num() != 1 ||
+      (image->pixelFormat() != IMAGE_RGB &&
+       image->pixelFormat() != IMAGE_GRAYSCALE))
+    return image;
+
+  int level = 0;
+  while (level < RenderMipmapCache::kMaxLevel && (zoom.den() % (2 << level)) == 0)
+    ++level;
+  if (level == 0)
+    return image;
+
+  const Image* mipmap = m_mipmapCache->getMipmap(image, level);
+  if (!mipmap)
+    return image;
+
+  zoom = Zoom(1, zoom.den() >> level);
+  return mipmap;
+}
 
-    case IMAGE_RGB:
-      zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
-      break;
+// Same as renderCheckedBackground() with the settings that were
+// active when the engine was created (the image must be RGB).
+void RenderEngine::renderCheckedBg(Image* image,
+  int source_x, int source_y, Zoom zoom) const
+{
+  ASSERT(image->pixelFormat() == IMAGE_RGB);
 
-    case IMAGE_GRAYSCALE:
-      zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
-      break;
+  draw_checked_background(image, source_x, source_y, zoom,
+    m_checkedBgType, m_checkedBgZoom, m_checkedBgColor1, m_checkedBgColor2);
+}
 
-    case IMAGE_INDEXED:
-      zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
-      break;
+// static
+void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette* pal,
+  int x, int y, Zoom zoom)
+{
+  ASSERT(rgb_image->pixelFormat() == IMAGE_RGB && "renderImage accepts RGB destination images only");
 
-    default:
-      return;
-  }
+  ZoomedFunc zoomed_func = get_zoomed_func(src_image->pixelFormat());
+  if (!zoomed_func)
+    return;
 
-  (*zoomed_func)(rgb_image, src_image, pal, x, y, 255, BLEND_MODE_NORMAL, zoom);
+  (*zoomed_func)(rgb_image, src_image, pal, x, y, 255, BLEND_MODE_NORMAL, zoom, true);
 }
 
 void RenderEngine::renderLayer(
@@ -664,10 +1215,10 @@ void RenderEngine::renderLayer(
   Image *image,
   int source_x, int source_y,
   FrameNumber frame, Zoom zoom,
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, Zoom),
+  ZoomedFunc zoomed_func,
   bool render_background,
   bool render_transparent,
-  int blend_mode)
+  LayersPass& pass) const
 {
   // we can't read from this layer
   if (!layer->isVisible())
@@ -676,30 +1227,52 @@ void RenderEngine::renderLayer(
   switch (layer->type()) {
 
     case ObjectType::LayerImage: {
+      // Skip layers that are not in the range that we are rendering
+      if (pass.range != AllLayers) {
+        LayersRange range =
+          (layer == m_currentLayer ? CurrentLayerOnly:
+           pass.currentLayerFound ? LayersAboveCurrent: LayersBelowCurrent);
+        if (layer == m_currentLayer)
+          pass.currentLayerFound = true;
+        if (range != pass.range)
+          break;
+      }
+
+      // Skip layers hidden by an opaque layer above them
+      if (pass.bottomLayer && !pass.bottomLayerFound) {
+        if (layer != pass.bottomLayer)
+          return;
+        pass.bottomLayerFound = true;
+      }
+
       if ((!render_background  &&  layer->isBackground()) ||
           (!render_transparent && !layer->isBackground()))
         break;
 
       const Cel* cel = static_cast<const LayerImage*>(layer)->getCel(frame);
       if (cel != NULL) {
-        Image* src_image;
-
-        // Is the 'preview_image' set to be used with this layer?
-        if ((selected_layer == layer) &&
-            (selected_frame == frame) &&
-            (preview_image != NULL)) {
-          src_image = preview_image;
+        const Image* src_image;
+        Zoom srcZoom = zoom;
+        bool preview = false;
+
+        // Is the preview image set to be used with this layer?
+        if ((m_previewLayer == layer) &&
+            (m_previewFrame == frame) &&
+            (m_previewImage != NULL)) {
+          src_image = m_previewImage;
+          preview = true;
         }
         // If not, we use the original cel-image from the images' stock
+        // (or a reduced version of it if we are zooming out)
         else {
-          src_image = cel->image();
+          src_image = (cel->image() ? getZoomedSource(cel->image(), srcZoom): NULL);
         }
 
         if (src_image) {
           int t, output_opacity;
 
           output_opacity = MID(0, cel->opacity(), 255);
-          output_opacity = INT_MULT(output_opacity, global_opacity, t);
+          output_opacity = INT_MULT(output_opacity, pass.opacity, t);
 
           ASSERT(src_image->maskColor() == m_sprite->transparentColor());
 
@@ -707,10 +1280,10 @@ void RenderEngine::renderLayer(
             zoom.apply(cel->x()) - source_x,
             zoom.apply(cel->y()) - source_y,
             output_opacity,
-            (blend_mode < 0 ?
+            (pass.blend_mode < 0 ?
               static_cast<const LayerImage*>(layer)->getBlendMode():
-              blend_mode),
-            zoom);
+              pass.blend_mode),
+            srcZoom, !preview);
         }
       }
       break;
@@ -726,7 +1299,7 @@ void RenderEngine::renderLayer(
           frame, zoom, zoomed_func,
           render_background,
           render_transparent,
-          blend_mode);
+          pass);
       }
       break;
     }
@@ -734,7 +1307,8 @@ void RenderEngine::renderLayer(
   }
 
   // Draw extras
-  if (m_document->getExtraCel() &&
+  if ((pass.range == AllLayers || pass.range == CurrentLayerOnly) &&
+      m_document->getExtraCel() &&
       layer == m_currentLayer &&
       frame == m_currentFrame) {
     Cel* extraCel = m_document->getExtraCel();
@@ -745,7 +1319,7 @@ void RenderEngine::renderLayer(
         zoom.apply(extraCel->x()) - source_x,
         zoom.apply(extraCel->y()) - source_y,
         extraCel->opacity(),
-        m_document->getExtraCelBlendMode(), zoom);
+        m_document->getExtraCelBlendMode(), zoom, false);
     }
   }
 }
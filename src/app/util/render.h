@@ -22,10 +22,14 @@
 
 #include "app/color.h"
 #include "app/zoom.h"
+#include "base/disable_copying.h"
+#include "base/unique_ptr.h"
 #include "doc/frame_number.h"
 #include "doc/image_buffer.h"
 #include "gfx/rect.h"
 
+#include <vector>
+
 namespace doc {
   class Image;
   class Layer;
@@ -35,9 +39,42 @@ namespace doc {
 
 namespace app {
   class Document;
+  class RenderFrameCache;
+  class RenderMipmapCache;
+  class RenderTileCache;
 
   using namespace doc;
 
+  // Layers below and above the current layer flattened in two RGB
+  // images (in sprite coordinates). While the user is drawing only
+  // the current layer changes, so the editor can merge these two
+  // images instead of all the other layers.
+  class FlattenedLayers {
+  public:
+    FlattenedLayers(const Sprite* sprite, const Layer* currentLayer,
+                    FrameNumber frame, Image* below, Image* above)
+      : m_sprite(sprite), m_currentLayer(currentLayer), m_frame(frame)
+      , m_below(below), m_above(above) {
+    }
+
+    const Sprite* sprite() const { return m_sprite; }
+    const Layer* currentLayer() const { return m_currentLayer; }
+    FrameNumber frame() const { return m_frame; }
+
+    // These images are NULL if there are no visible pixels.
+    const Image* below() const { return m_below; }
+    const Image* above() const { return m_above; }
+
+  private:
+    const Sprite* m_sprite;
+    const Layer* m_currentLayer;
+    FrameNumber m_frame;
+    base::UniquePtr<Image> m_below;
+    base::UniquePtr<Image> m_above;
+
+    DISABLE_COPYING(FlattenedLayers);
+  };
+
   class RenderEngine {
   public:
     RenderEngine(const Document* document,
@@ -63,14 +100,34 @@ namespace app {
     static app::Color getCheckedBgColor2();
     static void setCheckedBgColor2(const app::Color& color);
 
-    //////////////////////////////////////////////////////////////////////
-    // Preview image
+    // Composited tiles of the document that renderSprite() can reuse
+    // (NULL by default, to render everything from scratch).
+    void setTileCache(RenderTileCache* cache) { m_tileCache = cache; }
 
-    static void setPreviewImage(const Layer* layer, FrameNumber frame, Image* drawable);
+    // Reduced images that renderSprite() can use to draw images with
+    // zoom levels like 1:2, 1:4, 1:8, etc. (NULL by default, to
+    // sample the original images).
+    void setMipmapCache(RenderMipmapCache* cache) { m_mipmapCache = cache; }
+
+    // Composited frames that renderSprite() can reuse to draw the
+    // onion-skin (NULL by default, to merge all layers of each
+    // onion-skin frame).
+    void setFrameCache(RenderFrameCache* cache) { m_frameCache = cache; }
+
+    // Flattens the layers below and above the current layer in the
+    // given frame. Returns NULL if they cannot be flattened (e.g. if
+    // some layer uses a blend mode different from the normal one).
+    FlattenedLayers* flattenLayers(FrameNumber frame);
+
+    // Layers that renderSprite() can use instead of the layers below
+    // and above the current one (if they match the current layer and
+    // the rendered frame).
+    void setFlattenedLayers(const FlattenedLayers* layers) { m_flattenedLayers = layers; }
 
     //////////////////////////////////////////////////////////////////////
     // Main function used by sprite-editors to render the sprite.
     // Draws the given sprite frame in a new image and return it.
+    // Big areas are split in horizontal bands rendered in parallel.
     // Note: zoomedRect must have the zoom applied (zoomedRect = zoom.apply(spriteRect)).
     Image* renderSprite(const gfx::Rect& zoomedRect,
       FrameNumber frame, Zoom zoom,
@@ -89,20 +146,104 @@ namespace app {
                             int x, int y, Zoom zoom);
 
   private:
+    enum LayersRange {
+      AllLayers,
+      LayersBelowCurrent,
+      CurrentLayerOnly,
+      LayersAboveCurrent,
+    };
+
+    typedef void (*ZoomedFunc)(Image*, const Image*, const Palette*, int, int, int, int, Zoom, bool);
+
+    // A previous/next frame drawn by the onion-skin.
+    struct OnionskinFrame {
+      FrameNumber frame;
+      int opacity;
+      int blend_mode;
+      const Image* image;       // Composited frame (from the RenderFrameCache)
+
+      OnionskinFrame(FrameNumber frame, int opacity, int blend_mode)
+        : frame(frame), opacity(opacity), blend_mode(blend_mode), image(NULL) { }
+    };
+
+    // State of one traversal of the layers with renderLayer(). Each
+    // band of renderSprite() uses its own one, so they can be
+    // rendered at the same time from different threads.
+    struct LayersPass {
+      int opacity;              // Opacity applied to all cels
+      int blend_mode;           // Blend mode of all cels (-1 to use the layer's one)
+      LayersRange range;        // Layers to be rendered
+      bool currentLayerFound;
+      const Layer* bottomLayer; // Layers below this one are hidden (can be NULL)
+      bool bottomLayerFound;
+
+      LayersPass(int opacity, int blend_mode, LayersRange range = AllLayers)
+        : opacity(opacity), blend_mode(blend_mode)
+        , range(range), currentLayerFound(false)
+        , bottomLayer(NULL), bottomLayerFound(false) { }
+    };
+
+    void renderBand(Image* image, const gfx::Rect& zoomedRect,
+      FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+      bool checked_bg, uint32_t bg_color, bool flattened,
+      const std::vector<OnionskinFrame>& onionskin);
+
+    void renderFrame(Image* image, const gfx::Rect& zoomedRect,
+      FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+      bool checked_bg, uint32_t bg_color);
+
+    void renderCachedFrame(Image* image, const gfx::Rect& zoomedRect,
+      FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+      bool checked_bg, uint32_t bg_color);
+
+    void renderFlattenedFrame(Image* image, const gfx::Rect& zoomedRect,
+      FrameNumber frame, Zoom zoom, ZoomedFunc zoomed_func,
+      bool checked_bg, uint32_t bg_color);
+
+    void renderCheckedBg(Image* image, int source_x, int source_y, Zoom zoom) const;
+
+    void prepareOnionskinFrames(std::vector<OnionskinFrame>& onionskin,
+      ZoomedFunc zoomed_func);
+
+    const Image* getZoomedSource(const Image* image, Zoom& zoom) const;
+
+    bool canFlattenLayers(const Layer* layer, FrameNumber frame) const;
+
+    const Layer* findOpaqueLayer(const Layer* layer, const gfx::Rect& zoomedRect,
+      FrameNumber frame, Zoom zoom, const Layer* opaqueLayer) const;
+
+    uint64_t tileSignature(const Layer* layer, const gfx::Rect& tileBounds,
+      FrameNumber frame, Zoom zoom, uint64_t hash) const;
+
     void renderLayer(
       const Layer* layer,
       Image* image,
       int source_x, int source_y,
       FrameNumber frame, Zoom zoom,
-      void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, Zoom),
+      ZoomedFunc zoomed_func,
       bool render_background,
       bool render_transparent,
-      int blend_mode);
+      LayersPass& pass) const;
 
     const Document* m_document;
     const Sprite* m_sprite;
     const Layer* m_currentLayer;
     FrameNumber m_currentFrame;
+    RenderTileCache* m_tileCache;
+    RenderMipmapCache* m_mipmapCache;
+    RenderFrameCache* m_frameCache;
+    const FlattenedLayers* m_flattenedLayers;
+
+    // Checked background settings (RGB colors)
+    CheckedBgType m_checkedBgType;
+    bool m_checkedBgZoom;
+    uint32_t m_checkedBgColor1;
+    uint32_t m_checkedBgColor2;
+
+    // Preview image of the document
+    const Layer* m_previewLayer;
+    FrameNumber m_previewFrame;
+    const Image* m_previewImage;
   };
 
 } // namespace app
@@ -0,0 +1,94 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/render_frame_cache.h"
+
+#include "doc/image.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace app {
+
+static size_t image_bytes(const Image* image)
+{
+  return size_t(image->getRowStrideSize()) * image->height();
+}
+
+RenderFrameCache::RenderFrameCache()
+  : m_bytes(0)
+  , m_tick(0)
+{
+}
+
+RenderFrameCache::~RenderFrameCache()
+{
+}
+
+const Image* RenderFrameCache::getFrame(FrameNumber frame, uint64_t signature)
+{
+  Frames::iterator it = m_frames.find(frame);
+  if (it == m_frames.end() || it->second.signature != signature)
+    return NULL;
+
+  it->second.lastUse = ++m_tick;
+  return it->second.image.get();
+}
+
+void RenderFrameCache::addFrame(FrameNumber frame, uint64_t signature, Image* image)
+{
+  Frame& entry = m_frames[frame];
+  if (entry.image)
+    m_bytes -= image_bytes(entry.image);
+
+  entry.image.reset(image);
+  entry.signature = signature;
+  entry.lastUse = ++m_tick;
+  m_bytes += image_bytes(image);
+}
+
+void RenderFrameCache::removeOldFrames()
+{
+  if (m_bytes <= kMaxBytes)
+    return;
+
+  std::vector<std::pair<uint64_t, FrameNumber> > uses;
+  uses.reserve(m_frames.size());
+  for (const auto& item : m_frames)
+    uses.push_back(std::make_pair(item.second.lastUse, item.first));
+  std::sort(uses.begin(), uses.end());
+
+  for (size_t i=0; i<uses.size() && m_bytes > kMaxBytes; ++i) {
+    Frames::iterator it = m_frames.find(uses[i].second);
+    m_bytes -= image_bytes(it->second.image);
+    m_frames.erase(it);
+  }
+}
+
+void RenderFrameCache::invalidate()
+{
+  m_frames.clear();
+  m_bytes = 0;
+}
+
+} // namespace app
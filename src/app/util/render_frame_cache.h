@@ -0,0 +1,89 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UTIL_RENDER_FRAME_CACHE_H_INCLUDED
+#define APP_UTIL_RENDER_FRAME_CACHE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/shared_ptr.h"
+#include "doc/frame_number.h"
+
+#include <map>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+
+  using namespace doc;
+
+  // Cache of whole frames composited in transparent RGB images (in
+  // sprite coordinates, 100% zoom). RenderEngine uses it to draw the
+  // onion-skin frames without merging all their layers again in each
+  // repaint.
+  //
+  // Each frame is stored with a signature of everything that was used
+  // to render it (like tiles in RenderTileCache), so frames are
+  // replaced as soon as one of their cels changes.
+  class RenderFrameCache {
+  public:
+    enum {
+      kMaxBytes = 128*1024*1024,
+    };
+
+    RenderFrameCache();
+    ~RenderFrameCache();
+
+    // Returns the given frame if it was rendered with the same
+    // signature, or NULL if it's not available. The image is valid
+    // until the next call to removeOldFrames().
+    const Image* getFrame(FrameNumber frame, uint64_t signature);
+
+    // Adds a new frame to the cache (the cache takes the ownership of
+    // the image).
+    void addFrame(FrameNumber frame, uint64_t signature, Image* image);
+
+    // Removes the least recently used frames if they use more than
+    // kMaxBytes.
+    void removeOldFrames();
+
+    void invalidate();
+
+    size_t size() const { return m_frames.size(); }
+
+  private:
+    struct Frame {
+      SharedPtr<Image> image;
+      uint64_t signature;
+      uint64_t lastUse;
+    };
+
+    typedef std::map<FrameNumber, Frame> Frames;
+
+    Frames m_frames;
+    size_t m_bytes;
+    uint64_t m_tick;
+
+    DISABLE_COPYING(RenderFrameCache);
+  };
+
+} // namespace app
+
+#endif
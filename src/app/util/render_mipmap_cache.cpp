@@ -0,0 +1,132 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/render_mipmap_cache.h"
+
+#include "base/scoped_lock.h"
+#include "doc/algorithm/half_size_image.h"
+#include "doc/image.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace app {
+
+RenderMipmapCache::RenderMipmapCache()
+  : m_bytes(0)
+  , m_tick(0)
+{
+}
+
+RenderMipmapCache::~RenderMipmapCache()
+{
+}
+
+const Image* RenderMipmapCache::getMipmap(const Image* image, int level)
+{
+  ASSERT(level >= 1 && level <= kMaxLevel);
+
+  // Find the biggest level that we already have (level 0 is the
+  // image itself).
+  const Image* from = image;
+  int fromLevel = 0;
+  {
+    base::scoped_lock lock(m_mutex);
+    Entries::iterator it = m_entries.find(image->id());
+    if (it != m_entries.end() && it->second.version == image->version()) {
+      Entry& entry = it->second;
+      entry.lastUse = ++m_tick;
+      if (entry.levels[level-1])
+        return entry.levels[level-1].get();
+
+      for (fromLevel=level-1; fromLevel > 0 && !entry.levels[fromLevel-1]; --fromLevel)
+        ;
+      if (fromLevel > 0)
+        from = entry.levels[fromLevel-1].get();
+    }
+  }
+
+  // Create the missing levels without the lock (two threads could
+  // create the same levels, in that case the first ones are kept).
+  Image* levels[kMaxLevel] = { NULL };
+  for (int i=fromLevel; i<level; ++i) {
+    levels[i] = algorithm::create_half_size_image(i == fromLevel ? from: levels[i-1]);
+    if (!levels[i]) {
+      for (int j=fromLevel; j<i; ++j)
+        delete levels[j];
+      return NULL;
+    }
+  }
+
+  base::scoped_lock lock(m_mutex);
+  Entry& entry = m_entries[image->id()];
+  if (entry.version != image->version()) {
+    for (int i=0; i<kMaxLevel; ++i)
+      entry.levels[i].reset();
+    m_bytes -= entry.bytes;
+    entry.bytes = 0;
+    entry.version = image->version();
+  }
+
+  for (int i=fromLevel; i<level; ++i) {
+    if (entry.levels[i]) {
+      delete levels[i];
+      continue;
+    }
+
+    size_t size = size_t(levels[i]->getRowStrideSize()) * levels[i]->height();
+    entry.levels[i].reset(levels[i]);
+    entry.bytes += size;
+    m_bytes += size;
+  }
+
+  entry.lastUse = ++m_tick;
+  return entry.levels[level-1].get();
+}
+
+void RenderMipmapCache::removeOldMipmaps()
+{
+  base::scoped_lock lock(m_mutex);
+  if (m_bytes <= kMaxBytes)
+    return;
+
+  std::vector<std::pair<uint64_t, ObjectId> > uses;
+  uses.reserve(m_entries.size());
+  for (const auto& item : m_entries)
+    uses.push_back(std::make_pair(item.second.lastUse, item.first));
+  std::sort(uses.begin(), uses.end());
+
+  for (size_t i=0; i<uses.size() && m_bytes > kMaxBytes; ++i) {
+    Entries::iterator it = m_entries.find(uses[i].second);
+    m_bytes -= it->second.bytes;
+    m_entries.erase(it);
+  }
+}
+
+size_t RenderMipmapCache::bytes() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_bytes;
+}
+
+} // namespace app
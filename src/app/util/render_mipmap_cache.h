@@ -0,0 +1,89 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UTIL_RENDER_MIPMAP_CACHE_H_INCLUDED
+#define APP_UTIL_RENDER_MIPMAP_CACHE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/shared_ptr.h"
+#include "doc/object_id.h"
+
+#include <map>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+
+  using namespace doc;
+
+  // Reduced versions (mip levels) of the images that RenderEngine
+  // draws with zoom levels below 100%. Level 1 has half the size of
+  // the image, level 2 a quarter, etc. Levels are created when they
+  // are needed and discarded when the image version changes.
+  //
+  // getMipmap() can be called from several threads at the same time
+  // (e.g. from the bands of RenderEngine::renderSprite()).
+  class RenderMipmapCache {
+  public:
+    enum {
+      kMaxLevel = 3,                    // 1:8
+      kMaxBytes = 64*1024*1024,
+    };
+
+    RenderMipmapCache();
+    ~RenderMipmapCache();
+
+    // Returns the given level (1 to kMaxLevel) of the image, or NULL
+    // if the image cannot be reduced. The returned image is valid
+    // until the next call to removeOldMipmaps().
+    const Image* getMipmap(const Image* image, int level);
+
+    // Removes the least recently used mipmaps if they use more than
+    // kMaxBytes. It must not be called while other threads are using
+    // mipmaps.
+    void removeOldMipmaps();
+
+    size_t bytes() const;
+
+  private:
+    struct Entry {
+      uint32_t version;
+      SharedPtr<Image> levels[kMaxLevel];
+      size_t bytes;
+      uint64_t lastUse;
+
+      Entry() : version(0), bytes(0), lastUse(0) { }
+    };
+
+    typedef std::map<ObjectId, Entry> Entries;
+
+    mutable base::mutex m_mutex;
+    Entries m_entries;
+    size_t m_bytes;
+    uint64_t m_tick;
+
+    DISABLE_COPYING(RenderMipmapCache);
+  };
+
+} // namespace app
+
+#endif
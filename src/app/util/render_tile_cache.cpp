@@ -0,0 +1,241 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/render_tile_cache.h"
+
+#include "app/document.h"
+#include "doc/cel.h"
+#include "doc/document_event.h"
+#include "doc/image.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace app {
+
+// Cel events don't include the frame, it's taken from the cel.
+static FrameNumber cel_frame(const DocumentEvent& ev)
+{
+  return (ev.cel() ? ev.cel()->frame(): ev.frame());
+}
+
+RenderTileCache::Key::Key(FrameNumber frame, Zoom zoom, int col, int row)
+  : frame(frame)
+  , zoomNum(zoom.num())
+  , zoomDen(zoom.den())
+  , col(col)
+  , row(row)
+{
+}
+
+bool RenderTileCache::Key::operator<(const Key& other) const
+{
+  if (frame != other.frame) return frame < other.frame;
+  if (zoomNum != other.zoomNum) return zoomNum < other.zoomNum;
+  if (zoomDen != other.zoomDen) return zoomDen < other.zoomDen;
+  if (row != other.row) return row < other.row;
+  return col < other.col;
+}
+
+RenderTileCache::RenderTileCache(Document* document)
+  : m_document(document)
+  , m_tick(0)
+{
+  m_document->addObserver(this);
+}
+
+RenderTileCache::~RenderTileCache()
+{
+  m_document->removeObserver(this);
+}
+
+const Image* RenderTileCache::getTile(FrameNumber frame, Zoom zoom, int col, int row,
+                                      uint64_t signature)
+{
+  Tiles::iterator it = m_tiles.find(Key(frame, zoom, col, row));
+  if (it == m_tiles.end())
+    return NULL;
+
+  if (it->second.signature != signature) {
+    m_tiles.erase(it);
+    return NULL;
+  }
+
+  it->second.lastUse = ++m_tick;
+  return it->second.image.get();
+}
+
+void RenderTileCache::addTile(FrameNumber frame, Zoom zoom, int col, int row,
+                              uint64_t signature, Image* image)
+{
+  Tile& tile = m_tiles[Key(frame, zoom, col, row)];
+  tile.image.reset(image);
+  tile.signature = signature;
+  tile.lastUse = ++m_tick;
+
+  if (m_tiles.size() > kMaxTiles)
+    removeOldTiles();
+}
+
+void RenderTileCache::invalidate()
+{
+  m_tiles.clear();
+}
+
+void RenderTileCache::invalidateFrame(FrameNumber frame)
+{
+  for (Tiles::iterator it = m_tiles.begin(); it != m_tiles.end(); ) {
+    if (it->first.frame == frame)
+      m_tiles.erase(it++);
+    else
+      ++it;
+  }
+}
+
+void RenderTileCache::invalidateRegion(const gfx::Region& spriteRegion)
+{
+  for (Tiles::iterator it = m_tiles.begin(); it != m_tiles.end(); ) {
+    const Key& key = it->first;
+    Zoom zoom(key.zoomNum, key.zoomDen);
+
+    // Tile bounds in sprite coordinates (with one extra pixel for
+    // rounding errors in zoomed out tiles)
+    gfx::Rect bounds = zoom.remove(
+      gfx::Rect(key.col*kTileSize, key.row*kTileSize, kTileSize, kTileSize));
+    bounds.enlarge(1);
+
+    if (spriteRegion.contains(bounds) != gfx::Region::Out)
+      m_tiles.erase(it++);
+    else
+      ++it;
+  }
+}
+
+// Removes the least recently used quarter of the tiles.
+void RenderTileCache::removeOldTiles()
+{
+  std::vector<uint64_t> uses;
+  uses.reserve(m_tiles.size());
+  for (const auto& item : m_tiles)
+    uses.push_back(item.second.lastUse);
+
+  std::vector<uint64_t>::iterator nth = uses.begin() + uses.size()/4;
+  std::nth_element(uses.begin(), nth, uses.end());
+  uint64_t oldest = *nth;
+
+  for (Tiles::iterator it = m_tiles.begin(); it != m_tiles.end(); ) {
+    if (it->second.lastUse < oldest)
+      m_tiles.erase(it++);
+    else
+      ++it;
+  }
+}
+
+void RenderTileCache::onGeneralUpdate(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onAddLayer(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onAfterRemoveLayer(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onAddFrame(DocumentEvent& ev)
+{
+  // Frame numbers of the following frames change
+  invalidate();
+}
+
+void RenderTileCache::onRemoveFrame(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onAddCel(DocumentEvent& ev)
+{
+  invalidateFrame(cel_frame(ev));
+}
+
+void RenderTileCache::onRemoveCel(DocumentEvent& ev)
+{
+  invalidateFrame(cel_frame(ev));
+}
+
+void RenderTileCache::onSpriteSizeChanged(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onSpriteTransparentColorChanged(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onLayerRestacked(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onLayerMergedDown(DocumentEvent& ev)
+{
+  invalidate();
+}
+
+void RenderTileCache::onCelMoved(DocumentEvent& ev)
+{
+  invalidateFrame(ev.frame());
+  invalidateFrame(ev.targetFrame());
+}
+
+void RenderTileCache::onCelCopied(DocumentEvent& ev)
+{
+  invalidateFrame(ev.targetFrame());
+}
+
+void RenderTileCache::onCelFrameChanged(DocumentEvent& ev)
+{
+  // We don't know the previous frame of the cel
+  invalidate();
+}
+
+void RenderTileCache::onCelPositionChanged(DocumentEvent& ev)
+{
+  invalidateFrame(cel_frame(ev));
+}
+
+void RenderTileCache::onCelOpacityChanged(DocumentEvent& ev)
+{
+  invalidateFrame(cel_frame(ev));
+}
+
+void RenderTileCache::onSpritePixelsModified(DocumentEvent& ev)
+{
+  invalidateRegion(ev.region());
+}
+
+} // namespace app
@@ -0,0 +1,125 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UTIL_RENDER_TILE_CACHE_H_INCLUDED
+#define APP_UTIL_RENDER_TILE_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/zoom.h"
+#include "base/disable_copying.h"
+#include "base/shared_ptr.h"
+#include "doc/document_observer.h"
+#include "doc/frame_number.h"
+#include "gfx/region.h"
+
+#include <map>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+  class Document;
+
+  using namespace doc;
+
+  // Cache of composited RGB tiles of a document used by
+  // RenderEngine::renderSprite(). Tiles are kTileSize x kTileSize
+  // pixels in zoomed coordinates and they are identified by (frame,
+  // zoom, column, row).
+  //
+  // Each tile is stored with a signature of everything that was used
+  // to render it (cels and images below the tile, image versions,
+  // palette, background, etc.), so a tile is never used if it could
+  // be out of date. Document events remove tiles as soon as we know
+  // that they are invalid.
+  class RenderTileCache : public doc::DocumentObserver {
+  public:
+    enum {
+      kTileSize = 128,
+      kMaxTiles = 1024,         // 64 MB
+    };
+
+    RenderTileCache(Document* document);
+    ~RenderTileCache();
+
+    // Returns the tile in the given position if it was rendered with
+    // the same signature, or NULL if it's not available.
+    const Image* getTile(FrameNumber frame, Zoom zoom, int col, int row,
+                         uint64_t signature);
+
+    // Adds a new tile to the cache (the cache takes the ownership of
+    // the image). Old tiles are removed if there are too many.
+    void addTile(FrameNumber frame, Zoom zoom, int col, int row,
+                 uint64_t signature, Image* tile);
+
+    void invalidate();
+    void invalidateFrame(FrameNumber frame);
+    void invalidateRegion(const gfx::Region& spriteRegion);
+
+    size_t size() const { return m_tiles.size(); }
+
+    // DocumentObserver impl
+    void onGeneralUpdate(DocumentEvent& ev) override;
+    void onAddLayer(DocumentEvent& ev) override;
+    void onAfterRemoveLayer(DocumentEvent& ev) override;
+    void onAddFrame(DocumentEvent& ev) override;
+    void onRemoveFrame(DocumentEvent& ev) override;
+    void onAddCel(DocumentEvent& ev) override;
+    void onRemoveCel(DocumentEvent& ev) override;
+    void onSpriteSizeChanged(DocumentEvent& ev) override;
+    void onSpriteTransparentColorChanged(DocumentEvent& ev) override;
+    void onLayerRestacked(DocumentEvent& ev) override;
+    void onLayerMergedDown(DocumentEvent& ev) override;
+    void onCelMoved(DocumentEvent& ev) override;
+    void onCelCopied(DocumentEvent& ev) override;
+    void onCelFrameChanged(DocumentEvent& ev) override;
+    void onCelPositionChanged(DocumentEvent& ev) override;
+    void onCelOpacityChanged(DocumentEvent& ev) override;
+    void onSpritePixelsModified(DocumentEvent& ev) override;
+
+  private:
+    struct Key {
+      FrameNumber frame;
+      int zoomNum, zoomDen;
+      int col, row;
+
+      Key(FrameNumber frame, Zoom zoom, int col, int row);
+      bool operator<(const Key& other) const;
+    };
+
+    struct Tile {
+      SharedPtr<Image> image;
+      uint64_t signature;
+      uint64_t lastUse;
+    };
+
+    typedef std::map<Key, Tile> Tiles;
+
+    void removeOldTiles();
+
+    Document* m_document;
+    Tiles m_tiles;
+    uint64_t m_tick;
+
+    DISABLE_COPYING(RenderTileCache);
+  };
+
+} // namespace app
+
+#endif
@@ -30,6 +30,8 @@ namespace app {
       : m_num(num), m_den(den) {
     }
 
+    int num() const { return m_num; }
+    int den() const { return m_den; }
     double scale() const { return static_cast<double>(m_num) / static_cast<double>(m_den); }
 
     int apply(int x) const { return x * m_num / m_den; }
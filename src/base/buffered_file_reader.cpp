@@ -0,0 +1,157 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/buffered_file_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace base {
+
+BufferedFileReader::BufferedFileReader(FILE* file, size_t bufferSize)
+  : m_file(file)
+  , m_buffer(bufferSize > 0 ? bufferSize: 1)
+  , m_bufferPos(std::ftell(file))
+  , m_pos(0)
+  , m_end(0)
+  , m_fileEnd(false)
+  , m_eof(false)
+  , m_error(false)
+{
+}
+
+int BufferedFileReader::read16()
+{
+  if (m_end - m_pos >= 2) {
+    int b1 = m_buffer[m_pos++];
+    int b2 = m_buffer[m_pos++];
+    return ((b2 << 8) | b1);
+  }
+
+  int b1 = read8();
+  if (b1 == EOF)
+    return EOF;
+
+  int b2 = read8();
+  if (b2 == EOF)
+    return EOF;
+
+  return ((b2 << 8) | b1);
+}
+
+long BufferedFileReader::read32()
+{
+  if (m_end - m_pos >= 4) {
+    const unsigned char* p = &m_buffer[m_pos];
+    m_pos += 4;
+    return ((p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]);
+  }
+
+  int b[4];
+  for (int i=0; i<4; ++i) {
+    b[i] = read8();
+    if (b[i] == EOF)
+      return EOF;
+  }
+
+  return ((b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0]);
+}
+
+size_t BufferedFileReader::read(void* dst, size_t bytes)
+{
+  unsigned char* out = static_cast<unsigned char*>(dst);
+  size_t total = 0;
+
+  while (total < bytes) {
+    if (m_pos == m_end) {
+      // Big blocks are read directly in the destination
+      if (bytes - total >= m_buffer.size()) {
+        m_bufferPos += long(m_end);
+        m_pos = m_end = 0;
+
+        if (m_fileEnd || m_error)
+          break;
+
+        size_t wanted = bytes - total;
+        size_t n = std::fread(out+total, 1, wanted, m_file);
+        m_bufferPos += long(n);
+        total += n;
+        if (n < wanted) {
+          m_fileEnd = (std::feof(m_file) != 0);
+          m_error = (std::ferror(m_file) != 0);
+          break;
+        }
+        continue;
+      }
+
+      if (!fill())
+        break;
+    }
+
+    size_t n = std::min(bytes-total, m_end-m_pos);
+    std::memcpy(out+total, &m_buffer[m_pos], n);
+    m_pos += n;
+    total += n;
+  }
+
+  if (total < bytes)
+    m_eof = true;
+  return total;
+}
+
+void BufferedFileReader::seek(long pos)
+{
+  // Seek inside the buffer
+  if (pos >= m_bufferPos && pos <= m_bufferPos + long(m_end)) {
+    m_pos = size_t(pos - m_bufferPos);
+    m_eof = false;
+    return;
+  }
+
+  if (std::fseek(m_file, pos, SEEK_SET) != 0) {
+    m_error = true;
+    return;
+  }
+
+  m_bufferPos = pos;
+  m_pos = m_end = 0;
+  m_fileEnd = false;
+  m_eof = false;
+}
+
+int BufferedFileReader::readSlow()
+{
+  if (!fill()) {
+    m_eof = true;
+    return EOF;
+  }
+
+  return m_buffer[m_pos++];
+}
+
+// Reads the next block of the file in the buffer. Returns false if
+// there is nothing else to read.
+bool BufferedFileReader::fill()
+{
+  m_bufferPos += long(m_end);
+  m_pos = m_end = 0;
+
+  if (m_fileEnd || m_error)
+    return false;
+
+  m_end = std::fread(&m_buffer[0], 1, m_buffer.size(), m_file);
+  if (m_end < m_buffer.size()) {
+    m_fileEnd = (std::feof(m_file) != 0);
+    m_error = (std::ferror(m_file) != 0);
+  }
+  return (m_end > 0);
+}
+
+} // namespace base
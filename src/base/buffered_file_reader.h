@@ -0,0 +1,72 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_BUFFERED_FILE_READER_H_INCLUDED
+#define BASE_BUFFERED_FILE_READER_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace base {
+
+  // Reads a file through a big memory buffer, so reading small fields
+  // (bytes, words, etc.) doesn't need one call to the C library for
+  // each byte. Reading past the end of the file returns EOF (as
+  // fgetc()) or less bytes than the requested ones.
+  class BufferedFileReader {
+  public:
+    static const size_t kDefaultBufferSize = 1024*1024;
+
+    BufferedFileReader(FILE* file, size_t bufferSize = kDefaultBufferSize);
+
+    // Reads a byte, or returns EOF.
+    int read8() {
+      if (m_pos < m_end)
+        return m_buffer[m_pos++];
+      else
+        return readSlow();
+    }
+
+    // Reads a WORD/DWORD in little-endian byte ordering, or returns
+    // EOF (same as fgetw() and fgetl()).
+    int read16();
+    long read32();
+
+    // Reads "bytes" bytes in "dst", returns the number of read bytes.
+    size_t read(void* dst, size_t bytes);
+
+    void skip(size_t bytes) { seek(tell() + long(bytes)); }
+
+    long tell() const { return m_bufferPos + long(m_pos); }
+    void seek(long pos);
+
+    // Returns true if a read couldn't be completed because the end of
+    // the file was reached.
+    bool eof() const { return m_eof; }
+    bool error() const { return m_error; }
+
+  private:
+    int readSlow();
+    bool fill();
+
+    FILE* m_file;
+    std::vector<unsigned char> m_buffer;
+    long m_bufferPos;           // File position of m_buffer[0]
+    size_t m_pos;               // Next byte to read in m_buffer
+    size_t m_end;               // Number of valid bytes in m_buffer
+    bool m_fileEnd;             // The last byte of the file is in m_buffer
+    bool m_eof;
+    bool m_error;
+
+    DISABLE_COPYING(BufferedFileReader);
+  };
+
+} // namespace base
+
+#endif
@@ -0,0 +1,102 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/buffered_file_reader.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace base;
+
+#ifdef _MSC_VER
+#pragma warning (disable: 4996)
+#endif
+
+static const char* fn = "buffered_file_reader_test.bin";
+
+// Creates a file with 100 bytes with values 0, 1, 2, ..., 99
+static FILE* create_test_file()
+{
+  FILE* f = std::fopen(fn, "wb");
+  for (int i=0; i<100; ++i)
+    std::fputc(i, f);
+  std::fclose(f);
+
+  return std::fopen(fn, "rb");
+}
+
+TEST(BufferedFileReader, LittleEndianValues)
+{
+  FILE* file = create_test_file();
+  ASSERT_TRUE(file != NULL);
+
+  // A small buffer to cross its limits in the middle of the values
+  BufferedFileReader f(file, 7);
+
+  EXPECT_EQ(0, f.read8());
+  EXPECT_EQ(0x0201, f.read16());
+  EXPECT_EQ(0x06050403, f.read32());
+  EXPECT_EQ(0x0807, f.read16());
+  EXPECT_EQ(9, f.tell());
+
+  f.seek(96);
+  EXPECT_EQ(0x63626160, f.read32());
+  EXPECT_FALSE(f.eof());
+  EXPECT_EQ(EOF, f.read8());
+  EXPECT_EQ(EOF, f.read16());
+  EXPECT_TRUE(f.eof());
+  EXPECT_FALSE(f.error());
+
+  f.seek(98);
+  EXPECT_EQ(EOF, f.read32());
+
+  std::fclose(file);
+  std::remove(fn);
+}
+
+TEST(BufferedFileReader, ReadBlocksAndSeek)
+{
+  FILE* file = create_test_file();
+  ASSERT_TRUE(file != NULL);
+
+  BufferedFileReader f(file, 16);
+  std::vector<unsigned char> buf(100);
+
+  // Block from the buffer
+  EXPECT_EQ(10, f.read(&buf[0], 10));
+  EXPECT_EQ(9, buf[9]);
+
+  // Block bigger than the buffer (read directly)
+  EXPECT_EQ(50, f.read(&buf[0], 50));
+  EXPECT_EQ(10, buf[0]);
+  EXPECT_EQ(59, buf[49]);
+  EXPECT_EQ(60, f.tell());
+  EXPECT_EQ(60, f.read8());
+
+  // Seek backward and forward
+  f.seek(5);
+  EXPECT_EQ(5, f.read8());
+  f.skip(10);
+  EXPECT_EQ(16, f.read8());
+
+  // Read past the end
+  f.seek(90);
+  EXPECT_EQ(10, f.read(&buf[0], 20));
+  EXPECT_EQ(99, buf[9]);
+  EXPECT_EQ(100, f.tell());
+  EXPECT_TRUE(f.eof());
+
+  std::fclose(file);
+  std::remove(fn);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
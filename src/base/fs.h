@@ -8,6 +8,7 @@
 #define BASE_FS_H_INCLUDED
 #pragma once
 
+#include <stdint.h>
 #include <string>
 
 namespace base {
@@ -17,6 +18,33 @@ namespace base {
 
   size_t file_size(const std::string& path);
 
+  // Identity of a file and its last modification. Two paths point to
+  // the same file (e.g. through links or different relative paths)
+  // if they have the same device and index, and a file was modified
+  // if its size or modification time changed.
+  struct FileStatus {
+    uint64_t device;            // Device (volume serial number on Windows)
+    uint64_t index;             // Inode (file index on Windows)
+    uint64_t size;
+    uint64_t mtime;             // Modification time (system units)
+
+    bool sameFile(const FileStatus& other) const {
+      return (device == other.device && index == other.index);
+    }
+
+    bool operator==(const FileStatus& other) const {
+      return (sameFile(other) && size == other.size && mtime == other.mtime);
+    }
+
+    bool operator!=(const FileStatus& other) const {
+      return !operator==(other);
+    }
+  };
+
+  // Returns false if the file doesn't exist or its status cannot be
+  // read.
+  bool get_file_status(const std::string& path, FileStatus* status);
+
   void move_file(const std::string& src, const std::string& dst);
   void delete_file(const std::string& path);
 
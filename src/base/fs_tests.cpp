@@ -8,6 +8,8 @@
 
 #include "base/fs.h"
 
+#include <cstdio>
+
 using namespace base;
 
 TEST(FileSystem, MakeDirectory)
@@ -49,6 +51,38 @@ TEST(FileSystem, MakeAllDirectories)
 #endif
 }
 
+TEST(FileSystem, FileStatus)
+{
+  FileStatus a, b;
+  EXPECT_FALSE(get_file_status("a.txt", &a));
+
+  FILE* f = fopen("a.txt", "wb");
+  ASSERT_TRUE(f != NULL);
+  fputs("abc", f);
+  fclose(f);
+
+  make_directory("a");
+  ASSERT_TRUE(get_file_status("a.txt", &a));
+  ASSERT_TRUE(get_file_status("a/../a.txt", &b));
+  EXPECT_EQ(3, a.size);
+  EXPECT_TRUE(a.sameFile(b));
+  EXPECT_TRUE(a == b);
+
+  f = fopen("a.txt", "ab");
+  ASSERT_TRUE(f != NULL);
+  fputs("d", f);
+  fclose(f);
+
+  ASSERT_TRUE(get_file_status("a.txt", &b));
+  EXPECT_EQ(4, b.size);
+  EXPECT_TRUE(a.sameFile(b));
+  EXPECT_TRUE(a != b);
+
+  remove_directory("a");
+  delete_file("a.txt");
+  EXPECT_FALSE(get_file_status("a.txt", &a));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -48,6 +48,23 @@ size_t file_size(const std::string& path)
   return (stat(path.c_str(), &sts) == 0) ? sts.st_size: 0;
 }
 
+bool get_file_status(const std::string& path, FileStatus* status)
+{
+  struct stat sts;
+  if (stat(path.c_str(), &sts) != 0)
+    return false;
+
+  status->device = sts.st_dev;
+  status->index = sts.st_ino;
+  status->size = sts.st_size;
+#if __APPLE__
+  status->mtime = uint64_t(sts.st_mtimespec.tv_sec) * 1000000000 + sts.st_mtimespec.tv_nsec;
+#else
+  status->mtime = uint64_t(sts.st_mtim.tv_sec) * 1000000000 + sts.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
 void move_file(const std::string& src, const std::string& dst)
 {
   int result = rename(src.c_str(), dst.c_str());
@@ -39,6 +39,27 @@ size_t file_size(const std::string& path)
   return (_wstat(from_utf8(path).c_str(), &sts) == 0) ? sts.st_size: 0;
 }
 
+bool get_file_status(const std::string& path, FileStatus* status)
+{
+  HANDLE handle = ::CreateFile(from_utf8(path).c_str(), 0,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+    OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  BY_HANDLE_FILE_INFORMATION info;
+  BOOL result = ::GetFileInformationByHandle(handle, &info);
+  ::CloseHandle(handle);
+  if (result == 0)
+    return false;
+
+  status->device = info.dwVolumeSerialNumber;
+  status->index = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+  status->size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+  status->mtime = (uint64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
+
 void move_file(const std::string& src, const std::string& dst)
 {
   BOOL result = ::MoveFile(from_utf8(src).c_str(), from_utf8(dst).c_str());
@@ -0,0 +1,153 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/parallel_for.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace base {
+namespace details {
+
+namespace {
+
+  // A call to parallel_for() waiting for threads of the pool.
+  struct job {
+    parallel_for_task* task;
+    int helpers;                // Threads of the pool that can still join
+    int running;                // Threads of the pool in task->run()
+  };
+
+  class thread_pool {
+  public:
+    thread_pool() : m_stop(false) {
+      int n = thread::hardware_concurrency()-1;
+      try {
+        for (int i=0; i<n; ++i)
+          m_workers.push_back(new thread(&thread_pool::worker_proxy, this));
+      }
+      catch (...) {
+        // Use only the threads that could be created (the calling
+        // thread of parallel_for() can do all the work alone).
+      }
+    }
+
+    ~thread_pool() {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_wakeup.notify_all();
+
+      for (thread* worker : m_workers) {
+        worker->join();
+        delete worker;
+      }
+    }
+
+    static thread_pool& instance() {
+      static thread_pool pool;
+      return pool;
+    }
+
+    void run(parallel_for_task* task, int helpers) {
+      job j;
+      j.task = task;
+      j.helpers = std::min(helpers, int(m_workers.size()));
+      j.running = 0;
+
+      // Workers can change "j" as soon as it's in the queue
+      const int wanted = j.helpers;
+      bool queued = false;
+      if (wanted > 0) {
+        try {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_jobs.push_back(&j);
+          queued = true;
+        }
+        catch (...) {
+          // Without the pool the calling thread does all the work
+        }
+      }
+      if (queued) {
+        if (wanted == 1)
+          m_wakeup.notify_one();
+        else
+          m_wakeup.notify_all();
+      }
+
+      task->run();
+
+      if (queued) {
+        // No more threads can join the job after this point, and the
+        // ones that joined it must finish before "j" and "task" are
+        // destroyed.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        remove_job(&j);
+        m_finished.wait(lock, [&j]{ return j.running == 0; });
+      }
+    }
+
+  private:
+    static void worker_proxy(thread_pool* pool) {
+      pool->worker();
+    }
+
+    void worker() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      for (;;) {
+        m_wakeup.wait(lock, [this]{ return m_stop || !m_jobs.empty(); });
+        if (m_stop)
+          break;
+
+        job* j = m_jobs.front();
+        if (--j->helpers == 0)
+          m_jobs.pop_front();
+        ++j->running;
+
+        lock.unlock();
+        j->task->run();
+        lock.lock();
+
+        if (--j->running == 0)
+          m_finished.notify_all();
+      }
+    }
+
+    void remove_job(job* j) {
+      j->helpers = 0;
+      for (auto it=m_jobs.begin(); it!=m_jobs.end(); ++it) {
+        if (*it == j) {
+          m_jobs.erase(it);
+          break;
+        }
+      }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;   // There are new jobs (or m_stop)
+    std::condition_variable m_finished; // A thread finished a job
+    std::deque<job*> m_jobs;
+    std::vector<thread*> m_workers;
+    bool m_stop;
+  };
+
+} // anonymous namespace
+
+void run_parallel_for_task(parallel_for_task* task, int helpers)
+{
+  thread_pool::instance().run(task, helpers);
+}
+
+} // namespace details
+} // namespace base
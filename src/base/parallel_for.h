@@ -0,0 +1,113 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_PARALLEL_FOR_H_INCLUDED
+#define BASE_PARALLEL_FOR_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+#include <exception>
+
+namespace base {
+
+  namespace details {
+
+    // Work that can be done by several threads at the same time. Each
+    // thread calls run(), which returns when there is nothing else to
+    // do. It must not throw exceptions.
+    class parallel_for_task {
+    public:
+      virtual ~parallel_for_task() { }
+      virtual void run() = 0;
+    };
+
+    // Runs "task" in the calling thread and in up to "helpers" threads
+    // of a process-wide pool (which is started the first time it's
+    // used, with one thread less than the number of CPU cores). Returns
+    // when all threads have returned from task->run().
+    void run_parallel_for_task(parallel_for_task* task, int helpers);
+
+    template<typename Func>
+    class parallel_for_state : public parallel_for_task {
+    public:
+      parallel_for_state(int begin, int end, const Func& func)
+        : m_next(begin), m_end(end), m_func(func) { }
+
+      // Calls the function for the next indexes until there are no
+      // more indexes (or some call throws an exception).
+      void run() override {
+        try {
+          int i;
+          while ((i = next()) < m_end)
+            m_func(i);
+        }
+        catch (...) {
+          scoped_lock lock(m_mutex);
+          if (!m_exception)
+            m_exception = std::current_exception();
+          m_next = m_end;
+        }
+      }
+
+      void rethrow() {
+        if (m_exception)
+          std::rethrow_exception(m_exception);
+      }
+
+    private:
+      int next() {
+        scoped_lock lock(m_mutex);
+        return (m_next < m_end ? m_next++: m_end);
+      }
+
+      mutex m_mutex;
+      int m_next;
+      int m_end;
+      const Func& m_func;
+      std::exception_ptr m_exception;
+
+      DISABLE_COPYING(parallel_for_state);
+    };
+
+  } // namespace details
+
+  // Calls func(i) for each i in [begin, end) using up to "threads"
+  // threads (the number of CPU cores if it's 0), the calling thread
+  // included. The other threads are taken from a pool that lives
+  // during the whole process, so calling this function doesn't create
+  // new threads. Indexes are given in order, but the calls can finish
+  // in any order. Returns when all calls have finished. If a call
+  // throws an exception, the remaining indexes are skipped and the
+  // first exception is re-thrown in the calling thread. It can be
+  // called from func() too (the calling thread does all the work that
+  // the pool cannot take).
+  template<typename Func>
+  void parallel_for(int begin, int end, const Func& func, int threads = 0)
+  {
+    if (begin >= end)
+      return;
+
+    if (threads <= 0)
+      threads = thread::hardware_concurrency();
+    if (threads > end-begin)
+      threads = end-begin;
+
+    details::parallel_for_state<Func> state(begin, end, func);
+    if (threads > 1)
+      details::run_parallel_for_task(&state, threads-1);
+    else
+      state.run();
+
+    state.rethrow();
+  }
+
+} // namespace base
+
+#endif
@@ -0,0 +1,76 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+
+TEST(ParallelFor, CallsEachIndexOnce)
+{
+  std::vector<int> calls(1000, 0);
+  parallel_for(0, int(calls.size()), [&calls](int i) { ++calls[i]; }, 4);
+
+  for (int count : calls)
+    EXPECT_EQ(1, count);
+}
+
+TEST(ParallelFor, EmptyRange)
+{
+  bool called = false;
+  parallel_for(5, 5, [&called](int i) { called = true; });
+  EXPECT_FALSE(called);
+}
+
+TEST(ParallelFor, RethrowsExceptions)
+{
+  EXPECT_THROW(
+    parallel_for(0, 100, [](int i) {
+        if (i == 50)
+          throw std::runtime_error("error");
+      }, 4),
+    std::runtime_error);
+}
+
+TEST(ParallelFor, ManyCalls)
+{
+  // Threads of the pool are reused between calls
+  for (int j=0; j<1000; ++j) {
+    std::vector<int> calls(64, 0);
+    parallel_for(0, int(calls.size()), [&calls](int i) { ++calls[i]; });
+
+    for (int count : calls)
+      ASSERT_EQ(1, count);
+  }
+}
+
+TEST(ParallelFor, NestedCalls)
+{
+  std::vector<std::vector<int> > calls(16, std::vector<int>(100, 0));
+  parallel_for(0, int(calls.size()), [&calls](int i) {
+      std::vector<int>& row = calls[i];
+      parallel_for(0, int(row.size()), [&row](int j) { ++row[j]; });
+    });
+
+  for (const std::vector<int>& row : calls)
+    for (int count : row)
+      EXPECT_EQ(1, count);
+}
+
+TEST(ParallelFor, HardwareConcurrency)
+{
+  EXPECT_LE(1, thread::hardware_concurrency());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -89,6 +89,23 @@ base::thread::native_handle_type base::thread::native_handle()
   return m_native_handle;
 }
 
+int base::thread::hardware_concurrency()
+{
+#ifdef WIN32
+
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  int n = int(info.dwNumberOfProcessors);
+
+#else
+
+  int n = int(::sysconf(_SC_NPROCESSORS_ONLN));
+
+#endif
+
+  return (n > 0 ? n: 1);
+}
+
 void base::thread::launch_thread(func_wrapper* f)
 {
   m_native_handle = (native_handle_type)0;
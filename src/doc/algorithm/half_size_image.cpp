@@ -0,0 +1,91 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/algorithm/half_size_image.h"
+
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/image_traits.h"
+
+namespace doc {
+namespace algorithm {
+
+static inline color_t average(RgbTraits, color_t a, color_t b, color_t c, color_t d)
+{
+  int wa = rgba_geta(a), wb = rgba_geta(b), wc = rgba_geta(c), wd = rgba_geta(d);
+  int alpha = wa + wb + wc + wd;
+  if (alpha == 0)
+    return 0;
+
+  return rgba(
+    (rgba_getr(a)*wa + rgba_getr(b)*wb + rgba_getr(c)*wc + rgba_getr(d)*wd) / alpha,
+    (rgba_getg(a)*wa + rgba_getg(b)*wb + rgba_getg(c)*wc + rgba_getg(d)*wd) / alpha,
+    (rgba_getb(a)*wa + rgba_getb(b)*wb + rgba_getb(c)*wc + rgba_getb(d)*wd) / alpha,
+    (alpha+2) / 4);
+}
+
+static inline color_t average(GrayscaleTraits, color_t a, color_t b, color_t c, color_t d)
+{
+  int wa = graya_geta(a), wb = graya_geta(b), wc = graya_geta(c), wd = graya_geta(d);
+  int alpha = wa + wb + wc + wd;
+  if (alpha == 0)
+    return 0;
+
+  return graya(
+    (graya_getv(a)*wa + graya_getv(b)*wb + graya_getv(c)*wc + graya_getv(d)*wd) / alpha,
+    (alpha+2) / 4);
+}
+
+template<class Traits>
+static void half_size_image_templ(const Image* src, Image* dst)
+{
+  typedef typename Traits::const_address_t const_address_t;
+  typedef typename Traits::address_t address_t;
+
+  for (int y=0; y<dst->height(); ++y) {
+    const_address_t row0 = (const_address_t)src->getPixelAddress(0, y*2);
+    const_address_t row1 = (const_address_t)src->getPixelAddress(0, y*2+1);
+    address_t dst_address = (address_t)dst->getPixelAddress(0, y);
+
+    for (int x=0; x<dst->width(); ++x, row0 += 2, row1 += 2, ++dst_address)
+      *dst_address = average(Traits(), row0[0], row0[1], row1[0], row1[1]);
+  }
+}
+
+Image* create_half_size_image(const Image* src)
+{
+  int w = src->width() / 2;
+  int h = src->height() / 2;
+  if (w < 1 || h < 1)
+    return NULL;
+
+  Image* dst;
+  switch (src->pixelFormat()) {
+
+    case IMAGE_RGB:
+      dst = Image::create(IMAGE_RGB, w, h);
+      half_size_image_templ<RgbTraits>(src, dst);
+      break;
+
+    case IMAGE_GRAYSCALE:
+      dst = Image::create(IMAGE_GRAYSCALE, w, h);
+      half_size_image_templ<GrayscaleTraits>(src, dst);
+      break;
+
+    default:
+      return NULL;
+  }
+
+  dst->setMaskColor(src->maskColor());
+  return dst;
+}
+
+} // namespace algorithm
+} // namespace doc
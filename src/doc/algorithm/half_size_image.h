@@ -0,0 +1,26 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_ALGORITHM_HALF_SIZE_IMAGE_H_INCLUDED
+#define DOC_ALGORITHM_HALF_SIZE_IMAGE_H_INCLUDED
+#pragma once
+
+namespace doc {
+  class Image;
+
+  namespace algorithm {
+
+    // Creates an image with half the width and height of "src" (odd
+    // rows/columns are discarded) where each pixel is the average of
+    // a 2x2 block of the source (weighted by the alpha channel).
+    // Returns NULL if the image is too small or if it's not a RGB or
+    // grayscale image (indexes cannot be averaged).
+    Image* create_half_size_image(const Image* src);
+
+  } // algorithm
+} // doc
+
+#endif
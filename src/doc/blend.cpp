@@ -11,6 +11,12 @@
 #include "doc/blend.h"
 #include "doc/image.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_USE_SSE2
+  #include <emmintrin.h>
+#endif
+
 namespace doc {
 
 BLEND_COLOR rgba_blenders[] =
@@ -308,4 +314,286 @@ int graya_blend_blackandwhite(int back, int front, int opacity)
   return graya(D_k, 255);
 }
 
+/**********************************************************************/
+/* Row blenders                                                       */
+/**********************************************************************/
+
+template<typename pixel_t, int (*blender)(int, int, int)>
+static void blend_row_tpl(pixel_t* dst, const pixel_t* src, int n,
+                          int opacity, pixel_t mask_color)
+{
+  for (int x=0; x<n; ++x, ++dst, ++src) {
+    if (*src != mask_color)
+      *dst = (*blender)(*dst, *src, opacity);
+  }
+}
+
+#ifdef DOC_USE_SSE2
+
+// All the following functions work with four RGBA pixels, one pixel
+// in each 32-bit lane, and give exactly the same results as the
+// scalar blenders.
+
+// INT_MULT() for each 32-bit lane. "a" can be negative (but must fit
+// in 16 bits) and "b" must be in [0,255].
+static inline __m128i sse2_int_mult(__m128i a, __m128i b)
+{
+  // _mm_madd_epi16() multiplies the low 16-bits words (a*b) and the
+  // high words (sign of "a" * 0), so we get a 32-bit product.
+  __m128i t = _mm_add_epi32(_mm_madd_epi16(a, b), _mm_set1_epi32(0x80));
+  return _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(t, 8), t), 8);
+}
+
+static inline __m128i sse2_select(__m128i cond, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(cond, a), _mm_andnot_si128(cond, b));
+}
+
+static inline __m128i sse2_channel(__m128i c, int shift)
+{
+  return _mm_and_si128(_mm_srli_epi32(c, shift), _mm_set1_epi32(0xff));
+}
+
+// B + (F-B) * A / D, with the integer division truncated to zero as
+// in C. A float division is exact enough for this range of values
+// (the quotient is never closer than 1/255 to the next integer).
+static inline __m128i sse2_lerp_div(__m128i b, __m128i f, __m128i a, __m128 d)
+{
+  __m128 num = _mm_cvtepi32_ps(_mm_madd_epi16(_mm_sub_epi32(f, b), a));
+  return _mm_add_epi32(b, _mm_cvttps_epi32(_mm_div_ps(num, d)));
+}
+
+static inline __m128i sse2_rgba(__m128i r, __m128i g, __m128i b, __m128i a)
+{
+  const __m128i ff = _mm_set1_epi32(0xff);
+  return _mm_or_si128(
+    _mm_or_si128(_mm_and_si128(r, ff),
+                 _mm_slli_epi32(_mm_and_si128(g, ff), rgba_g_shift)),
+    _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b, ff), rgba_b_shift),
+                 _mm_slli_epi32(_mm_and_si128(a, ff), rgba_a_shift)));
+}
+
+static inline __m128i sse2_rgba_blend_normal(__m128i back, __m128i front, __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  __m128i B_a = _mm_srli_epi32(back, rgba_a_shift);
+  __m128i F_a = _mm_srli_epi32(front, rgba_a_shift);
+  __m128i back_is_transparent = _mm_cmpeq_epi32(B_a, zero);
+  __m128i front_is_transparent = _mm_cmpeq_epi32(F_a, zero);
+
+  F_a = sse2_int_mult(F_a, opacity);
+
+  // D_a is zero only when the back is transparent, in that case we
+  // divide by one just to avoid a division by zero (the result of
+  // these lanes is discarded).
+  __m128i D_a = _mm_sub_epi32(_mm_add_epi32(B_a, F_a), sse2_int_mult(B_a, F_a));
+  __m128 D_a_div = _mm_cvtepi32_ps(
+    _mm_or_si128(D_a, _mm_and_si128(back_is_transparent, _mm_set1_epi32(1))));
+
+  __m128i D_r = sse2_lerp_div(sse2_channel(back, rgba_r_shift),
+                              sse2_channel(front, rgba_r_shift), F_a, D_a_div);
+  __m128i D_g = sse2_lerp_div(sse2_channel(back, rgba_g_shift),
+                              sse2_channel(front, rgba_g_shift), F_a, D_a_div);
+  __m128i D_b = sse2_lerp_div(sse2_channel(back, rgba_b_shift),
+                              sse2_channel(front, rgba_b_shift), F_a, D_a_div);
+  __m128i result = sse2_rgba(D_r, D_g, D_b, D_a);
+
+  result = sse2_select(front_is_transparent, back, result);
+  return sse2_select(back_is_transparent,
+                     _mm_or_si128(_mm_and_si128(front, _mm_set1_epi32(rgba_rgb_mask)),
+                                  _mm_slli_epi32(F_a, rgba_a_shift)),
+                     result);
+}
+
+static inline __m128i sse2_rgba_blend_copy(__m128i back, __m128i front, __m128i opacity)
+{
+  return front;
+}
+
+static inline __m128i sse2_rgba_blend_merge(__m128i back, __m128i front, __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  __m128i B_a = _mm_srli_epi32(back, rgba_a_shift);
+  __m128i F_a = _mm_srli_epi32(front, rgba_a_shift);
+  __m128i back_is_transparent = _mm_cmpeq_epi32(B_a, zero);
+  __m128i front_is_transparent = _mm_cmpeq_epi32(F_a, zero);
+
+  __m128i B_r = sse2_channel(back, rgba_r_shift);
+  __m128i B_g = sse2_channel(back, rgba_g_shift);
+  __m128i B_b = sse2_channel(back, rgba_b_shift);
+  __m128i D_r = _mm_add_epi32(B_r, sse2_int_mult(_mm_sub_epi32(sse2_channel(front, rgba_r_shift), B_r), opacity));
+  __m128i D_g = _mm_add_epi32(B_g, sse2_int_mult(_mm_sub_epi32(sse2_channel(front, rgba_g_shift), B_g), opacity));
+  __m128i D_b = _mm_add_epi32(B_b, sse2_int_mult(_mm_sub_epi32(sse2_channel(front, rgba_b_shift), B_b), opacity));
+  __m128i D_a = _mm_add_epi32(B_a, sse2_int_mult(_mm_sub_epi32(F_a, B_a), opacity));
+
+  __m128i rgb = _mm_and_si128(sse2_rgba(D_r, D_g, D_b, zero),
+                              _mm_set1_epi32(rgba_rgb_mask));
+  rgb = sse2_select(front_is_transparent, _mm_and_si128(back, _mm_set1_epi32(rgba_rgb_mask)), rgb);
+  rgb = sse2_select(back_is_transparent, _mm_and_si128(front, _mm_set1_epi32(rgba_rgb_mask)), rgb);
+  rgb = _mm_andnot_si128(_mm_cmpeq_epi32(D_a, zero), rgb);
+
+  return _mm_or_si128(rgb, _mm_slli_epi32(_mm_and_si128(D_a, _mm_set1_epi32(0xff)), rgba_a_shift));
+}
+
+template<__m128i (*sse2_blender)(__m128i, __m128i, __m128i),
+         int (*blender)(int, int, int)>
+static void sse2_rgba_blend_row_tpl(uint32_t* dst, const uint32_t* src, int n,
+                                    int opacity, uint32_t mask_color)
+{
+  const __m128i mask = _mm_set1_epi32(mask_color);
+  const __m128i op = _mm_set1_epi32(opacity);
+
+  for (; n >= 4; n -= 4, dst += 4, src += 4) {
+    __m128i back = _mm_loadu_si128((const __m128i*)dst);
+    __m128i front = _mm_loadu_si128((const __m128i*)src);
+    __m128i result = (*sse2_blender)(back, front, op);
+
+    _mm_storeu_si128((__m128i*)dst,
+                     sse2_select(_mm_cmpeq_epi32(front, mask), back, result));
+  }
+
+  blend_row_tpl<uint32_t, blender>(dst, src, n, opacity, mask_color);
+}
+
+#endif // DOC_USE_SSE2
+
+#ifdef DOC_USE_SSE2
+
+// Normal blend mode with opacity=255. Groups of four opaque pixels
+// replace the destination pixels and groups of pixels equal to the
+// mask color are skipped, so the blender is used only for the rest.
+static void sse2_rgba_blend_row_normal_opaque(uint32_t* dst, const uint32_t* src, int n,
+                                              int opacity, uint32_t mask_color)
+{
+  ASSERT(opacity == 255);
+
+  const __m128i mask = _mm_set1_epi32(mask_color);
+  const __m128i alpha = _mm_set1_epi32(rgba_a_mask);
+  const __m128i op = _mm_set1_epi32(255);
+
+  for (; n >= 4; n -= 4, dst += 4, src += 4) {
+    __m128i front = _mm_loadu_si128((const __m128i*)src);
+    __m128i is_mask = _mm_cmpeq_epi32(front, mask);
+    int mask_bits = _mm_movemask_epi8(is_mask);
+    if (mask_bits == 0xffff)
+      continue;
+
+    if (mask_bits == 0 &&
+        _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(front, alpha), alpha)) == 0xffff) {
+      _mm_storeu_si128((__m128i*)dst, front);
+      continue;
+    }
+
+    __m128i back = _mm_loadu_si128((const __m128i*)dst);
+    __m128i result = sse2_rgba_blend_normal(back, front, op);
+    _mm_storeu_si128((__m128i*)dst, sse2_select(is_mask, back, result));
+  }
+
+  blend_row_tpl<uint32_t, rgba_blend_normal>(dst, src, n, opacity, mask_color);
+}
+
+#else
+
+// Normal blend mode with opacity=255 (opaque pixels replace the
+// destination pixels).
+static void rgba_blend_row_normal_opaque(uint32_t* dst, const uint32_t* src, int n,
+                                         int opacity, uint32_t mask_color)
+{
+  ASSERT(opacity == 255);
+
+  for (int x=0; x<n; ++x, ++dst, ++src) {
+    uint32_t c = *src;
+    if (c == mask_color)
+      continue;
+
+    if ((c & rgba_a_mask) == rgba_a_mask)
+      *dst = c;
+    else
+      *dst = rgba_blend_normal(*dst, c, 255);
+  }
+}
+
+#endif // DOC_USE_SSE2
+
+static void graya_blend_row_normal_opaque(uint16_t* dst, const uint16_t* src, int n,
+                                          int opacity, uint16_t mask_color)
+{
+  ASSERT(opacity == 255);
+
+  for (int x=0; x<n; ++x, ++dst, ++src) {
+    uint16_t c = *src;
+    if (c == mask_color)
+      continue;
+
+    if ((c & graya_a_mask) == graya_a_mask)
+      *dst = c;
+    else
+      *dst = graya_blend_normal(*dst, c, 255);
+  }
+}
+
+BLEND_ROW_RGBA get_rgba_row_blender(int blend_mode, int opacity)
+{
+  switch (blend_mode) {
+#ifdef DOC_USE_SSE2
+    case BLEND_MODE_NORMAL:
+      if (opacity == 255)
+        return sse2_rgba_blend_row_normal_opaque;
+      return sse2_rgba_blend_row_tpl<sse2_rgba_blend_normal, rgba_blend_normal>;
+    case BLEND_MODE_COPY:
+      return sse2_rgba_blend_row_tpl<sse2_rgba_blend_copy, rgba_blend_copy>;
+    case BLEND_MODE_MERGE:
+      return sse2_rgba_blend_row_tpl<sse2_rgba_blend_merge, rgba_blend_merge>;
+#else
+    case BLEND_MODE_NORMAL:
+      if (opacity == 255)
+        return rgba_blend_row_normal_opaque;
+      return blend_row_tpl<uint32_t, rgba_blend_normal>;
+    case BLEND_MODE_COPY:
+      return blend_row_tpl<uint32_t, rgba_blend_copy>;
+    case BLEND_MODE_MERGE:
+      return blend_row_tpl<uint32_t, rgba_blend_merge>;
+#endif
+    case BLEND_MODE_RED_TINT:
+      return blend_row_tpl<uint32_t, rgba_blend_red_tint>;
+    case BLEND_MODE_BLUE_TINT:
+      return blend_row_tpl<uint32_t, rgba_blend_blue_tint>;
+    case BLEND_MODE_BLACKANDWHITE:
+      return blend_row_tpl<uint32_t, rgba_blend_blackandwhite>;
+  }
+
+  ASSERT(false);
+  return blend_row_tpl<uint32_t, rgba_blend_normal>;
+}
+
+BLEND_ROW_GRAYA get_graya_row_blender(int blend_mode, int opacity)
+{
+  switch (blend_mode) {
+    case BLEND_MODE_NORMAL:
+      if (opacity == 255)
+        return graya_blend_row_normal_opaque;
+      return blend_row_tpl<uint16_t, graya_blend_normal>;
+    case BLEND_MODE_BLACKANDWHITE:
+      return blend_row_tpl<uint16_t, graya_blend_blackandwhite>;
+    default:
+      // The rest of modes are a copy for grayscale images (see
+      // graya_blenders table).
+      return blend_row_tpl<uint16_t, graya_blend_copy>;
+  }
+}
+
+void rgba_blend_row(uint32_t* dst, const uint32_t* src, int n,
+                    int opacity, int blend_mode, uint32_t mask_color)
+{
+  (*get_rgba_row_blender(blend_mode, opacity))(dst, src, n, opacity, mask_color);
+}
+
+void graya_blend_row(uint16_t* dst, const uint16_t* src, int n,
+                     int opacity, int blend_mode, uint16_t mask_color)
+{
+  (*get_graya_row_blender(blend_mode, opacity))(dst, src, n, opacity, mask_color);
+}
+
 } // namespace doc
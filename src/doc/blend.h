@@ -42,6 +42,29 @@ namespace doc {
   int graya_blend_merge(int back, int front, int opacity);
   int graya_blend_blackandwhite(int back, int front, int opacity);
 
+  // Blends "n" pixels from the "src" row into the "dst" row using the
+  // given blend mode. Source pixels equal to "mask_color" are
+  // skipped. These functions give the same results as calling the
+  // per-pixel blenders, but the most common modes (normal, copy and
+  // merge) are processed several pixels at the same time using SIMD
+  // instructions when they are available.
+  void rgba_blend_row(uint32_t* dst, const uint32_t* src, int n,
+                      int opacity, int blend_mode, uint32_t mask_color);
+  void graya_blend_row(uint16_t* dst, const uint16_t* src, int n,
+                       int opacity, int blend_mode, uint16_t mask_color);
+
+  typedef void (*BLEND_ROW_RGBA)(uint32_t* dst, const uint32_t* src, int n,
+                                 int opacity, uint32_t mask_color);
+  typedef void (*BLEND_ROW_GRAYA)(uint16_t* dst, const uint16_t* src, int n,
+                                  int opacity, uint16_t mask_color);
+
+  // Returns the row blender used by the functions above for the given
+  // blend mode and opacity, so it can be selected only once to blend
+  // several rows. The normal mode with full opacity has its own
+  // blender which copies opaque pixels directly.
+  BLEND_ROW_RGBA get_rgba_row_blender(int blend_mode, int opacity);
+  BLEND_ROW_GRAYA get_graya_row_blender(int blend_mode, int opacity);
+
 } // namespace doc
 
 #endif
@@ -0,0 +1,129 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/blend.h"
+#include "doc/color.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+static uint32_t random_rgba()
+{
+  // Use a lot of fully transparent and opaque pixels to test all
+  // special cases of the blenders.
+  int a;
+  switch (std::rand() % 4) {
+    case 0: a = 0; break;
+    case 1: a = 255; break;
+    default: a = std::rand() % 256; break;
+  }
+  return rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, a);
+}
+
+TEST(BlendRow, RgbaSameResultsAsPixelBlenders)
+{
+  const int n = 67;
+  const int opacities[] = { 0, 1, 64, 128, 200, 254, 255 };
+
+  for (int blend_mode=0; blend_mode<BLEND_MODE_MAX; ++blend_mode) {
+    for (int opacity : opacities) {
+      std::vector<uint32_t> back(n), front(n);
+      for (int i=0; i<n; ++i) {
+        back[i] = random_rgba();
+        front[i] = random_rgba();
+      }
+      front[5] = front[n-1] = 0x00000000; // Mask color
+
+      std::vector<uint32_t> expected(back);
+      for (int i=0; i<n; ++i)
+        if (front[i] != 0)
+          expected[i] = rgba_blenders[blend_mode](back[i], front[i], opacity);
+
+      // Different lengths/offsets to test scalar tails
+      for (int offset=0; offset<4; ++offset) {
+        std::vector<uint32_t> result(back);
+        rgba_blend_row(&result[offset], &front[offset], n-offset,
+                       opacity, blend_mode, 0);
+
+        for (int i=offset; i<n; ++i)
+          ASSERT_EQ(expected[i], result[i])
+            << "blend_mode=" << blend_mode << " opacity=" << opacity
+            << " back=" << std::hex << back[i] << " front=" << front[i];
+      }
+    }
+  }
+}
+
+TEST(BlendRow, GrayaSameResultsAsPixelBlenders)
+{
+  const int n = 33;
+
+  for (int blend_mode=0; blend_mode<BLEND_MODE_MAX; ++blend_mode) {
+    for (int opacity=0; opacity<256; opacity+=51) {
+      std::vector<uint16_t> back(n), front(n);
+      for (int i=0; i<n; ++i) {
+        back[i] = graya(std::rand() % 256, std::rand() % 256);
+        front[i] = graya(std::rand() % 256, std::rand() % 256);
+      }
+      front[3] = 0;
+
+      std::vector<uint16_t> expected(back);
+      for (int i=0; i<n; ++i)
+        if (front[i] != 0)
+          expected[i] = graya_blenders[blend_mode](back[i], front[i], opacity);
+
+      std::vector<uint16_t> result(back);
+      graya_blend_row(&result[0], &front[0], n, opacity, blend_mode, 0);
+
+      for (int i=0; i<n; ++i)
+        ASSERT_EQ(expected[i], result[i]);
+    }
+  }
+}
+
+TEST(BlendRow, RgbaNormalOpaqueRuns)
+{
+  // Runs of opaque and mask pixels use the fast paths of the normal
+  // blend mode with full opacity.
+  const int n = 64;
+  std::vector<uint32_t> back(n), front(n);
+  for (int i=0; i<n; ++i) {
+    back[i] = random_rgba();
+    switch ((i / 8) % 3) {
+      case 0: front[i] = rgba(std::rand() % 256, 0, 0, 255); break;
+      case 1: front[i] = 0; break;
+      case 2: front[i] = random_rgba(); break;
+    }
+  }
+
+  std::vector<uint32_t> expected(back);
+  for (int i=0; i<n; ++i)
+    if (front[i] != 0)
+      expected[i] = rgba_blend_normal(back[i], front[i], 255);
+
+  for (int offset=0; offset<4; ++offset) {
+    std::vector<uint32_t> result(back);
+    (*get_rgba_row_blender(BLEND_MODE_NORMAL, 255))(
+      &result[offset], &front[offset], n-offset, 255, 0);
+
+    for (int i=offset; i<n; ++i)
+      ASSERT_EQ(expected[i], result[i]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
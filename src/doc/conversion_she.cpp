@@ -21,6 +21,7 @@
 #include "she/surface_format.h"
 #include "she/scoped_surface_lock.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace doc {
@@ -92,6 +93,32 @@ void convert_image_to_surface_templ(const Image* image, she::LockedSurface* dst,
   }
 }
 
+// Fast path for the most common case (RGB images on 32bpp surfaces):
+// pixels are read directly from each row of the image, and rows are
+// copied as they are if the surface uses the same pixel layout.
+template<>
+void convert_image_to_surface_templ<RgbTraits, uint32_t*>(const Image* image, she::LockedSurface* dst,
+  int src_x, int src_y, int dst_x, int dst_y, int w, int h, const Palette* palette, const she::SurfaceFormatData* fd)
+{
+  bool sameLayout =
+    (fd->redShift   == rgba_r_shift && fd->redMask   == rgba_r_mask &&
+     fd->greenShift == rgba_g_shift && fd->greenMask == rgba_g_mask &&
+     fd->blueShift  == rgba_b_shift && fd->blueMask  == rgba_b_mask &&
+     fd->alphaShift == rgba_a_shift && fd->alphaMask == rgba_a_mask);
+
+  for (int v=0; v<h; ++v, ++src_y, ++dst_y) {
+    const uint32_t* src_address = (const uint32_t*)image->getPixelAddress(src_x, src_y);
+    uint32_t* dst_address = (uint32_t*)dst->getData(dst_x, dst_y);
+
+    if (sameLayout)
+      std::copy(src_address, src_address+w, dst_address);
+    else {
+      for (int u=0; u<w; ++u, ++src_address, ++dst_address)
+        *dst_address = convert_color_to_surface<RgbTraits, she::kRgbaSurfaceFormat>(*src_address, palette, fd);
+    }
+  }
+}
+
 struct Address24bpp
 {
   uint8_t* m_ptr;
@@ -191,6 +191,8 @@ void Dirty::swapImagePixels(Image* image)
       std::swap_ranges(address, address+getLineSize(col->w), col->data.begin());
     }
   }
+
+  image->incrementVersion();
 }
 
 } // namespace doc
@@ -0,0 +1,70 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/algorithm/half_size_image.h"
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/primitives.h"
+
+using namespace base;
+using namespace doc;
+using namespace doc::algorithm;
+
+TEST(HalfSizeImage, AverageRgb)
+{
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, 5, 3));
+  clear_image(src, rgba(0, 0, 0, 255));
+  put_pixel(src, 0, 0, rgba(255, 0, 0, 255));
+  put_pixel(src, 1, 0, rgba(255, 0, 0, 255));
+  put_pixel(src, 2, 0, rgba(200, 100, 0, 255));
+  put_pixel(src, 3, 0, rgba(0, 0, 0, 0));
+  put_pixel(src, 2, 1, rgba(0, 0, 0, 0));
+  put_pixel(src, 3, 1, rgba(0, 0, 0, 0));
+
+  UniquePtr<Image> dst(create_half_size_image(src));
+  ASSERT_TRUE(dst != NULL);
+  EXPECT_EQ(2, dst->width());
+  EXPECT_EQ(1, dst->height());
+
+  EXPECT_EQ(rgba(127, 0, 0, 255), get_pixel(dst, 0, 0));
+
+  // Transparent pixels don't affect the color
+  EXPECT_EQ(rgba(200, 100, 0, 64), get_pixel(dst, 1, 0));
+}
+
+TEST(HalfSizeImage, AverageGrayscale)
+{
+  UniquePtr<Image> src(Image::create(IMAGE_GRAYSCALE, 2, 2));
+  clear_image(src, graya(0, 0));
+  put_pixel(src, 0, 0, graya(100, 255));
+  put_pixel(src, 1, 1, graya(200, 255));
+
+  UniquePtr<Image> dst(create_half_size_image(src));
+  ASSERT_TRUE(dst != NULL);
+  EXPECT_EQ(graya(150, 128), get_pixel(dst, 0, 0));
+}
+
+TEST(HalfSizeImage, Unsupported)
+{
+  UniquePtr<Image> indexed(Image::create(IMAGE_INDEXED, 4, 4));
+  EXPECT_EQ(NULL, create_half_size_image(indexed));
+
+  UniquePtr<Image> small(Image::create(IMAGE_RGB, 1, 4));
+  EXPECT_EQ(NULL, create_half_size_image(small));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
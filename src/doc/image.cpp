@@ -10,16 +10,106 @@
 
 #include "doc/image.h"
 
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
 #include "doc/algo.h"
 #include "doc/blend.h"
 #include "doc/brush.h"
+#include "doc/image_buffer_pool.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/primitives_fast.h"
 #include "doc/rgbmap.h"
 
+#include <cstring>
+
 namespace doc {
 
+// Protects the cached visible bounds of all images. It's locked only
+// to read/write the cached values, not while they are calculated.
+static base::mutex bounds_mutex;
+
+// Locked while the visible bounds of an image are calculated, so two
+// threads don't scan the same image at the same time. Each image uses
+// the mutex of its ID, so different images can be scanned in parallel.
+static const int kScanMutexes = 16;
+static base::mutex scan_mutexes[kScanMutexes];
+
+template<typename ImageTraits>
+struct PixelAlpha {
+  static int get(typename ImageTraits::pixel_t c) { return 255; }
+};
+
+template<>
+struct PixelAlpha<RgbTraits> {
+  static int get(RgbTraits::pixel_t c) { return rgba_geta(c); }
+};
+
+template<>
+struct PixelAlpha<GrayscaleTraits> {
+  static int get(GrayscaleTraits::pixel_t c) { return graya_geta(c); }
+};
+
+template<typename ImageTraits>
+static void calculate_visible_bounds(const Image* image,
+  gfx::Rect& bounds, bool& opaque)
+{
+  typedef typename ImageTraits::pixel_t pixel_t;
+  typedef PixelAlpha<ImageTraits> Alpha;
+
+  const pixel_t mask = pixel_t(image->maskColor());
+  const int w = image->width();
+  const int h = image->height();
+  int x1 = w, y1 = h, x2 = -1, y2 = -1;
+  pixel_t c;
+
+  opaque = true;
+
+  for (int y=0; y<h; ++y) {
+    // First and last visible pixels of the row
+    int u = 0;
+    for (; u<w; ++u) {
+      c = get_pixel_fast<ImageTraits>(image, u, y);
+      if (c != mask && Alpha::get(c) != 0)
+        break;
+    }
+    if (u == w) {
+      opaque = false;
+      continue;
+    }
+
+    int v = w-1;
+    for (; v>u; --v) {
+      c = get_pixel_fast<ImageTraits>(image, v, y);
+      if (c != mask && Alpha::get(c) != 0)
+        break;
+    }
+
+    if (u > 0 || v < w-1)
+      opaque = false;
+    else if (opaque) {
+      for (int x=u; x<=v; ++x) {
+        c = get_pixel_fast<ImageTraits>(image, x, y);
+        if (c == mask || Alpha::get(c) != 255) {
+          opaque = false;
+          break;
+        }
+      }
+    }
+
+    if (x1 > u) x1 = u;
+    if (x2 < v) x2 = v;
+    if (y1 > y) y1 = y;
+    y2 = y;
+  }
+
+  if (x2 >= x1)
+    bounds = gfx::Rect(x1, y1, x2-x1+1, y2-y1+1);
+  else
+    bounds = gfx::Rect();
+}
+
 Image::Image(PixelFormat format, int width, int height)
   : Object(ObjectType::Image)
   , m_format(format)
@@ -27,20 +117,117 @@ Image::Image(PixelFormat format, int width, int height)
   m_width = width;
   m_height = height;
   m_maskColor = 0;
+  m_version = 1;
+  m_hashVersion = 0;
+  m_hash = 0;
+  m_boundsVersion = 0;
+  m_opaque = false;
 }
 
 Image::~Image()
 {
 }
 
+void Image::setMaskColor(color_t c)
+{
+  // The visible bounds depend on the mask color
+  if (m_maskColor != c) {
+    m_maskColor = c;
+    incrementVersion();
+  }
+}
+
 int Image::getMemSize() const
 {
   return sizeof(Image) + getRowStrideSize()*m_height;
 }
 
-int Image::getRowStrideSize() const
+uint64_t Image::contentHash() const
+{
+  if (m_hashVersion == m_version)
+    return m_hash;
+
+  // 64-bit FNV-1a of the image size, format and the pixel data of
+  // each row (padding bytes are not included), processing 8 bytes
+  // at the same time.
+  const uint64_t prime = 0x100000001b3ull;
+  uint64_t h = 0xcbf29ce484222325ull;
+  h = (h ^ uint64_t(m_format)) * prime;
+  h = (h ^ uint64_t(m_width)) * prime;
+  h = (h ^ uint64_t(m_height)) * prime;
+
+  int bytes = getRowStrideSize(m_width);
+  for (int y=0; y<m_height; ++y) {
+    const uint8_t* p = getPixelAddress(0, y);
+    int x = 0;
+    for (; x+8 <= bytes; x += 8, p += 8) {
+      uint64_t k;
+      std::memcpy(&k, p, 8);
+      h = (h ^ k) * prime;
+      h ^= h >> 29;
+    }
+    for (; x<bytes; ++x, ++p)
+      h = (h ^ *p) * prime;
+  }
+
+  m_hash = h;
+  m_hashVersion = m_version;
+  return m_hash;
+}
+
+gfx::Rect Image::visibleBounds() const
 {
-  return getRowStrideSize(m_width);
+  {
+    base::scoped_lock lock(bounds_mutex);
+    if (m_boundsVersion == m_version)
+      return m_visibleBounds;
+  }
+
+  base::scoped_lock scanLock(scan_mutexes[id() % kScanMutexes]);
+
+  // Other thread could calculate the bounds while we were waiting
+  {
+    base::scoped_lock lock(bounds_mutex);
+    if (m_boundsVersion == m_version)
+      return m_visibleBounds;
+  }
+
+  gfx::Rect bounds;
+  bool opaque = false;
+  uint32_t version = m_version;
+
+  switch (m_format) {
+    case IMAGE_RGB:       calculate_visible_bounds<RgbTraits>(this, bounds, opaque); break;
+    case IMAGE_GRAYSCALE: calculate_visible_bounds<GrayscaleTraits>(this, bounds, opaque); break;
+    case IMAGE_INDEXED:   calculate_visible_bounds<IndexedTraits>(this, bounds, opaque); break;
+    case IMAGE_BITMAP:    calculate_visible_bounds<BitmapTraits>(this, bounds, opaque); break;
+  }
+
+  base::scoped_lock lock(bounds_mutex);
+  m_visibleBounds = bounds;
+  m_opaque = opaque;
+  m_boundsVersion = version;
+  return bounds;
+}
+
+bool Image::isOpaque() const
+{
+  {
+    base::scoped_lock lock(bounds_mutex);
+    if (m_boundsVersion == m_version)
+      return m_opaque;
+  }
+
+  visibleBounds();
+
+  base::scoped_lock lock(bounds_mutex);
+  return m_opaque;
+}
+
+bool Image::isVisibleBoundsValid() const
+{
+  base::scoped_lock lock(bounds_mutex);
+  return (m_boundsVersion == m_version);
 }
 
 int Image::getRowStrideSize(int pixels_per_row) const
@@ -61,6 +248,27 @@ Image* Image::create(PixelFormat format, int width, int height,
   return NULL;
 }
 
+// static
+Image* Image::createAligned(PixelFormat format, int width, int height,
+                            const ImageBufferPtr& buffer)
+{
+  switch (format) {
+    case IMAGE_RGB:       return new ImageImpl<RgbTraits>(width, height, buffer, true);
+    case IMAGE_GRAYSCALE: return new ImageImpl<GrayscaleTraits>(width, height, buffer, true);
+    case IMAGE_INDEXED:   return new ImageImpl<IndexedTraits>(width, height, buffer, true);
+    case IMAGE_BITMAP:    return new ImageImpl<BitmapTraits>(width, height, buffer, true);
+  }
+  return NULL;
+}
+
+// static
+Image* Image::createFromPool(PixelFormat format, int width, int height)
+{
+  return createAligned(format, width, height,
+    ImageBufferPool::instance()->get(
+      calculate_image_buffer_size(format, width, height, true)));
+}
+
 // static
 Image* Image::createCopy(const Image* image, const ImageBufferPtr& buffer)
 {
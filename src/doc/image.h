@@ -36,6 +36,21 @@ namespace doc {
     static Image* createCopy(const Image* image,
                              const ImageBufferPtr& buffer = ImageBufferPtr());
 
+    // Creates an image with an aligned layout: the first row starts
+    // at a kImageBaseAlignment boundary and each row is padded to a
+    // multiple of kImageRowAlignment bytes, so SIMD kernels can use
+    // aligned loads/stores. getRowStrideSize() returns the padded
+    // size of each row.
+    static Image* createAligned(PixelFormat format, int width, int height,
+                                const ImageBufferPtr& buffer = ImageBufferPtr());
+
+    // Creates an image with a buffer from the process-wide
+    // ImageBufferPool (the buffer returns to the pool when the image
+    // is destroyed). Pixels are not initialized, so it should be used
+    // for temporary images that are completely overwritten. The
+    // image uses the aligned layout.
+    static Image* createFromPool(PixelFormat format, int width, int height);
+
     virtual ~Image();
 
     PixelFormat pixelFormat() const { return m_format; }
@@ -44,14 +59,44 @@ namespace doc {
     gfx::Size size() const { return gfx::Size(m_width, m_height); }
     gfx::Rect bounds() const { return gfx::Rect(0, 0, m_width, m_height); }
     color_t maskColor() const { return m_maskColor; }
-    void setMaskColor(color_t c) { m_maskColor = c; }
+    void setMaskColor(color_t c);
 
     virtual int getMemSize() const override;
-    int getRowStrideSize() const;
+
+    // Returns the number of bytes between the beginning of two
+    // consecutive rows (it includes the padding of aligned images).
+    virtual int getRowStrideSize() const = 0;
+
+    // Returns the number of bytes used by "pixels_per_row" pixels
+    // (without padding), i.e. the size of the pixel data of a row.
     int getRowStrideSize(int pixels_per_row) const;
 
+    // Modification version of the image. It's incremented by all
+    // member functions that modify pixels (or the mask color) and
+    // when the bits are locked for writing. Code that writes pixels directly through
+    // getPixelAddress() must call incrementVersion().
+    uint32_t version() const { return m_version; }
+    void incrementVersion() { ++m_version; }
+
+    // Returns a 64-bit hash of the pixels. It's calculated only if
+    // the image was modified since the last call.
+    uint64_t contentHash() const;
+    bool isContentHashValid() const { return m_hashVersion == m_version; }
+
+    // Returns the smallest rectangle that contains all visible pixels
+    // (pixels that aren't the mask color and, in RGB and grayscale
+    // images, have alpha > 0), and if all pixels are opaque. Both are
+    // calculated only if the image was modified since the last call,
+    // and they can be used from several threads at the same time (only
+    // one thread scans the pixels, the others wait for its result).
+    gfx::Rect visibleBounds() const;
+    bool isOpaque() const;
+    bool isVisibleBoundsValid() const;
+
     template<typename ImageTraits>
     ImageBits<ImageTraits> lockBits(LockType lockType, const gfx::Rect& bounds) {
+      if (lockType != ReadLock)
+        incrementVersion();
       return ImageBits<ImageTraits>(this, bounds);
     }
 
@@ -86,6 +131,12 @@ namespace doc {
     int m_width;
     int m_height;
     color_t m_maskColor;  // Skipped color in merge process.
+    uint32_t m_version;
+    mutable uint32_t m_hashVersion; // Version used to calculate m_hash
+    mutable uint64_t m_hash;
+    mutable uint32_t m_boundsVersion; // Version used to calculate m_visibleBounds/m_opaque
+    mutable gfx::Rect m_visibleBounds;
+    mutable bool m_opaque;
   };
 
 } // namespace doc
@@ -96,15 +147,32 @@ namespace doc {
 
 namespace doc {
 
-  inline int calculate_rowstride_bytes(PixelFormat pixelFormat, int pixels_per_row)
+  // Alignment (in bytes) of images created with the aligned layout.
+  const int kImageBaseAlignment = 64;
+  const int kImageRowAlignment = 16;
+
+  inline int calculate_rowstride_bytes(PixelFormat pixelFormat, int pixels_per_row,
+                                       bool aligned = false)
   {
+    int bytes = 0;
     switch (pixelFormat) {
-      case IMAGE_RGB:       return RgbTraits::getRowStrideBytes(pixels_per_row);
-      case IMAGE_GRAYSCALE: return GrayscaleTraits::getRowStrideBytes(pixels_per_row);
-      case IMAGE_INDEXED:   return IndexedTraits::getRowStrideBytes(pixels_per_row);
-      case IMAGE_BITMAP:    return BitmapTraits::getRowStrideBytes(pixels_per_row);
+      case IMAGE_RGB:       bytes = RgbTraits::getRowStrideBytes(pixels_per_row); break;
+      case IMAGE_GRAYSCALE: bytes = GrayscaleTraits::getRowStrideBytes(pixels_per_row); break;
+      case IMAGE_INDEXED:   bytes = IndexedTraits::getRowStrideBytes(pixels_per_row); break;
+      case IMAGE_BITMAP:    bytes = BitmapTraits::getRowStrideBytes(pixels_per_row); break;
     }
-    return 0;
+    if (aligned)
+      bytes = (bytes + kImageRowAlignment-1) & ~(kImageRowAlignment-1);
+    return bytes;
+  }
+
+  // Returns the number of bytes of the ImageBuffer used by an image
+  // of the given format and size (pixels and row pointers).
+  inline size_t calculate_image_buffer_size(PixelFormat pixelFormat, int width, int height,
+                                            bool aligned = false)
+  {
+    return (sizeof(uint8_t*) + calculate_rowstride_bytes(pixelFormat, width, aligned)) * height
+      + (aligned ? kImageBaseAlignment-1: 0);
   }
 
 } // namespace doc
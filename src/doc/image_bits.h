@@ -117,6 +117,16 @@ namespace doc {
       : m_bits(image->lockBits<ImageTraits>(Image::ReadLock, bounds)) {
     }
 
+    // Non-const images are locked for reading and writing (their
+    // version is incremented).
+    explicit LockImageBits(Image* image)
+      : m_bits(image->lockBits<ImageTraits>(Image::ReadWriteLock, image->bounds())) {
+    }
+
+    LockImageBits(Image* image, const gfx::Rect& bounds)
+      : m_bits(image->lockBits<ImageTraits>(Image::ReadWriteLock, bounds)) {
+    }
+
     LockImageBits(Image* image, Image::LockType lockType)
       : m_bits(image->lockBits<ImageTraits>(lockType, image->bounds())) {
     }
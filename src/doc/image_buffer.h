@@ -8,27 +8,47 @@
 #define DOC_IMAGE_BUFFER_H_INCLUDED
 #pragma once
 
+#include "base/disable_copying.h"
 #include "base/shared_ptr.h"
 
-#include <vector>
+#include <algorithm>
 
 namespace doc {
 
   class ImageBuffer {
   public:
-    ImageBuffer(size_t size = 1) : m_buffer(size) {
+    // Creates a buffer of "size" bytes. If "clear" is false the
+    // memory is left uninitialized (useful when the caller is going
+    // to overwrite all the pixels anyway).
+    ImageBuffer(size_t size = 1, bool clear = true)
+      : m_size(size)
+      , m_buffer(clear ? new uint8_t[size](): new uint8_t[size]) {
     }
 
-    size_t size() const { return m_buffer.size(); }
-    uint8_t* buffer() { return &m_buffer[0]; }
+    ~ImageBuffer() {
+      delete[] m_buffer;
+    }
+
+    size_t size() const { return m_size; }
+    uint8_t* buffer() { return m_buffer; }
 
     void resizeIfNecessary(size_t size) {
-      if (size > m_buffer.size())
-        m_buffer.resize(size);
+      if (size > m_size) {
+        uint8_t* newBuffer = new uint8_t[size];
+        std::copy(m_buffer, m_buffer+m_size, newBuffer);
+        std::fill(newBuffer+m_size, newBuffer+size, 0);
+
+        delete[] m_buffer;
+        m_buffer = newBuffer;
+        m_size = size;
+      }
     }
 
   private:
-    std::vector<uint8_t> m_buffer;
+    size_t m_size;
+    uint8_t* m_buffer;
+
+    DISABLE_COPYING(ImageBuffer);
   };
 
   typedef SharedPtr<ImageBuffer> ImageBufferPtr;
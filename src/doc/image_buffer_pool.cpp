@@ -0,0 +1,149 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_buffer_pool.h"
+
+#include "base/scoped_lock.h"
+
+namespace doc {
+
+// Deleter used in the ImageBufferPtrs given by the pool.
+class ImageBufferPool::ReturnToPool {
+public:
+  ReturnToPool(ImageBufferPool* pool) : m_pool(pool) { }
+
+  void operator()(ImageBuffer* buffer) {
+    m_pool->release(buffer);
+  }
+
+private:
+  ImageBufferPool* m_pool;
+};
+
+// Returns the smallest class that can hold "size" bytes.
+static int size_class_for_request(size_t size)
+{
+  int bits = ImageBufferPool::kMinSizeBits;
+  while (bits <= ImageBufferPool::kMaxSizeBits && (size_t(1) << bits) < size)
+    ++bits;
+  return bits;
+}
+
+// Returns the biggest class whose requests can be satisfied with a
+// buffer of "size" bytes.
+static int size_class_for_buffer(size_t size)
+{
+  int bits = 0;
+  while (bits < ImageBufferPool::kMaxSizeBits+1 && (size_t(1) << (bits+1)) <= size)
+    ++bits;
+  return bits;
+}
+
+ImageBufferPool::ImageBufferPool(size_t maxBytes)
+  : m_maxBytes(maxBytes)
+  , m_cachedBytes(0)
+{
+}
+
+ImageBufferPool::~ImageBufferPool()
+{
+  clear();
+}
+
+// static
+ImageBufferPool* ImageBufferPool::instance()
+{
+  static ImageBufferPool* pool = new ImageBufferPool;
+  return pool;
+}
+
+ImageBufferPtr ImageBufferPool::get(size_t size)
+{
+  int sizeClass = size_class_for_request(size);
+
+  // Too big to be pooled
+  if (sizeClass > kMaxSizeBits)
+    return ImageBufferPtr(new ImageBuffer(size, false));
+
+  ImageBuffer* buffer = NULL;
+  {
+    base::scoped_lock lock(m_mutex);
+    std::vector<ImageBuffer*>& buffers = m_classes[sizeClass];
+    if (!buffers.empty()) {
+      buffer = buffers.back();
+      buffers.pop_back();
+      m_cachedBytes -= buffer->size();
+    }
+  }
+
+  if (!buffer)
+    buffer = new ImageBuffer(size_t(1) << sizeClass, false);
+
+  return ImageBufferPtr(buffer, ReturnToPool(this));
+}
+
+size_t ImageBufferPool::maxBytes() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_maxBytes;
+}
+
+void ImageBufferPool::setMaxBytes(size_t maxBytes)
+{
+  base::scoped_lock lock(m_mutex);
+  m_maxBytes = maxBytes;
+  trim(maxBytes);
+}
+
+size_t ImageBufferPool::cachedBytes() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_cachedBytes;
+}
+
+void ImageBufferPool::clear()
+{
+  base::scoped_lock lock(m_mutex);
+  trim(0);
+}
+
+void ImageBufferPool::release(ImageBuffer* buffer)
+{
+  // The buffer could be bigger than its original class if it was
+  // resized by its user.
+  int sizeClass = size_class_for_buffer(buffer->size());
+
+  if (sizeClass <= kMaxSizeBits) {
+    base::scoped_lock lock(m_mutex);
+    if (m_cachedBytes + buffer->size() <= m_maxBytes) {
+      m_classes[sizeClass].push_back(buffer);
+      m_cachedBytes += buffer->size();
+      return;
+    }
+  }
+
+  delete buffer;
+}
+
+// Frees unused buffers (the biggest ones first) until the cached
+// bytes are less or equal than "maxBytes". The mutex must be locked.
+void ImageBufferPool::trim(size_t maxBytes)
+{
+  for (int i=kMaxSizeBits; i>=0 && m_cachedBytes > maxBytes; --i) {
+    std::vector<ImageBuffer*>& buffers = m_classes[i];
+    while (!buffers.empty() && m_cachedBytes > maxBytes) {
+      m_cachedBytes -= buffers.back()->size();
+      delete buffers.back();
+      buffers.pop_back();
+    }
+  }
+}
+
+} // namespace doc
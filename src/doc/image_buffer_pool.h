@@ -0,0 +1,71 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_IMAGE_BUFFER_POOL_H_INCLUDED
+#define DOC_IMAGE_BUFFER_POOL_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "doc/image_buffer.h"
+
+#include <vector>
+
+namespace doc {
+
+  // A thread-safe pool of ImageBuffers grouped in power-of-two size
+  // classes. Buffers returned by get() are not zero-initialized, and
+  // they go back to the pool automatically when the last
+  // ImageBufferPtr that references them is released. The pool keeps
+  // at most maxBytes() bytes of unused buffers, the rest are freed.
+  //
+  // The pool must outlive all the buffers that it gives.
+  class ImageBufferPool {
+  public:
+    enum {
+      kMinSizeBits = 8,         // Smallest class: 256 bytes
+      kMaxSizeBits = 30,        // Biggest class: 1 GB
+    };
+
+    static const size_t kDefaultMaxBytes = 64*1024*1024;
+
+    ImageBufferPool(size_t maxBytes = kDefaultMaxBytes);
+    ~ImageBufferPool();
+
+    // Returns the process-wide pool. It is never destroyed, so
+    // buffers released from static objects at exit are safe.
+    static ImageBufferPool* instance();
+
+    // Returns a buffer with at least "size" bytes. Its content is
+    // undefined.
+    ImageBufferPtr get(size_t size);
+
+    size_t maxBytes() const;
+    void setMaxBytes(size_t maxBytes);
+
+    // Number of bytes of unused buffers kept in the pool.
+    size_t cachedBytes() const;
+
+    // Frees all unused buffers.
+    void clear();
+
+  private:
+    class ReturnToPool;
+
+    void release(ImageBuffer* buffer);
+    void trim(size_t maxBytes);
+
+    mutable base::mutex m_mutex;
+    std::vector<ImageBuffer*> m_classes[kMaxSizeBits+1];
+    size_t m_maxBytes;
+    size_t m_cachedBytes;
+
+    DISABLE_COPYING(ImageBufferPool);
+  };
+
+} // namespace doc
+
+#endif
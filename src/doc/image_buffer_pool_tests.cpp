@@ -0,0 +1,99 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/image_buffer_pool.h"
+#include "doc/primitives.h"
+
+using namespace base;
+using namespace doc;
+
+TEST(ImageBufferPool, PowerOfTwoClasses)
+{
+  ImageBufferPool pool;
+
+  EXPECT_EQ(256, pool.get(1)->size());
+  EXPECT_EQ(256, pool.get(256)->size());
+  EXPECT_EQ(512, pool.get(257)->size());
+  EXPECT_EQ(4096, pool.get(4000)->size());
+}
+
+TEST(ImageBufferPool, ReuseReleasedBuffers)
+{
+  ImageBufferPool pool;
+  uint8_t* ptr;
+  {
+    ImageBufferPtr a = pool.get(1000);
+    ptr = a->buffer();
+    EXPECT_EQ(0, pool.cachedBytes());
+  }
+  EXPECT_EQ(1024, pool.cachedBytes());
+
+  // A request of the same class gives the same buffer
+  ImageBufferPtr b = pool.get(600);
+  EXPECT_EQ(ptr, b->buffer());
+  EXPECT_EQ(0, pool.cachedBytes());
+
+  // A different class needs a new buffer
+  ImageBufferPtr c = pool.get(2000);
+  EXPECT_NE(ptr, c->buffer());
+}
+
+TEST(ImageBufferPool, MaxBytes)
+{
+  ImageBufferPool pool(2048);
+  {
+    ImageBufferPtr a = pool.get(1024);
+    ImageBufferPtr b = pool.get(1024);
+    ImageBufferPtr c = pool.get(1024);
+  }
+  EXPECT_EQ(2048, pool.cachedBytes());
+
+  pool.setMaxBytes(1024);
+  EXPECT_EQ(1024, pool.cachedBytes());
+
+  pool.clear();
+  EXPECT_EQ(0, pool.cachedBytes());
+}
+
+TEST(ImageBufferPool, ResizedBufferGoesToBiggerClass)
+{
+  ImageBufferPool pool;
+  {
+    ImageBufferPtr a = pool.get(256);
+    a->resizeIfNecessary(3000);
+  }
+  EXPECT_EQ(3000, pool.cachedBytes());
+
+  // 3000 bytes can satisfy a 2048 bytes request
+  ImageBufferPtr b = pool.get(2048);
+  EXPECT_EQ(3000, b->size());
+}
+
+TEST(ImageBufferPool, CreateImage)
+{
+  UniquePtr<Image> image(Image::createFromPool(IMAGE_RGB, 32, 16));
+  EXPECT_EQ(32, image->width());
+  EXPECT_EQ(16, image->height());
+
+  clear_image(image, rgba(255, 0, 0, 255));
+  put_pixel(image, 31, 15, rgba(0, 0, 255, 255));
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(image, 0, 0));
+  EXPECT_EQ(rgba(0, 0, 255, 255), get_pixel(image, 31, 15));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -25,6 +25,7 @@ namespace doc {
     ImageBufferPtr m_buffer;
     address_t m_bits;
     address_t* m_rows;
+    int m_rowStride;
 
     inline address_t getBitsAddress() {
       return m_bits;
@@ -49,30 +50,43 @@ namespace doc {
       return (address_t)(m_rows[y] + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte));
     }
 
+    using Image::getRowStrideSize;
+
     ImageImpl(int width, int height,
-              const ImageBufferPtr& buffer)
+              const ImageBufferPtr& buffer,
+              bool aligned = false)
       : Image(static_cast<PixelFormat>(Traits::pixel_format), width, height)
       , m_buffer(buffer)
     {
+      PixelFormat format = static_cast<PixelFormat>(Traits::pixel_format);
       size_t for_rows = sizeof(address_t) * height;
-      size_t rowstride_bytes = Traits::getRowStrideBytes(width);
-      size_t required_size = for_rows + rowstride_bytes*height;
+      size_t required_size = calculate_image_buffer_size(format, width, height, aligned);
+
+      m_rowStride = calculate_rowstride_bytes(format, width, aligned);
 
       if (!m_buffer)
         m_buffer.reset(new ImageBuffer(required_size));
       else
         m_buffer->resizeIfNecessary(required_size);
 
+      uint8_t* bits = m_buffer->buffer() + for_rows;
+      if (aligned)
+        bits = (uint8_t*)((uintptr_t(bits) + kImageBaseAlignment-1) & ~uintptr_t(kImageBaseAlignment-1));
+
       m_rows = (address_t*)m_buffer->buffer();
-      m_bits = (address_t)(m_buffer->buffer() + for_rows);
+      m_bits = (address_t)bits;
 
       address_t addr = m_bits;
       for (int y=0; y<height; ++y) {
         m_rows[y] = addr;
-        addr = (address_t)(((uint8_t*)addr) + rowstride_bytes);
+        addr = (address_t)(((uint8_t*)addr) + m_rowStride);
       }
     }
 
+    int getRowStrideSize() const override {
+      return m_rowStride;
+    }
+
     uint8_t* getPixelAddress(int x, int y) const override {
       ASSERT(x >= 0 && x < width());
       ASSERT(y >= 0 && y < height());
@@ -92,6 +106,7 @@ namespace doc {
       ASSERT(y >= 0 && y < height());
 
       *address(x, y) = color;
+      incrementVersion();
     }
 
     void clear(color_t color) override {
@@ -112,6 +127,8 @@ namespace doc {
       if (!clip_rects(src, dst_x, dst_y, src_x, src_y, w, h))
         return;
 
+      incrementVersion();
+
       // Copy process
       bytes = Traits::getRowStrideBytes(w);
 
@@ -124,12 +141,9 @@ namespace doc {
     }
 
     void merge(const Image* _src, int dst_x, int dst_y, int src_x, int src_y, int w, int h, int opacity, int blend_mode) override {
-      BLEND_COLOR blender = Traits::get_blender(blend_mode);
       const ImageImpl<Traits>* src = (const ImageImpl<Traits>*)_src;
       ImageImpl<Traits>* dst = this;
-      address_t src_address;
-      address_t dst_address;
-      uint32_t mask_color = src->maskColor();
+      typename Traits::pixel_t mask_color = src->maskColor();
 
       // nothing to do
       if (!opacity)
@@ -138,19 +152,29 @@ namespace doc {
       if (!clip_rects(src, dst_x, dst_y, src_x, src_y, w, h))
         return;
 
-      // Merge process
-      int end_x = dst_x+w;
-      for (int end_y=dst_y+h; dst_y<end_y; ++dst_y, ++src_y) {
-        src_address = src->address(src_x, src_y);
-        dst_address = dst->address(dst_x, dst_y);
+      incrementVersion();
+
+      // An opaque image replaces the destination pixels. The source
+      // is scanned only if the whole image is merged (or it was
+      // already scanned), as the scan costs as much as the merge.
+      if (blend_mode == BLEND_MODE_NORMAL && opacity == 255 &&
+          ((w == src->width() && h == src->height()) ||
+           src->isVisibleBoundsValid()) &&
+          src->isOpaque()) {
+        int bytes = Traits::getRowStrideBytes(w);
+        for (int end_y=dst_y+h; dst_y<end_y; ++dst_y, ++src_y)
+          memcpy(dst->address(dst_x, dst_y), src->address(src_x, src_y), bytes);
+        return;
+      }
 
-        for (int x=dst_x; x<end_x; ++x) {
-          if (*src_address != mask_color)
-            *dst_address = (*blender)(*dst_address, *src_address, opacity);
+      // Merge process (row by row), the blender is selected only once
+      typename Traits::row_blender_t blend_row =
+        Traits::get_row_blender(blend_mode, opacity);
 
-          ++dst_address;
-          ++src_address;
-        }
+      for (int end_y=dst_y+h; dst_y<end_y; ++dst_y, ++src_y) {
+        (*blend_row)(dst->address(dst_x, dst_y),
+                     src->address(src_x, src_y),
+                     w, opacity, mask_color);
       }
     }
 
@@ -234,13 +258,14 @@ namespace doc {
 
   template<>
   inline void ImageImpl<IndexedTraits>::clear(color_t color) {
-    memset(m_bits, color, width()*height());
+    memset(m_bits, color, m_rowStride*height());
+    incrementVersion();
   }
 
   template<>
   inline void ImageImpl<BitmapTraits>::clear(color_t color) {
-    memset(m_bits, (color ? 0xff: 0x00),
-           BitmapTraits::getRowStrideBytes(width()) * height());
+    memset(m_bits, (color ? 0xff: 0x00), m_rowStride*height());
+    incrementVersion();
   }
 
   template<>
@@ -262,6 +287,7 @@ namespace doc {
       (*(m_rows[y] + d.quot)) |= (1 << d.rem);
     else
       (*(m_rows[y] + d.quot)) &= ~(1 << d.rem);
+    incrementVersion();
   }
 
   template<>
@@ -269,6 +295,8 @@ namespace doc {
     address_t addr;
     int x, y;
 
+    incrementVersion();
+
     for (y=y1; y<=y2; ++y) {
       addr = (address_t)getPixelAddress(x1, y);
       for (x=x1; x<=x2; ++x) {
@@ -283,6 +311,8 @@ namespace doc {
     if (!clip_rects(src, dst_x, dst_y, src_x, src_y, w, h))
       return;
 
+    incrementVersion();
+
     address_t src_address;
     address_t dst_address;
 
@@ -326,6 +356,8 @@ namespace doc {
     if (!clip_rects(src, dst_x, dst_y, src_x, src_y, w, h))
       return;
 
+    incrementVersion();
+
     // Copy process
     ImageConstIterator<BitmapTraits> src_it(src, gfx::Rect(src_x, src_y, w, h), src_x, src_y);
     ImageIterator<BitmapTraits> dst_it(this, gfx::Rect(dst_x, dst_y, w, h), dst_x, dst_y);
@@ -346,6 +378,8 @@ namespace doc {
     if (!clip_rects(src, dst_x, dst_y, src_x, src_y, w, h))
       return;
 
+    incrementVersion();
+
     // Merge process
     ImageConstIterator<BitmapTraits> src_it(src, gfx::Rect(src_x, src_y, w, h), src_x, src_y);
     ImageIterator<BitmapTraits> dst_it(this, gfx::Rect(dst_x, dst_y, w, h), dst_x, dst_y);
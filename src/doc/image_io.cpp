@@ -40,7 +40,7 @@ void write_image(std::ostream& os, Image* image)
   write16(os, image->height());        // Height
   write32(os, image->maskColor());     // Mask color
 
-  int size = image->getRowStrideSize();
+  int size = image->getRowStrideSize(image->width());
   for (int c=0; c<image->height(); c++)
     os.write((char*)image->getPixelAddress(0, c), size);
 }
@@ -53,7 +53,7 @@ Image* read_image(std::istream& is)
   uint32_t maskColor = read32(is);      // Mask color
 
   base::UniquePtr<Image> image(Image::create(static_cast<PixelFormat>(pixelFormat), width, height));
-  int size = image->getRowStrideSize();
+  int size = image->getRowStrideSize(image->width());
 
   for (int c=0; c<image->height(); c++)
     is.read((char*)image->getPixelAddress(0, c), size);
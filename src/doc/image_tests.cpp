@@ -14,6 +14,7 @@
 #include "doc/image.h"
 #include "doc/image_bits.h"
 #include "doc/primitives.h"
+#include "gfx/rect_io.h"
 
 using namespace base;
 using namespace doc;
@@ -179,6 +180,199 @@ TYPED_TEST(ImageAllTypes, DrawHLine)
   }
 }
 
+TYPED_TEST(ImageAllTypes, AlignedLayout)
+{
+  typedef TypeParam ImageTraits;
+  const color_t maxValue = ImageTraits::max_value;
+
+  for (int w=1; w<40; w+=3) {
+    int h = 5;
+    UniquePtr<Image> aligned(Image::createAligned(ImageTraits::pixel_format, w, h));
+    UniquePtr<Image> packed(Image::create(ImageTraits::pixel_format, w, h));
+
+    EXPECT_EQ(packed->getRowStrideSize(w), packed->getRowStrideSize());
+    EXPECT_EQ(packed->getRowStrideSize(w), aligned->getRowStrideSize(w));
+    EXPECT_EQ(0, aligned->getRowStrideSize() % kImageRowAlignment);
+    EXPECT_LE(aligned->getRowStrideSize(w), aligned->getRowStrideSize());
+
+    for (int y=0; y<h; ++y) {
+      EXPECT_EQ(0, (uintptr_t(aligned->getPixelAddress(0, y)) - uintptr_t(aligned->getPixelAddress(0, 0)))
+                   % kImageRowAlignment);
+    }
+    EXPECT_EQ(0, uintptr_t(aligned->getPixelAddress(0, 0)) % kImageBaseAlignment);
+
+    aligned->clear(maxValue);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        put_pixel(packed, x, y, (x+y) % 2);
+
+    aligned->copy(packed, 0, 1, 0, 1, w, h-1);
+    for (int x=0; x<w; ++x)
+      EXPECT_EQ(maxValue, get_pixel(aligned, x, 0));
+    for (int y=1; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        EXPECT_EQ(get_pixel(packed, x, y), get_pixel(aligned, x, y));
+  }
+}
+
+TEST(Image, VersionAndContentHash)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 5, 3));
+  UniquePtr<Image> b(Image::create(IMAGE_RGB, 5, 3));
+  clear_image(a, rgba(0, 0, 0, 0));
+  clear_image(b, rgba(0, 0, 0, 0));
+
+  EXPECT_FALSE(a->isContentHashValid());
+  uint64_t hash = a->contentHash();
+  EXPECT_TRUE(a->isContentHashValid());
+  EXPECT_EQ(hash, b->contentHash());
+  EXPECT_TRUE(is_same_image(a, b));
+
+  uint32_t version = a->version();
+  put_pixel(a, 4, 2, rgba(255, 0, 0, 255));
+  EXPECT_LT(version, a->version());
+  EXPECT_FALSE(a->isContentHashValid());
+  EXPECT_NE(hash, a->contentHash());
+  EXPECT_FALSE(is_same_image(a, b));
+
+  version = b->version();
+  b->copy(a, 0, 0, 0, 0, 5, 3);
+  EXPECT_LT(version, b->version());
+  EXPECT_EQ(a->contentHash(), b->contentHash());
+  EXPECT_TRUE(is_same_image(a, b));
+
+  // Writing through LockImageBits invalidates the hash
+  hash = b->contentHash();
+  {
+    LockImageBits<RgbTraits> bits(b.get());
+    *bits.begin() = rgba(0, 255, 0, 255);
+  }
+  EXPECT_FALSE(b->isContentHashValid());
+  EXPECT_NE(hash, b->contentHash());
+
+  // Reading from a const image doesn't change the version
+  version = b->version();
+  {
+    const Image* c = b.get();
+    const LockImageBits<RgbTraits> bits(c);
+    EXPECT_EQ(rgba(0, 255, 0, 255), *bits.begin());
+  }
+  EXPECT_EQ(version, b->version());
+
+  // Different sizes give different hashes
+  UniquePtr<Image> d(Image::create(IMAGE_RGB, 3, 5));
+  clear_image(d, rgba(0, 0, 0, 0));
+  UniquePtr<Image> e(Image::create(IMAGE_RGB, 5, 3));
+  clear_image(e, rgba(0, 0, 0, 0));
+  EXPECT_NE(d->contentHash(), e->contentHash());
+
+  // Padding of aligned images is not included in the hash
+  UniquePtr<Image> f(Image::createAligned(IMAGE_RGB, 5, 3));
+  clear_image(f, rgba(0, 0, 0, 0));
+  EXPECT_EQ(e->contentHash(), f->contentHash());
+}
+
+TEST(Image, VisibleBoundsAndOpaque)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 8, 6));
+  clear_image(a, rgba(0, 0, 0, 0));
+  EXPECT_TRUE(a->visibleBounds().isEmpty());
+  EXPECT_FALSE(a->isOpaque());
+
+  // Transparent pixels with other RGB values are not visible
+  put_pixel(a, 1, 1, rgba(255, 0, 0, 0));
+  EXPECT_TRUE(a->visibleBounds().isEmpty());
+
+  put_pixel(a, 2, 1, rgba(255, 0, 0, 128));
+  put_pixel(a, 5, 4, rgba(0, 255, 0, 255));
+  EXPECT_EQ(gfx::Rect(2, 1, 4, 4), a->visibleBounds());
+  EXPECT_FALSE(a->isOpaque());
+
+  clear_image(a, rgba(0, 0, 255, 255));
+  EXPECT_EQ(a->bounds(), a->visibleBounds());
+  EXPECT_TRUE(a->isOpaque());
+
+  put_pixel(a, 7, 5, rgba(0, 0, 255, 254));
+  EXPECT_EQ(a->bounds(), a->visibleBounds());
+  EXPECT_FALSE(a->isOpaque());
+
+  // Indexed images use the mask color only
+  UniquePtr<Image> b(Image::create(IMAGE_INDEXED, 8, 6));
+  b->setMaskColor(3);
+  clear_image(b, 3);
+  put_pixel(b, 0, 5, 0);
+  put_pixel(b, 6, 2, 1);
+  EXPECT_EQ(gfx::Rect(0, 2, 7, 4), b->visibleBounds());
+  EXPECT_FALSE(b->isOpaque());
+
+  clear_image(b, 0);
+  EXPECT_TRUE(b->isOpaque());
+}
+
+TEST(Image, VisibleBoundsAfterMaskColorChange)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_INDEXED, 8, 6));
+  a->setMaskColor(0);
+  clear_image(a, 0);
+  put_pixel(a, 2, 3, 1);
+  EXPECT_EQ(gfx::Rect(2, 3, 1, 1), a->visibleBounds());
+  EXPECT_FALSE(a->isOpaque());
+
+  uint32_t version = a->version();
+  a->setMaskColor(1);
+  EXPECT_NE(version, a->version());
+  EXPECT_EQ(a->bounds(), a->visibleBounds());
+  EXPECT_FALSE(a->isOpaque());
+
+  a->setMaskColor(2);
+  EXPECT_EQ(a->bounds(), a->visibleBounds());
+  EXPECT_TRUE(a->isOpaque());
+
+  // The same mask color doesn't modify the image
+  version = a->version();
+  a->setMaskColor(2);
+  EXPECT_EQ(version, a->version());
+}
+
+TEST(Image, MergeOpaqueImage)
+{
+  UniquePtr<Image> dst(Image::create(IMAGE_RGB, 6, 4));
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, 3, 3));
+  clear_image(dst, rgba(0, 0, 255, 128));
+  clear_image(src, rgba(255, 0, 0, 255));
+  put_pixel(src, 1, 1, rgba(0, 255, 0, 255));
+  EXPECT_TRUE(src->isOpaque());
+
+  dst->merge(src, 2, 2, 0, 0, 3, 3, 255, BLEND_MODE_NORMAL);
+  EXPECT_EQ(rgba(0, 0, 255, 128), get_pixel(dst, 1, 2));
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(dst, 2, 2));
+  EXPECT_EQ(rgba(0, 255, 0, 255), get_pixel(dst, 3, 3));
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(dst, 4, 3));
+
+  // With less opacity the pixels are blended
+  dst->merge(src, 0, 0, 0, 0, 3, 3, 128, BLEND_MODE_NORMAL);
+  EXPECT_EQ(rgba_blend_normal(rgba(0, 0, 255, 128), rgba(255, 0, 0, 255), 128),
+            get_pixel(dst, 0, 0));
+}
+
+TEST(Image, VisibleBoundsValid)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 8, 6));
+  clear_image(a, rgba(0, 0, 0, 0));
+  EXPECT_FALSE(a->isVisibleBoundsValid());
+  EXPECT_TRUE(a->visibleBounds().isEmpty());
+  EXPECT_TRUE(a->isVisibleBoundsValid());
+
+  put_pixel(a, 3, 2, rgba(0, 0, 0, 255));
+  EXPECT_FALSE(a->isVisibleBoundsValid());
+
+  // Merging a part of an image doesn't scan its pixels
+  UniquePtr<Image> b(Image::create(IMAGE_RGB, 8, 6));
+  b->merge(a, 0, 0, 0, 0, 4, 4, 255, BLEND_MODE_NORMAL);
+  EXPECT_FALSE(a->isVisibleBoundsValid());
+  EXPECT_EQ(gfx::Rect(3, 2, 1, 1), a->visibleBounds());
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
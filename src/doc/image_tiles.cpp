@@ -0,0 +1,164 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_tiles.h"
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "gfx/point.h"
+
+#include <cstring>
+
+namespace doc {
+
+class ImageTiles::Tile {
+public:
+  Tile(int rowStride, int height)
+    : m_rowStride(rowStride)
+    , m_data(rowStride*height) {
+  }
+
+  int rowStride() const { return m_rowStride; }
+  size_t size() const { return m_data.size(); }
+  uint8_t* row(int y) { return &m_data[y*m_rowStride]; }
+  const uint8_t* row(int y) const { return &m_data[y*m_rowStride]; }
+
+private:
+  int m_rowStride;
+  std::vector<uint8_t> m_data;
+};
+
+template<typename ImageTraits>
+static bool is_transparent_area(const Image* image, const gfx::Rect& bounds)
+{
+  typedef typename ImageTraits::const_address_t const_address_t;
+  typename ImageTraits::pixel_t mask = image->maskColor();
+
+  for (int y=bounds.y; y<bounds.y+bounds.h; ++y) {
+    const_address_t it = (const_address_t)image->getPixelAddress(bounds.x, y);
+    for (int x=0; x<bounds.w; ++x, ++it)
+      if (*it != mask)
+        return false;
+  }
+  return true;
+}
+
+static bool is_transparent_area(const Image* image, const gfx::Rect& bounds)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:       return is_transparent_area<RgbTraits>(image, bounds);
+    case IMAGE_GRAYSCALE: return is_transparent_area<GrayscaleTraits>(image, bounds);
+    case IMAGE_INDEXED:   return is_transparent_area<IndexedTraits>(image, bounds);
+    default:
+      // Bitmap tiles are always stored
+      return false;
+  }
+}
+
+ImageTiles::ImageTiles()
+  : m_format(IMAGE_RGB)
+  , m_width(0)
+  , m_height(0)
+  , m_maskColor(0)
+  , m_cols(0)
+{
+}
+
+ImageTiles::ImageTiles(const Image* image)
+  : m_format(image->pixelFormat())
+  , m_width(image->width())
+  , m_height(image->height())
+  , m_maskColor(image->maskColor())
+  , m_cols((m_width+TileSize-1) / TileSize)
+  , m_tiles(m_cols * ((m_height+TileSize-1) / TileSize))
+{
+  for (int i=0; i<tilesCount(); ++i)
+    m_tiles[i] = captureTile(image, tileBounds(i));
+}
+
+int ImageTiles::storedTilesCount() const
+{
+  int count = 0;
+  for (const auto& tile : m_tiles)
+    if (tile)
+      ++count;
+  return count;
+}
+
+size_t ImageTiles::getMemSize() const
+{
+  size_t size = sizeof(*this) + sizeof(TilePtr)*m_tiles.size();
+  for (const auto& tile : m_tiles)
+    if (tile)
+      size += sizeof(Tile) + tile->size();
+  return size;
+}
+
+void ImageTiles::restore(Image* image) const
+{
+  ASSERT(image->pixelFormat() == m_format);
+  ASSERT(image->width() == m_width);
+  ASSERT(image->height() == m_height);
+
+  image->setMaskColor(m_maskColor);
+
+  for (int i=0; i<tilesCount(); ++i) {
+    gfx::Rect bounds = tileBounds(i);
+    const TilePtr& tile = m_tiles[i];
+
+    if (tile) {
+      int bytes = image->getRowStrideSize(bounds.w);
+      for (int y=0; y<bounds.h; ++y)
+        std::memcpy(image->getPixelAddress(bounds.x, bounds.y+y),
+                    tile->row(y), bytes);
+    }
+    else {
+      image->fillRect(bounds.x, bounds.y,
+                      bounds.x+bounds.w-1, bounds.y+bounds.h-1,
+                      m_maskColor);
+    }
+  }
+
+  image->incrementVersion();
+}
+
+Image* ImageTiles::createImage() const
+{
+  base::UniquePtr<Image> image(Image::create(m_format, m_width, m_height));
+  restore(image);
+  return image.release();
+}
+
+gfx::Rect ImageTiles::tileBounds(int tileIndex) const
+{
+  gfx::Rect bounds((tileIndex % m_cols) * TileSize,
+                   (tileIndex / m_cols) * TileSize,
+                   TileSize, TileSize);
+  return bounds.createIntersect(gfx::Rect(0, 0, m_width, m_height));
+}
+
+ImageTiles::TilePtr ImageTiles::captureTile(const Image* image, const gfx::Rect& bounds) const
+{
+  if (is_transparent_area(image, bounds))
+    return TilePtr();
+
+  // As TileSize is a multiple of 8, tiles of bitmap images always
+  // start in the first bit of a byte.
+  int bytes = image->getRowStrideSize(bounds.w);
+  TilePtr tile(new Tile(bytes, bounds.h));
+
+  for (int y=0; y<bounds.h; ++y)
+    std::memcpy(tile->row(y),
+                image->getPixelAddress(bounds.x, bounds.y+y), bytes);
+
+  return tile;
+}
+
+} // namespace doc
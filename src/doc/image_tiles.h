@@ -0,0 +1,71 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_IMAGE_TILES_H_INCLUDED
+#define DOC_IMAGE_TILES_H_INCLUDED
+#pragma once
+
+#include "base/shared_ptr.h"
+#include "doc/color.h"
+#include "doc/pixel_format.h"
+#include "gfx/rect.h"
+
+#include <vector>
+
+namespace doc {
+
+  class Image;
+
+  // Snapshot of the pixels of an image divided in fixed-size tiles
+  // (e.g. to keep a removed image in the undo history). Fully
+  // transparent tiles (all pixels equal to the mask color) are not
+  // stored at all, so mostly transparent images use little memory.
+  // Tiles are immutable and reference counted, copies of an
+  // ImageTiles share them.
+  class ImageTiles {
+  public:
+    enum { TileSize = 64 };
+
+    ImageTiles();
+    explicit ImageTiles(const Image* image);
+
+    PixelFormat pixelFormat() const { return m_format; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    color_t maskColor() const { return m_maskColor; }
+
+    // Returns the total number of tiles and the number of tiles with
+    // pixels (the ones that are not fully transparent).
+    int tilesCount() const { return int(m_tiles.size()); }
+    int storedTilesCount() const;
+
+    // Approximate amount of memory used by the tiles. Tiles shared
+    // with other ImageTiles are counted too.
+    size_t getMemSize() const;
+
+    // Copies all pixels to "image" (which must have the same format
+    // and size), or creates a new image with them.
+    void restore(Image* image) const;
+    Image* createImage() const;
+
+  private:
+    class Tile;
+    typedef SharedPtr<Tile> TilePtr;
+
+    gfx::Rect tileBounds(int tileIndex) const;
+    TilePtr captureTile(const Image* image, const gfx::Rect& bounds) const;
+
+    PixelFormat m_format;
+    int m_width;
+    int m_height;
+    color_t m_maskColor;
+    int m_cols;
+    std::vector<TilePtr> m_tiles;
+  };
+
+} // namespace doc
+
+#endif
@@ -0,0 +1,70 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/image_tiles.h"
+#include "doc/primitives.h"
+
+using namespace base;
+using namespace doc;
+
+static void expect_equal_images(const Image* a, const Image* b)
+{
+  ASSERT_EQ(a->width(), b->width());
+  ASSERT_EQ(a->height(), b->height());
+  for (int y=0; y<a->height(); ++y)
+    for (int x=0; x<a->width(); ++x)
+      ASSERT_EQ(get_pixel(a, x, y), get_pixel(b, x, y)) << "x=" << x << " y=" << y;
+}
+
+TEST(ImageTiles, TransparentTilesAreNotStored)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_RGB, 200, 130));
+  clear_image(image, 0);
+  put_pixel(image, 70, 70, rgba(255, 0, 0, 255));
+  put_pixel(image, 199, 129, rgba(0, 255, 0, 255));
+
+  ImageTiles tiles(image);
+  EXPECT_EQ(4*3, tiles.tilesCount());
+  EXPECT_EQ(2, tiles.storedTilesCount());
+
+  UniquePtr<Image> copy(tiles.createImage());
+  expect_equal_images(image, copy);
+}
+
+TEST(ImageTiles, RestoreAllFormats)
+{
+  for (int format=IMAGE_RGB; format<=IMAGE_BITMAP; ++format) {
+    UniquePtr<Image> image(Image::create(PixelFormat(format), 150, 100));
+    for (int y=0; y<image->height(); ++y)
+      for (int x=0; x<image->width(); ++x)
+        put_pixel(image, x, y, (x+y) & 1);
+
+    ImageTiles tiles(image);
+    UniquePtr<Image> copy(tiles.createImage());
+    expect_equal_images(image, copy);
+
+    // Restore the pixels in the modified image
+    fill_rect(image, 10, 10, 20, 20, 0);
+    tiles.restore(image);
+    for (int y=10; y<=20; ++y)
+      for (int x=10; x<=20; ++x)
+        EXPECT_EQ((x+y) & 1, int(get_pixel(image, x, y)));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -40,6 +40,19 @@ namespace doc {
       ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
       return rgba_blenders[blend_mode];
     }
+
+    static inline void blend_row(address_t dst, const_address_t src, int n,
+                                 int opacity, int blend_mode, pixel_t mask_color)
+    {
+      rgba_blend_row(dst, src, n, opacity, blend_mode, mask_color);
+    }
+
+    typedef BLEND_ROW_RGBA row_blender_t;
+
+    static inline row_blender_t get_row_blender(int blend_mode, int opacity)
+    {
+      return get_rgba_row_blender(blend_mode, opacity);
+    }
   };
 
   struct GrayscaleTraits {
@@ -70,6 +83,19 @@ namespace doc {
       ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
       return graya_blenders[blend_mode];
     }
+
+    static inline void blend_row(address_t dst, const_address_t src, int n,
+                                 int opacity, int blend_mode, pixel_t mask_color)
+    {
+      graya_blend_row(dst, src, n, opacity, blend_mode, mask_color);
+    }
+
+    typedef BLEND_ROW_GRAYA row_blender_t;
+
+    static inline row_blender_t get_row_blender(int blend_mode, int opacity)
+    {
+      return get_graya_row_blender(blend_mode, opacity);
+    }
   };
 
   struct IndexedTraits {
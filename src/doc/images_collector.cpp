@@ -71,6 +71,10 @@ void ImagesCollector::collectFromLayer(Layer* layer, FrameNumber frame)
 
 void ImagesCollector::collectImage(Layer* layer, Cel* cel)
 {
+  // Linked cels share the same image, it's collected just once
+  if (!m_imageIndexes.insert(cel->imageIndex()).second)
+    return;
+
   m_items.push_back(Item(layer, cel, cel->image()));
 }
 
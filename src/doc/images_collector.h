@@ -11,6 +11,7 @@
 #include "doc/frame_number.h"
 
 #include <list>
+#include <set>
 
 namespace doc {
 
@@ -65,6 +66,7 @@ namespace doc {
     void collectImage(Layer* layer, Cel* cel);
 
     Items m_items;
+    std::set<int> m_imageIndexes;
     bool m_allFrames;
     bool m_forEdit;
   };
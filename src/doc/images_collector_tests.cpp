@@ -0,0 +1,52 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/images_collector.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+#include "doc/stock.h"
+
+using namespace base;
+using namespace doc;
+
+TEST(ImagesCollector, LinkedCels)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_RGB, 4, 4, 256));
+  sprite->setTotalFrames(FrameNumber(3));
+  LayerImage* layer = new LayerImage(sprite);
+  sprite->folder()->addLayer(layer);
+
+  // Frames 0 and 1 are linked to the same image
+  int shared = sprite->stock()->addImage(Image::create(IMAGE_RGB, 4, 4));
+  int other = sprite->stock()->addImage(Image::create(IMAGE_RGB, 4, 4));
+  layer->addCel(new Cel(FrameNumber(0), shared));
+  layer->addCel(new Cel(FrameNumber(1), shared));
+  layer->addCel(new Cel(FrameNumber(2), other));
+
+  // Each image is collected just once
+  ImagesCollector all(layer, FrameNumber(0), true, false);
+  ASSERT_EQ(2, all.size());
+  EXPECT_EQ(sprite->stock()->getImage(shared), all.begin()->image());
+  EXPECT_EQ(sprite->stock()->getImage(other), (++all.begin())->image());
+
+  ImagesCollector one(layer, FrameNumber(1), false, false);
+  EXPECT_EQ(1, one.size());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -18,6 +18,7 @@
 #include "doc/stock.h"
 
 #include <algorithm>
+#include <set>
 #include <string.h>
 
 namespace doc {
@@ -94,13 +95,17 @@ int LayerImage::getMemSize() const
   int size = sizeof(LayerImage);
   CelConstIterator it = getCelBegin();
   CelConstIterator end = getCelEnd();
+  std::set<int> images;
 
   for (; it != end; ++it) {
     const Cel* cel = *it;
     size += cel->getMemSize();
 
-    const Image* image = cel->image();
-    size += image->getMemSize();
+    // Linked cels share the same image, so it's counted just once.
+    if (images.insert(cel->imageIndex()).second) {
+      const Image* image = cel->image();
+      size += image->getMemSize();
+    }
   }
 
   return size;
@@ -115,13 +120,16 @@ void LayerImage::destroyAllCels()
     Cel* cel = *it;
     Image* image = cel->image();
 
-    ASSERT(image != NULL);
-
-    sprite()->stock()->removeImage(image);
-    delete image;
+    // The image can be NULL if it was shared with a previous cel
+    // (linked cels) and it was already removed from the stock.
+    if (image) {
+      sprite()->stock()->removeImage(image);
+      delete image;
+    }
     delete cel;
   }
   m_cels.clear();
+  m_celsByFrame.clear();
 }
 
 void LayerImage::getCels(CelList& cels) const
@@ -133,6 +141,16 @@ void LayerImage::getCels(CelList& cels) const
     cels.push_back(*it);
 }
 
+void LayerImage::getCels(FrameNumber first, FrameNumber last, CelList& cels) const
+{
+  int end = std::min(int(last)+1, int(m_celsByFrame.size()));
+
+  for (int frame=std::max(0, int(first)); frame<end; ++frame) {
+    if (m_celsByFrame[frame])
+      cels.push_back(m_celsByFrame[frame]);
+  }
+}
+
 Cel* LayerImage::getLastCel() const
 {
   if (!m_cels.empty())
@@ -143,16 +161,22 @@ Cel* LayerImage::getLastCel() const
 
 void LayerImage::addCel(Cel *cel)
 {
-  CelIterator it = getCelBegin();
-  CelIterator end = getCelEnd();
+  // Fast path to append cels (e.g. when a file is loaded)
+  if (m_cels.empty() || m_cels.back()->frame() <= cel->frame())
+    m_cels.push_back(cel);
+  else {
+    CelIterator it = getCelBegin();
+    CelIterator end = getCelEnd();
+
+    for (; it != end; ++it) {
+      if ((*it)->frame() > cel->frame())
+        break;
+    }
 
-  for (; it != end; ++it) {
-    if ((*it)->frame() > cel->frame())
-      break;
+    m_cels.insert(it, cel);
   }
 
-  m_cels.insert(it, cel);
-
+  indexCel(cel);
   cel->setParentLayer(this);
 }
 
@@ -169,6 +193,7 @@ void LayerImage::removeCel(Cel *cel)
   ASSERT(it != m_cels.end());
 
   m_cels.erase(it);
+  unindexCel(cel);
 }
 
 void LayerImage::moveCel(Cel* cel, FrameNumber frame)
@@ -180,16 +205,10 @@ void LayerImage::moveCel(Cel* cel, FrameNumber frame)
 
 const Cel* LayerImage::getCel(FrameNumber frame) const
 {
-  CelConstIterator it = getCelBegin();
-  CelConstIterator end = getCelEnd();
-
-  for (; it != end; ++it) {
-    const Cel* cel = *it;
-    if (cel->frame() == frame)
-      return cel;
-  }
-
-  return NULL;
+  if (frame >= 0 && frame < int(m_celsByFrame.size()))
+    return m_celsByFrame[frame];
+  else
+    return NULL;
 }
 
 Cel* LayerImage::getCel(FrameNumber frame)
@@ -197,6 +216,44 @@ Cel* LayerImage::getCel(FrameNumber frame)
   return const_cast<Cel*>(static_cast<const LayerImage*>(this)->getCel(frame));
 }
 
+void LayerImage::indexCel(Cel* cel)
+{
+  int frame = cel->frame();
+  ASSERT(frame >= 0);
+  if (frame < 0)
+    return;
+
+  if (frame >= int(m_celsByFrame.size()))
+    m_celsByFrame.resize(frame+1, NULL);
+
+  // Only one cel by frame is expected, but if there is another one
+  // in the same frame we keep the first one in the list (to get the
+  // same result of a linear search).
+  if (!m_celsByFrame[frame])
+    m_celsByFrame[frame] = cel;
+}
+
+void LayerImage::unindexCel(Cel* cel)
+{
+  int frame = cel->frame();
+  if (frame < 0 || frame >= int(m_celsByFrame.size()) ||
+      m_celsByFrame[frame] != cel)
+    return;
+
+  m_celsByFrame[frame] = NULL;
+
+  // Look for other cel in the same frame
+  for (CelIterator it=getCelBegin(), end=getCelEnd(); it != end; ++it) {
+    if ((*it)->frame() == frame) {
+      m_celsByFrame[frame] = *it;
+      break;
+    }
+  }
+
+  while (!m_celsByFrame.empty() && !m_celsByFrame.back())
+    m_celsByFrame.pop_back();
+}
+
 /**
  * Configures some properties of the specified layer to make it as the
  * "Background" of the sprite.
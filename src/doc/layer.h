@@ -15,6 +15,7 @@
 #include "doc/object.h"
 
 #include <string>
+#include <vector>
 
 namespace doc {
 
@@ -119,6 +120,9 @@ namespace doc {
     void getCels(CelList& cels) const override;
     Cel* getLastCel() const;
 
+    // Adds to "cels" the cels in the [first, last] frame range.
+    void getCels(FrameNumber first, FrameNumber last, CelList& cels) const;
+
     void configureAsBackground();
 
     CelIterator getCelBegin() { return m_cels.begin(); }
@@ -129,8 +133,14 @@ namespace doc {
 
   private:
     void destroyAllCels();
+    void indexCel(Cel* cel);
+    void unindexCel(Cel* cel);
 
     CelList m_cels;   // List of all cels inside this layer used by frames.
+
+    // Cels indexed by frame (NULL for frames without cel) to get them
+    // in O(1) from getCel().
+    std::vector<Cel*> m_celsByFrame;
   };
 
   //////////////////////////////////////////////////////////////////////
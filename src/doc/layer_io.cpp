@@ -18,6 +18,7 @@
 #include "doc/stock.h"
 
 #include <iostream>
+#include <set>
 #include <vector>
 
 namespace doc {
@@ -46,15 +47,23 @@ void write_layer(std::ostream& os, LayerSubObjectsSerializer* subObjects, Layer*
 
       CelIterator it = static_cast<LayerImage*>(layer)->getCelBegin();
       CelIterator end = static_cast<LayerImage*>(layer)->getCelEnd();
+      std::set<int> images;
 
       for (; it != end; ++it) {
         Cel* cel = *it;
         subObjects->write_cel(os, cel);
 
-        Image* image = cel->image();
-        ASSERT(image != NULL);
+        // Linked cels share the same image, so it is written only
+        // with the first cel that references it.
+        bool hasImage = images.insert(cel->imageIndex()).second;
+        write8(os, hasImage ? 1: 0);                 // Has image flag
 
-        subObjects->write_image(os, image);
+        if (hasImage) {
+          Image* image = cel->image();
+          ASSERT(image != NULL);
+
+          subObjects->write_image(os, image);
+        }
       }
       break;
     }
@@ -105,10 +114,12 @@ Layer* read_layer(std::istream& is, LayerSubObjectsSerializer* subObjects, Sprit
         // Add the cel in the layer
         static_cast<LayerImage*>(layer.get())->addCel(cel);
 
-        // Read the cel's image
-        Image* image = subObjects->read_image(is);
+        // Read the cel's image (if it isn't shared with a previous cel)
+        if (read8(is)) {
+          Image* image = subObjects->read_image(is);
 
-        sprite->stock()->replaceImage(cel->imageIndex(), image);
+          sprite->stock()->replaceImage(cel->imageIndex(), image);
+        }
       }
       break;
     }
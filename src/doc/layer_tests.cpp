@@ -0,0 +1,89 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/cel.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+
+using namespace base;
+using namespace doc;
+
+TEST(LayerImage, GetCelByFrame)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_RGB, 4, 4, 256));
+  LayerImage* layer = new LayerImage(sprite);
+  sprite->folder()->addLayer(layer);
+
+  Cel* cel3 = new Cel(FrameNumber(3), 0);
+  Cel* cel1 = new Cel(FrameNumber(1), 0);
+  Cel* cel7 = new Cel(FrameNumber(7), 0);
+  layer->addCel(cel3);
+  layer->addCel(cel1);
+  layer->addCel(cel7);
+
+  EXPECT_EQ(3, layer->getCelsCount());
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(0)));
+  EXPECT_EQ(cel1, layer->getCel(FrameNumber(1)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(2)));
+  EXPECT_EQ(cel3, layer->getCel(FrameNumber(3)));
+  EXPECT_EQ(cel7, layer->getCel(FrameNumber(7)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(8)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(-1)));
+
+  // Cels are sorted by frame
+  CelIterator it = layer->getCelBegin();
+  EXPECT_EQ(cel1, *it++);
+  EXPECT_EQ(cel3, *it++);
+  EXPECT_EQ(cel7, *it++);
+  EXPECT_EQ(cel7, layer->getLastCel());
+
+  layer->moveCel(cel7, FrameNumber(2));
+  EXPECT_EQ(cel7, layer->getCel(FrameNumber(2)));
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(7)));
+  EXPECT_EQ(cel3, layer->getLastCel());
+
+  layer->removeCel(cel1);
+  delete cel1;
+  EXPECT_EQ(NULL, layer->getCel(FrameNumber(1)));
+  EXPECT_EQ(2, layer->getCelsCount());
+}
+
+TEST(LayerImage, GetCelsInFrameRange)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_RGB, 4, 4, 256));
+  LayerImage* layer = new LayerImage(sprite);
+  sprite->folder()->addLayer(layer);
+
+  for (int frame=0; frame<10; frame += 2)
+    layer->addCel(new Cel(FrameNumber(frame), 0));
+
+  CelList cels;
+  layer->getCels(FrameNumber(3), FrameNumber(6), cels);
+  ASSERT_EQ(2, cels.size());
+  EXPECT_EQ(4, cels.front()->frame());
+  EXPECT_EQ(6, cels.back()->frame());
+
+  cels.clear();
+  layer->getCels(FrameNumber(-5), FrameNumber(100), cels);
+  EXPECT_EQ(5, cels.size());
+
+  cels.clear();
+  layer->getCels(FrameNumber(9), FrameNumber(9), cels);
+  EXPECT_EQ(0, cels.size());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
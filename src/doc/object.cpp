@@ -10,9 +10,13 @@
 
 #include "doc/object.h"
 
+#include <atomic>
+
 namespace doc {
 
-static ObjectId newId = 0;
+// Objects (e.g. images) can be created from several threads at the
+// same time, and each one must get a different ID.
+static std::atomic<ObjectId> newId(0);
 
 Object::Object(ObjectType type)
   : m_type(type)
@@ -331,4 +331,21 @@ int count_diff_between_images(const Image* i1, const Image* i2)
   return -1;
 }
 
+bool is_same_image(const Image* i1, const Image* i2)
+{
+  if (i1 == i2)
+    return true;
+
+  if ((i1->pixelFormat() != i2->pixelFormat()) ||
+      (i1->width() != i2->width()) ||
+      (i1->height() != i2->height()))
+    return false;
+
+  if (i1->contentHash() != i2->contentHash())
+    return false;
+
+  // Same hash, we have to compare pixels to be sure
+  return (count_diff_between_images(i1, i2) == 0);
+}
+
 } // namespace doc
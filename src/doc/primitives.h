@@ -41,6 +41,11 @@ namespace doc {
 
   int count_diff_between_images(const Image* i1, const Image* i2);
 
+  // Returns true if both images have the same format, size and
+  // pixels. Content hashes are compared first, so different images
+  // with valid hashes are discarded in O(1).
+  bool is_same_image(const Image* i1, const Image* i2);
+
 } // namespace doc
 
 #endif
@@ -28,6 +28,7 @@ namespace doc {
     ASSERT(y >= 0 && y < image->height());
 
     *(((ImageImpl<Traits>*)image)->address(x, y)) = color;
+    image->incrementVersion();
   }
 
   //////////////////////////////////////////////////////////////////////
@@ -50,6 +51,7 @@ namespace doc {
       *image->getPixelAddress(x, y) |= (1 << (x % 8));
     else
       *image->getPixelAddress(x, y) &= ~(1 << (x % 8));
+    image->incrementVersion();
   }
 
 } // namespace doc
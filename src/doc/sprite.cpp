@@ -18,6 +18,7 @@
 #include "doc/doc.h"
 
 #include <cstring>
+#include <set>
 #include <vector>
 
 namespace doc {
@@ -176,9 +177,10 @@ void Sprite::setTransparentColor(color_t color)
 {
   m_transparentColor = color;
 
-  // Change the mask color of all images.
+  // Change the mask color of all images (lazy images take the new
+  // color when they are loaded).
   for (int i=0; i<m_stock->size(); i++) {
-    Image* image = m_stock->getImage(i);
+    Image* image = m_stock->getLoadedImage(i);
     if (image != NULL)
       image->setMaskColor(color);
   }
@@ -189,7 +191,7 @@ int Sprite::getMemSize() const
   int size = 0;
 
   for (int i=0; i<m_stock->size(); i++) {
-    Image* image = m_stock->getImage(i);
+    Image* image = m_stock->getLoadedImage(i);
     if (image != NULL)
       size += image->getRowStrideSize() * image->height();
   }
@@ -436,12 +438,17 @@ void Sprite::remapImages(FrameNumber frameFrom, FrameNumber frameTo, const std::
   CelList cels;
   getCels(cels);
 
+  // Images shared by several cels (linked cels) must be remapped
+  // just once.
+  std::set<int> remapped;
+
   for (CelIterator it = cels.begin(); it != cels.end(); ++it) {
     Cel* cel = *it;
 
     // Remap this Cel because is inside the specified range
     if (cel->frame() >= frameFrom &&
-        cel->frame() <= frameTo) {
+        cel->frame() <= frameTo &&
+        remapped.insert(cel->imageIndex()).second) {
       Image* image = cel->image();
       LockImageBits<IndexedTraits> bits(image);
       LockImageBits<IndexedTraits>::iterator
@@ -10,27 +10,42 @@
 
 #include "doc/stock.h"
 
+#include "base/parallel_for.h"
+#include "base/scoped_lock.h"
 #include "doc/image.h"
 #include "doc/sprite.h"
 
+#include <algorithm>
 #include <cstring>
 
 namespace doc {
 
+static size_t image_bytes(const Image* image)
+{
+  return image->getRowStrideSize() * image->height();
+}
+
 Stock::Stock(Sprite* sprite, PixelFormat format)
   : Object(ObjectType::Stock)
   , m_format(format)
   , m_sprite(sprite)
+  , m_loadedBytes(0)
+  , m_loadErrors(false)
+  , m_tick(0)
+  , m_lastUnloadTick(0)
+  , m_maxLoadedBytes(kDefaultMaxLoadedBytes)
 {
   // Image with index=0 is always NULL.
   m_image.push_back(NULL);
+  m_lazy.push_back(LazyImage());
 }
 
 Stock::~Stock()
 {
+  // Lazy images that are not loaded are NULL
   for (int i=0; i<size(); ++i) {
-    if (getImage(i))
-      delete getImage(i);
+    if (m_image[i])
+      delete m_image[i];
   }
 }
 
@@ -43,14 +58,84 @@ Image* Stock::getImage(int index) const
 {
   ASSERT((index >= 0) && (index < size()));
 
+  for (;;) {
+    SharedPtr<StockLoader> loader;
+    {
+      base::scoped_lock lock(m_mutex);
+      LazyImage& lazy = m_lazy[index];
+      if (!lazy.lazy || !m_loader || m_image[index]) {
+        if (lazy.lazy)
+          lazy.lastUse = ++m_tick;
+        return m_image[index];
+      }
+      loader = m_loader;
+    }
+
+    // The image is loaded without locking the mutex, so other images
+    // can be used (or loaded) by other threads in the meantime. The
+    // reference to the loader keeps it alive if it's replaced, and
+    // it's released with the mutex locked (references to the loader
+    // are not thread-safe).
+    Image* image = NULL;
+    try {
+      image = loader->loadImage(index);
+      fixupImage(image);
+    }
+    catch (...) {
+      base::scoped_lock lock(m_mutex);
+      loader.reset();
+      throw;
+    }
+
+    base::scoped_lock lock(m_mutex);
+
+    // If the loader was replaced in the meantime (e.g. because its
+    // file is being overwritten), its errors are ignored and the
+    // image is loaded again with the new loader.
+    if (loader->failed() && loader.get() != m_loader.get()) {
+      delete image;
+      loader.reset();
+      continue;
+    }
+
+    if (loader->failed())
+      m_loadErrors = true;
+    loader.reset();
+
+    // Other thread could load the same image in the meantime (or the
+    // image could be replaced), in that case our image is not needed.
+    LazyImage& lazy = m_lazy[index];
+    if (m_image[index] || !lazy.lazy) {
+      delete image;
+    }
+    else {
+      m_image[index] = image;
+      m_loadedBytes += image_bytes(image);
+      lazy.version = image->version();
+    }
+
+    if (lazy.lazy)
+      lazy.lastUse = ++m_tick;
+    return m_image[index];
+  }
+}
+
+Image* Stock::getLoadedImage(int index) const
+{
+  ASSERT((index >= 0) && (index < size()));
+
+  base::scoped_lock lock(m_mutex);
   return m_image[index];
 }
 
 int Stock::addImage(Image* image)
 {
+  base::scoped_lock lock(m_mutex);
+
   int i = m_image.size();
   try {
     m_image.resize(m_image.size()+1);
+    m_lazy.resize(m_image.size());
   }
   catch (...) {
     delete image;
@@ -62,10 +147,27 @@ int Stock::addImage(Image* image)
   return i;
 }
 
+int Stock::addLazyImage()
+{
+  base::scoped_lock lock(m_mutex);
+
+  int i = m_image.size();
+  m_image.resize(m_image.size()+1);
+  m_lazy.resize(m_image.size());
+  m_lazy[i].lazy = true;
+  return i;
+}
+
 void Stock::removeImage(Image* image)
 {
+  base::scoped_lock lock(m_mutex);
+
   for (int i=0; i<size(); i++)
     if (m_image[i] == image) {
+      if (m_lazy[i].lazy) {
+        m_lazy[i].lazy = false;
+        m_loadedBytes -= image_bytes(image);
+      }
       m_image[i] = NULL;
       return;
     }
@@ -76,12 +178,179 @@ void Stock::removeImage(Image* image)
 void Stock::replaceImage(int index, Image* image)
 {
   ASSERT((index > 0) && (index < size()));
+
+  base::scoped_lock lock(m_mutex);
+
+  // The new image is not a lazy one (it cannot be unloaded)
+  if (m_lazy[index].lazy) {
+    m_lazy[index].lazy = false;
+    if (m_image[index])
+      m_loadedBytes -= image_bytes(m_image[index]);
+  }
   m_image[index] = image;
 
   fixupImage(image);
 }
 
-void Stock::fixupImage(Image* image)
+void Stock::setLoader(StockLoader* loader)
+{
+  base::scoped_lock lock(m_mutex);
+  m_loader.reset(loader);
+}
+
+StockLoader* Stock::loader() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_loader.get();
+}
+
+bool Stock::hasLoader() const
+{
+  base::scoped_lock lock(m_mutex);
+  return (m_loader != NULL);
+}
+
+bool Stock::isUnmodifiedLazyImage(int index) const
+{
+  ASSERT((index >= 0) && (index < size()));
+
+  base::scoped_lock lock(m_mutex);
+  const LazyImage& lazy = m_lazy[index];
+  return (lazy.lazy &&
+          (!m_image[index] || lazy.version == m_image[index]->version()));
+}
+
+void Stock::setLazyImage(int index)
+{
+  ASSERT((index > 0) && (index < size()));
+
+  base::scoped_lock lock(m_mutex);
+  ASSERT(m_loader);
+
+  LazyImage& lazy = m_lazy[index];
+  Image* image = m_image[index];
+  if (image) {
+    if (!lazy.lazy)
+      m_loadedBytes += image_bytes(image);
+    lazy.version = image->version();
+  }
+  lazy.lazy = true;
+  lazy.lastUse = m_tick;
+}
+
+void Stock::loadAllImages()
+{
+  std::vector<int> indexes;
+  SharedPtr<StockLoader> loader;
+  {
+    base::scoped_lock lock(m_mutex);
+    if (!m_loader)
+      return;
+
+    for (int i=0; i<size(); ++i)
+      if (m_lazy[i].lazy && !m_image[i])
+        indexes.push_back(i);
+
+    loader = m_loader;
+  }
+
+  // Images are loaded without locking the mutex, so each one can be
+  // loaded in a different thread.
+  std::vector<Image*> images(indexes.size(), (Image*)NULL);
+  try {
+    base::parallel_for(0, int(indexes.size()),
+      [&](int i) {
+        images[i] = loader->loadImage(indexes[i]);
+      });
+  }
+  catch (...) {
+    for (Image* image : images)
+      delete image;
+
+    base::scoped_lock lock(m_mutex);
+    loader.reset();
+    throw;
+  }
+
+  base::scoped_lock lock(m_mutex);
+  if (loader->failed())
+    m_loadErrors = true;
+  loader.reset();
+  for (size_t i=0; i<indexes.size(); ++i) {
+    int index = indexes[i];
+
+    // The image could be loaded by other thread in the meantime
+    if (m_image[index] || !m_lazy[index].lazy) {
+      delete images[i];
+      continue;
+    }
+
+    fixupImage(images[i]);
+    m_image[index] = images[i];
+  }
+
+  // Now all images are regular images
+  for (int i=0; i<size(); ++i)
+    m_lazy[i] = LazyImage();
+  m_loadedBytes = 0;
+  m_loader.reset(NULL);
+}
+
+size_t Stock::maxLoadedBytes() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_maxLoadedBytes;
+}
+
+void Stock::setMaxLoadedBytes(size_t maxBytes)
+{
+  base::scoped_lock lock(m_mutex);
+  m_maxLoadedBytes = maxBytes;
+}
+
+size_t Stock::loadedBytes() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_loadedBytes;
+}
+
+bool Stock::hasLoadErrors() const
+{
+  base::scoped_lock lock(m_mutex);
+  return m_loadErrors;
+}
+
+void Stock::unloadOldImages(const StockImageRefs* refs)
+{
+  base::scoped_lock lock(m_mutex);
+  uint64_t lastUnloadTick = m_lastUnloadTick;
+  m_lastUnloadTick = m_tick;
+
+  if (!m_loader || m_loadedBytes <= m_maxLoadedBytes)
+    return;
+
+  // Unmodified images that weren't used since the last call, the
+  // least recently used first.
+  std::vector<std::pair<uint64_t, int> > candidates;
+  for (int i=0; i<size(); ++i) {
+    const LazyImage& lazy = m_lazy[i];
+    if (lazy.lazy && m_image[i] &&
+        lazy.version == m_image[i]->version() &&
+        lazy.lastUse <= lastUnloadTick &&
+        (!refs || !refs->isImageReferenced(m_image[i])))
+      candidates.push_back(std::make_pair(lazy.lastUse, i));
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  for (size_t i=0; i<candidates.size() && m_loadedBytes > m_maxLoadedBytes; ++i) {
+    int index = candidates[i].second;
+    m_loadedBytes -= image_bytes(m_image[index]);
+    delete m_image[index];
+    m_image[index] = NULL;
+  }
+}
+
+void Stock::fixupImage(Image* image) const
 {
   // Change the mask color of the added image to the sprite mask color.
   if (image)
@@ -9,9 +9,12 @@
 #pragma once
 
 #include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/shared_ptr.h"
 #include "doc/object.h"
 #include "doc/pixel_format.h"
 
+#include <atomic>
 #include <vector>
 
 namespace doc {
@@ -21,8 +24,41 @@ namespace doc {
 
   typedef std::vector<Image*> ImagesList;
 
+  // Loads the images of a stock when they are used for the first time
+  // (e.g. from the file where the sprite was saved). loadImage() can
+  // be called from several threads at the same time.
+  class StockLoader {
+  public:
+    StockLoader() : m_failed(false) { }
+    virtual ~StockLoader() { }
+
+    // If the image cannot be loaded (e.g. the file was modified by
+    // other program), it returns an empty image and failed() returns
+    // true from that moment.
+    virtual Image* loadImage(int index) = 0;
+
+    bool failed() const { return m_failed; }
+
+  protected:
+    void setFailed() { m_failed = true; }
+
+  private:
+    std::atomic<bool> m_failed;
+  };
+
+  // Tells to Stock::unloadOldImages() which images are referenced
+  // from outside the stock (e.g. from the undo history), so they
+  // cannot be deleted.
+  class StockImageRefs {
+  public:
+    virtual ~StockImageRefs() { }
+    virtual bool isImageReferenced(const Image* image) const = 0;
+  };
+
   class Stock : public Object {
   public:
+    static const size_t kDefaultMaxLoadedBytes = 512*1024*1024;
+
     Stock(Sprite* sprite, PixelFormat format);
     virtual ~Stock();
 
@@ -33,14 +69,23 @@ namespace doc {
       return m_image.size();
     }
 
-    // Returns the image in the "index" position
+    // Returns the image in the "index" position. If it's a lazy image
+    // which is not in memory, it's loaded with the stock loader.
     Image* getImage(int index) const;
 
+    // Returns the image in the "index" position only if it's in
+    // memory, lazy images are not loaded.
+    Image* getLoadedImage(int index) const;
+
     // Adds a new image in the stock resizing the images-array. Returns
     // the index/position in the stock (this index can be used with the
     // Stock::getImage() function).
     int addImage(Image* image);
 
+    // Adds a lazy image, an image that is loaded with the stock loader
+    // when getImage() is called for the first time. Returns its index.
+    int addLazyImage();
+
     // Removes a image from the stock, it doesn't resize the stock.
     void removeImage(Image* image);
 
@@ -54,13 +99,77 @@ namespace doc {
     //
     void replaceImage(int index, Image* image);
 
+    // The stock owns the loader and deletes it when it's not needed.
+    // If the loader is replaced, the new one must be able to load the
+    // same lazy images (images that the old loader fails to load
+    // while it's replaced are loaded again with the new one).
+    void setLoader(StockLoader* loader);
+    StockLoader* loader() const;
+    bool hasLoader() const;
+
+    // Returns true if it's a lazy image which wasn't modified since
+    // it was loaded (or it's not in memory).
+    bool isUnmodifiedLazyImage(int index) const;
+
+    // Converts the given image in an unmodified lazy image, which can
+    // be loaded again with the current loader (e.g. after saving it in
+    // the file of the loader).
+    void setLazyImage(int index);
+
+    // Loads all lazy images (in parallel) and deletes the loader, so
+    // the images don't depend on the loader anymore (e.g. before
+    // overwriting the file from where they are loaded).
+    void loadAllImages();
+
+    // Lazy images are unloaded when they use more than maxLoadedBytes().
+    size_t maxLoadedBytes() const;
+    void setMaxLoadedBytes(size_t maxBytes);
+
+    // Bytes used by the lazy images that are in memory.
+    size_t loadedBytes() const;
+
+    // Returns true if some lazy image couldn't be loaded, so the stock
+    // contains empty images instead of the original ones (and they
+    // shouldn't be saved).
+    bool hasLoadErrors() const;
+
+    // Unloads the least recently used lazy images until they use less
+    // than maxLoadedBytes(). Only unmodified images that weren't used
+    // since the last call are unloaded, and images referenced by
+    // "refs" (if it's not NULL) are never unloaded, because other
+    // objects keep pointers to them. It must be called when no other
+    // thread is using images of the stock (e.g. when a write lock of
+    // the document is released).
+    void unloadOldImages(const StockImageRefs* refs);
+
   private:
-    void fixupImage(Image* image);
+    struct LazyImage {
+      bool lazy;                // The image can be loaded by m_loader
+      uint32_t version;         // Image version after it was loaded
+      uint64_t lastUse;
+
+      LazyImage() : lazy(false), version(0), lastUse(0) { }
+    };
+
+    void fixupImage(Image* image) const;
 
     PixelFormat m_format; // Type of images (all images in the stock must be of this type).
-    ImagesList m_image;   // The images-array where the images are.
+    mutable ImagesList m_image; // The images-array where the images are.
     Sprite* m_sprite;
 
+    // Fields for lazy images. They (and m_image) are mutable because
+    // images are loaded in getImage(), and they are guarded by
+    // m_mutex. The loader is shared with the threads that are loading
+    // images, so it can be replaced while they use it.
+    SharedPtr<StockLoader> m_loader;
+    mutable std::vector<LazyImage> m_lazy;
+    mutable size_t m_loadedBytes;
+    mutable bool m_loadErrors;
+    mutable uint64_t m_tick;
+    uint64_t m_lastUnloadTick;
+    size_t m_maxLoadedBytes;
+    mutable base::mutex m_mutex;
+
     Stock();
     DISABLE_COPYING(Stock);
   };
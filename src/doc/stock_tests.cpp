@@ -0,0 +1,286 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/primitives.h"
+#include "doc/sprite.h"
+#include "doc/stock.h"
+
+#include <atomic>
+
+using namespace base;
+using namespace doc;
+
+// Creates 16x16 images filled with the index as the color.
+class TestLoader : public StockLoader {
+public:
+  TestLoader(int* loads) : m_loads(loads) { }
+
+  Image* loadImage(int index) override {
+    ++(*m_loads);
+    Image* image = Image::create(IMAGE_INDEXED, 16, 16);
+    clear_image(image, index);
+    return image;
+  }
+
+private:
+  int* m_loads;
+};
+
+TEST(Stock, LoadLazyImages)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+  int loads = 0;
+  stock->setLoader(new TestLoader(&loads));
+
+  int a = stock->addLazyImage();
+  int b = stock->addLazyImage();
+  EXPECT_EQ(NULL, stock->getLoadedImage(a));
+  EXPECT_EQ(0, loads);
+
+  Image* image = stock->getImage(a);
+  ASSERT_TRUE(image != NULL);
+  EXPECT_EQ(a, get_pixel(image, 0, 0));
+  EXPECT_EQ(image, stock->getImage(a));
+  EXPECT_EQ(image, stock->getLoadedImage(a));
+  EXPECT_EQ(NULL, stock->getLoadedImage(b));
+  EXPECT_EQ(1, loads);
+  EXPECT_EQ(256, stock->loadedBytes());
+
+  stock->loadAllImages();
+  EXPECT_FALSE(stock->hasLoader());
+  EXPECT_EQ(2, loads);
+  EXPECT_EQ(image, stock->getImage(a));
+  EXPECT_EQ(b, get_pixel(stock->getImage(b), 0, 0));
+  EXPECT_EQ(0, stock->loadedBytes());
+}
+
+TEST(Stock, UnloadOldImages)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+  int loads = 0;
+  stock->setLoader(new TestLoader(&loads));
+  stock->setMaxLoadedBytes(512);
+
+  int index[4];
+  for (int i=0; i<4; ++i)
+    index[i] = stock->addLazyImage();
+
+  stock->getImage(index[0]);
+  stock->getImage(index[1]);
+  stock->getImage(index[2]);
+  put_pixel(stock->getImage(index[3]), 0, 0, 100);
+  EXPECT_EQ(4*256, stock->loadedBytes());
+
+  // All images were used since the last call
+  stock->unloadOldImages(NULL);
+  EXPECT_EQ(4*256, stock->loadedBytes());
+
+  // The modified image and the used one are kept
+  stock->getImage(index[0]);
+  stock->unloadOldImages(NULL);
+  EXPECT_EQ(2*256, stock->loadedBytes());
+  EXPECT_TRUE(stock->getLoadedImage(index[0]) != NULL);
+  EXPECT_EQ(NULL, stock->getLoadedImage(index[1]));
+  EXPECT_EQ(NULL, stock->getLoadedImage(index[2]));
+  EXPECT_EQ(100, get_pixel(stock->getLoadedImage(index[3]), 0, 0));
+
+  // Unloaded images are loaded again
+  EXPECT_EQ(index[1], get_pixel(stock->getImage(index[1]), 0, 0));
+  EXPECT_EQ(5, loads);
+}
+
+class TestImageRefs : public StockImageRefs {
+public:
+  TestImageRefs(const Image* image) : m_image(image) { }
+
+  bool isImageReferenced(const Image* image) const override {
+    return (image == m_image);
+  }
+
+private:
+  const Image* m_image;
+};
+
+TEST(Stock, DontUnloadReferencedImages)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+  int loads = 0;
+  stock->setLoader(new TestLoader(&loads));
+  stock->setMaxLoadedBytes(0);
+
+  int a = stock->addLazyImage();
+  int b = stock->addLazyImage();
+  Image* imageA = stock->getImage(a);
+  stock->getImage(b);
+
+  TestImageRefs refs(imageA);
+  stock->unloadOldImages(&refs);
+  stock->unloadOldImages(&refs);
+  EXPECT_EQ(imageA, stock->getLoadedImage(a));
+  EXPECT_EQ(NULL, stock->getLoadedImage(b));
+  EXPECT_EQ(256, stock->loadedBytes());
+}
+
+TEST(Stock, UnmodifiedLazyImages)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+  int loads = 0;
+  stock->setLoader(new TestLoader(&loads));
+
+  int a = stock->addLazyImage();
+  int b = stock->addImage(Image::create(IMAGE_INDEXED, 16, 16));
+  EXPECT_TRUE(stock->isUnmodifiedLazyImage(a));
+  EXPECT_FALSE(stock->isUnmodifiedLazyImage(b));
+
+  put_pixel(stock->getImage(a), 0, 0, 100);
+  EXPECT_FALSE(stock->isUnmodifiedLazyImage(a));
+  EXPECT_EQ(256, stock->loadedBytes());
+
+  // Images are unmodified again after saving them
+  stock->setLazyImage(a);
+  stock->setLazyImage(b);
+  EXPECT_TRUE(stock->isUnmodifiedLazyImage(a));
+  EXPECT_TRUE(stock->isUnmodifiedLazyImage(b));
+  EXPECT_EQ(2*256, stock->loadedBytes());
+  EXPECT_EQ(1, loads);
+}
+
+// Same as TestLoader but it can be used from several threads.
+class ThreadSafeTestLoader : public StockLoader {
+public:
+  ThreadSafeTestLoader(std::atomic<int>* loads) : m_loads(loads) { }
+
+  Image* loadImage(int index) override {
+    ++(*m_loads);
+    Image* image = Image::create(IMAGE_INDEXED, 16, 16);
+    clear_image(image, index);
+    return image;
+  }
+
+private:
+  std::atomic<int>* m_loads;
+};
+
+TEST(Stock, LoadFromSeveralThreads)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+  std::atomic<int> loads(0);
+  stock->setLoader(new ThreadSafeTestLoader(&loads));
+
+  int index[4];
+  for (int i=0; i<4; ++i)
+    index[i] = stock->addLazyImage();
+
+  // Threads that load the same image at the same time get the same
+  // image (the other loaded copies are discarded).
+  std::vector<Image*> images(64, (Image*)NULL);
+  parallel_for(0, int(images.size()),
+    [&](int i) {
+      images[i] = stock->getImage(index[i % 4]);
+    }, 8);
+
+  for (int i=0; i<int(images.size()); ++i) {
+    EXPECT_EQ(stock->getLoadedImage(index[i % 4]), images[i]);
+    EXPECT_EQ(index[i % 4], get_pixel(images[i], 0, 0));
+  }
+  EXPECT_LE(4, loads.load());
+  EXPECT_EQ(4*256, stock->loadedBytes());
+}
+
+// Returns an empty image for the given index.
+class FailingTestLoader : public StockLoader {
+public:
+  FailingTestLoader(int failIndex) : m_failIndex(failIndex) { }
+
+  Image* loadImage(int index) override {
+    Image* image = Image::create(IMAGE_INDEXED, 16, 16);
+    if (index == m_failIndex) {
+      clear_image(image, 0);
+      setFailed();
+    }
+    else
+      clear_image(image, index);
+    return image;
+  }
+
+private:
+  int m_failIndex;
+};
+
+TEST(Stock, LoadErrors)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+
+  int a = stock->addLazyImage();
+  int b = stock->addLazyImage();
+  stock->setLoader(new FailingTestLoader(b));
+
+  EXPECT_EQ(a, get_pixel(stock->getImage(a), 0, 0));
+  EXPECT_FALSE(stock->hasLoadErrors());
+
+  EXPECT_EQ(0, get_pixel(stock->getImage(b), 0, 0));
+  EXPECT_TRUE(stock->hasLoadErrors());
+
+  // The error is remembered when the loader is deleted
+  stock->loadAllImages();
+  EXPECT_FALSE(stock->hasLoader());
+  EXPECT_TRUE(stock->hasLoadErrors());
+}
+
+// Replaces itself with a TestLoader in the middle of a load (e.g. as
+// if its file were overwritten) and fails.
+class ReplacedTestLoader : public StockLoader {
+public:
+  ReplacedTestLoader(Stock* stock, int* loads) : m_stock(stock), m_loads(loads) { }
+
+  Image* loadImage(int index) override {
+    m_stock->setLoader(new TestLoader(m_loads));
+
+    Image* image = Image::create(IMAGE_INDEXED, 16, 16);
+    clear_image(image, 0);
+    setFailed();
+    return image;
+  }
+
+private:
+  Stock* m_stock;
+  int* m_loads;
+};
+
+TEST(Stock, IgnoreErrorsOfReplacedLoader)
+{
+  UniquePtr<Sprite> sprite(new Sprite(IMAGE_INDEXED, 16, 16, 256));
+  Stock* stock = sprite->stock();
+  int loads = 0;
+
+  int a = stock->addLazyImage();
+  stock->setLoader(new ReplacedTestLoader(stock, &loads));
+
+  EXPECT_EQ(a, get_pixel(stock->getImage(a), 0, 0));
+  EXPECT_EQ(1, loads);
+  EXPECT_FALSE(stock->hasLoadErrors());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
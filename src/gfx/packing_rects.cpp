@@ -10,19 +10,22 @@
 
 #include "gfx/packing_rects.h"
 
-#include "gfx/region.h"
 #include "gfx/size.h"
 
+#include <algorithm>
+
 namespace gfx {
 
 void PackingRects::add(const Size& sz)
 {
   m_rects.push_back(Rect(sz));
+  m_rotated.push_back(false);
 }
 
 void PackingRects::add(const Rect& rc)
 {
   m_rects.push_back(rc);
+  m_rotated.push_back(false);
 }
 
 Size PackingRects::bestFit()
@@ -58,38 +61,140 @@ Size PackingRects::bestFit()
   return size;
 }
 
-static bool by_area(const Rect* a, const Rect* b) {
-  return a->w*a->h > b->w*b->h;
+namespace {
+
+// A horizontal segment of the skyline. All the space below "y" (from
+// "x" to "x+w") is already used.
+struct SkylineNode {
+  int x, y, w;
+  SkylineNode(int x, int y, int w) : x(x), y(y), w(w) { }
+};
+
+typedef std::vector<SkylineNode> Skyline;
+
+struct ByArea {
+  const PackingRects::Rects& rects;
+  ByArea(const PackingRects::Rects& rects) : rects(rects) { }
+  bool operator()(int a, int b) const {
+    return rects[a].w*rects[a].h > rects[b].w*rects[b].h;
+  }
+};
+
+// Returns the "y" where a rectangle of the given size can be placed
+// starting at the i-th node of the skyline, or -1 if it doesn't fit.
+int fit_in_skyline(const Skyline& skyline, int i, int w, int h, const Size& size)
+{
+  int x = skyline[i].x;
+  if (x+w > size.w)
+    return -1;
+
+  int y = skyline[i].y;
+  int widthLeft = w;
+  for (; widthLeft > 0; ++i) {
+    y = std::max(y, skyline[i].y);
+    if (y+h > size.h)
+      return -1;
+    widthLeft -= skyline[i].w;
+  }
+  return y;
+}
+
+void add_to_skyline(Skyline& skyline, int i, const Rect& rc)
+{
+  skyline.insert(skyline.begin()+i, SkylineNode(rc.x, rc.y+rc.h, rc.w));
+
+  // Shrink or remove the nodes below the new one
+  for (++i; i < int(skyline.size()); ) {
+    SkylineNode& node = skyline[i];
+    int shrink = rc.x+rc.w - node.x;
+    if (shrink <= 0)
+      break;
+
+    if (shrink < node.w) {
+      node.x += shrink;
+      node.w -= shrink;
+      break;
+    }
+    skyline.erase(skyline.begin()+i);
+  }
+
+  // Merge contiguous nodes at the same height
+  for (i=0; i < int(skyline.size())-1; ) {
+    if (skyline[i].y == skyline[i+1].y) {
+      skyline[i].w += skyline[i+1].w;
+      skyline.erase(skyline.begin()+i+1);
+    }
+    else
+      ++i;
+  }
 }
 
+} // anonymous namespace
+
 bool PackingRects::pack(const Size& size)
 {
   m_bounds = Rect(size);
 
-  // We cannot sort m_rects because we want to 
-  std::vector<Rect*> rectPtrs(m_rects.size());
-  int i = 0;
-  for (auto& rc : m_rects)
-    rectPtrs[i++] = &rc;
-  std::sort(rectPtrs.begin(), rectPtrs.end(), by_area);
-
-  gfx::Region rgn(m_bounds);
-  for (auto rcPtr : rectPtrs) {
-    gfx::Rect& rc = *rcPtr;
-
-    for (int v=0; v<=m_bounds.h-rc.h; ++v) {
-      for (int u=0; u<=m_bounds.w-rc.w; ++u) {
-        gfx::Rect possible(u, v, rc.w, rc.h);
-        Region::Overlap overlap = rgn.contains(possible);
-        if (overlap == Region::In) {
-          rc = possible;
-          rgn.createSubtraction(rgn, gfx::Region(rc));
-          goto next_rc;
+  // Undo the rotations of a previous pack() call
+  for (int i=0; i<int(m_rects.size()); ++i) {
+    if (m_rotated[i]) {
+      std::swap(m_rects[i].w, m_rects[i].h);
+      m_rotated[i] = false;
+    }
+  }
+
+  // We cannot sort m_rects because we want to keep the same order
+  // given by the user, so we sort indexes (the stable sort keeps
+  // rects with the same area in the user order).
+  std::vector<int> order(m_rects.size());
+  for (int i=0; i<int(order.size()); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), ByArea(m_rects));
+
+  Skyline skyline;
+  skyline.push_back(SkylineNode(0, 0, size.w));
+
+  for (int index : order) {
+    Rect& rc = m_rects[index];
+    if (rc.w <= 0 || rc.h <= 0) {
+      rc.x = rc.y = 0;
+      continue;
+    }
+
+    int bestNode = -1;
+    int bestX = 0, bestY = 0;
+    bool bestRotated = false;
+
+    for (int rotated=0; rotated<(m_allowRotation && rc.w != rc.h ? 2: 1); ++rotated) {
+      int w = (rotated ? rc.h: rc.w);
+      int h = (rotated ? rc.w: rc.h);
+
+      for (int i=0; i<int(skyline.size()); ++i) {
+        int y = fit_in_skyline(skyline, i, w, h, size);
+        if (y < 0)
+          continue;
+
+        // Bottom-left rule: the lowest position, and then the leftmost one
+        int x = skyline[i].x;
+        if (bestNode < 0 || y < bestY || (y == bestY && x < bestX)) {
+          bestNode = i;
+          bestX = x;
+          bestY = y;
+          bestRotated = (rotated ? true: false);
         }
       }
     }
-    return false; // There is not enough room for "rc"
-  next_rc:;
+
+    if (bestNode < 0)
+      return false; // There is not enough room for "rc"
+
+    if (bestRotated) {
+      std::swap(rc.w, rc.h);
+      m_rotated[index] = true;
+    }
+    rc.x = bestX;
+    rc.y = bestY;
+    add_to_skyline(skyline, bestNode, rc);
   }
 
   return true;
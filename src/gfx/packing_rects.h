@@ -14,12 +14,17 @@
 
 namespace gfx {
 
-  // TODO add support for rotations
+  // Packs rectangles in a texture using a skyline bottom-left
+  // algorithm. Bigger rectangles are placed first, each one in the
+  // lowest (and then leftmost) position where it fits, so the result
+  // is always the same for the same input.
   class PackingRects {
   public:
     typedef std::vector<Rect> Rects;
     typedef Rects::const_iterator const_iterator;
 
+    PackingRects() : m_allowRotation(false) { }
+
     // Iterate over all given rectangles (in the same order they where
     // given in addSize() calls).
     const_iterator begin() const { return m_rects.begin(); }
@@ -43,9 +48,21 @@ namespace gfx {
     // Returns the bounds of the packed area.
     const Rect& bounds() const { return m_bounds; }
 
+    // If rotations are allowed, pack() can swap the width and height
+    // of a rectangle when it fits better in that way. Disabled by
+    // default.
+    bool allowRotation() const { return m_allowRotation; }
+    void setAllowRotation(bool state) { m_allowRotation = state; }
+
+    // Returns true if the i-th rectangle was rotated 90 degrees in the
+    // last pack() call.
+    bool isRotated(int i) const { return m_rotated[i]; }
+
   private:
     Rect m_bounds;
     Rects m_rects;
+    std::vector<bool> m_rotated;
+    bool m_allowRotation;
   };
 
 } // namespace gfx
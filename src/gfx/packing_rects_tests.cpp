@@ -7,6 +7,7 @@
 #include <gtest/gtest.h>
 
 #include "gfx/packing_rects.h"
+#include "gfx/point.h"
 #include "gfx/rect_io.h"
 #include "gfx/size.h"
 
@@ -89,6 +90,37 @@ TEST(PackingRects, KeepSameRectsOrder)
   EXPECT_EQ(Rect(0, 0, 30, 30), pr[2]);
 }
 
+TEST(PackingRects, Rotation)
+{
+  PackingRects pr;
+  pr.add(Size(10, 40));
+  EXPECT_FALSE(pr.pack(Size(40, 10)));
+
+  pr.setAllowRotation(true);
+  EXPECT_TRUE(pr.pack(Size(40, 10)));
+  EXPECT_TRUE(pr.isRotated(0));
+  EXPECT_EQ(Rect(0, 0, 40, 10), pr[0]);
+
+  // The original size is used again in the next pack()
+  EXPECT_TRUE(pr.pack(Size(10, 40)));
+  EXPECT_FALSE(pr.isRotated(0));
+  EXPECT_EQ(Rect(0, 0, 10, 40), pr[0]);
+}
+
+TEST(PackingRects, ManyRectsDontOverlap)
+{
+  PackingRects pr;
+  for (int i=0; i<5000; ++i)
+    pr.add(Size(1 + (i*7) % 23, 1 + (i*13) % 31));
+  Size size = pr.bestFit();
+
+  for (int i=0; i<int(pr.size()); ++i) {
+    EXPECT_TRUE(Rect(size).contains(pr[i]));
+    for (int j=i+1; j<int(pr.size()); ++j)
+      ASSERT_TRUE(pr[i].createIntersect(pr[j]).isEmpty());
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);